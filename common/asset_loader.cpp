@@ -0,0 +1,370 @@
+/* asset_loader.cpp
+ Worker pool and upload queue for asynchronous asset loading
+*/
+
+#include "asset_loader.h"
+#include "gl_counters.h"
+#include "texture_cache.h"
+#include "ktx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+using namespace std;
+
+
+AssetLoader::AssetLoader(GLuint numThreads)
+{
+	inFlight = 0;
+	stopping = false;
+
+	if (numThreads == 0) numThreads = thread::hardware_concurrency();
+	if (numThreads == 0) numThreads = 2;
+
+	for (GLuint i = 0; i < numThreads; i++)
+		workers.push_back(thread(&AssetLoader::workerLoop, this));
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+	for (auto &w : workers) w.join();
+}
+
+void AssetLoader::workerLoop()
+{
+	while (true)
+	{
+		Job job;
+		{
+			unique_lock<mutex> lock(jobMutex);
+			jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (stopping) return;
+			job = jobs.front();
+			jobs.pop_front();
+		}
+
+		if (job.work) job.work();
+
+		{
+			lock_guard<mutex> lock(uploadMutex);
+			uploads.push_back(job.upload);
+		}
+		uploadReady.notify_one();
+	}
+}
+
+void AssetLoader::submit(function<void()> work, function<void()> upload)
+{
+	{
+		lock_guard<mutex> lock(uploadMutex);
+		inFlight++;
+	}
+	{
+		lock_guard<mutex> lock(jobMutex);
+		Job job;
+		job.work = work;
+		job.upload = upload;
+		jobs.push_back(job);
+	}
+	jobReady.notify_one();
+}
+
+void AssetLoader::loadTexture(const char *filename, GLuint &texID, bool bGenMipmaps, bool flip)
+{
+	// Placeholder: a single mid grey texel until the real image arrives
+	static const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+	glGenTextures(1, &texID);
+	glBindTexture(GL_TEXTURE_2D, texID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	GLuint id = texID;
+	string name = filename;
+	shared_ptr<MipChain> chain(new MipChain());
+	shared_ptr<CompressedTexture> compressed(new CompressedTexture());
+	shared_ptr<bool> loaded(new bool(false));
+
+	submit(
+		[chain, compressed, loaded, name, flip]()
+		{
+			// Prefer a block compressed <image>.ktx made by the texcompress tool.
+			// Compressed blocks cannot be flipped cheaply, so only unflipped loads use it
+			if (!flip && compressed->load(name + ".ktx"))
+			{
+				if (compressedFormatSupported(compressed->internalFormat)) return;
+				compressed->levelData.clear();
+			}
+
+			// Mapped from the mip cache when possible, decoded otherwise
+			*loaded = loadMipChain(name.c_str(), flip, *chain);
+		},
+		[chain, compressed, loaded, name, id, bGenMipmaps]()
+		{
+			if (!compressed->levelData.empty())
+			{
+				glBindTexture(GL_TEXTURE_2D, id);
+				if (!bGenMipmaps) compressed->levelData.resize(1);
+				compressed->upload();
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, bGenMipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+				glBindTexture(GL_TEXTURE_2D, 0);
+				return;
+			}
+
+			if (!*loaded)
+			{
+				printf("stb_image  loading error: filename=%s\n", name.c_str());
+				return;
+			}
+
+			glBindTexture(GL_TEXTURE_2D, id);
+			if (bGenMipmaps)
+			{
+				// The CPU built chain replaces glGenerateMipmap
+				chain->upload();
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			}
+			else
+			{
+				chain->levels.resize(1);
+				chain->upload();
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		});
+}
+
+/* A texture array being filled a layer and a mip level at a time */
+struct ArrayUpload
+{
+	ArrayUpload(GLuint count) : count(count), layers(count), compressed(count) {}
+
+	GLuint id;
+	GLuint count;
+	GLuint layerSize;
+	GLuint numLevels;
+	GLenum compressedFormat;			// 0 when the layers are decoded to RGBA8
+
+	std::vector<MipChain> layers;
+	std::vector<CompressedTexture> compressed;
+	std::vector<GLuint> firstLevel;		// KTX level of layerSize x layerSize
+
+	std::vector<GLuint> levelsDone;		// Layers uploaded at each level
+	GLuint baseLevel;					// Finest level complete in every layer
+};
+
+/* Decode one image and resample it to an RGBA layer with a full mip chain */
+static void buildLayer(const string &name, GLuint layerSize, MipChain &layer)
+{
+	MipChain source;
+	vector<unsigned char> rgba((size_t)layerSize * layerSize * 4, 128);
+	if (loadMipChain(name.c_str(), false, source))
+	{
+		// Resample from the smallest mip that is still at least the layer size
+		GLuint l = 0;
+		while (l + 1 < source.levels.size() && source.levels[l + 1].width >= layerSize && source.levels[l + 1].height >= layerSize) l++;
+		const MipLevel &level = source.levels[l];
+
+		vector<unsigned char> expanded((size_t)level.width * level.height * 4);
+		const unsigned char *src = source.level(l);
+		for (size_t p = 0; p < (size_t)level.width * level.height; p++)
+			for (GLuint c = 0; c < 4; c++)
+				expanded[p * 4 + c] = c < source.channels ? src[p * source.channels + c] : (c == 3 ? 255 : src[p * source.channels]);
+
+		resampleBilinear(expanded.data(), level.width, level.height, 4, rgba.data(), layerSize, layerSize);
+	}
+	else
+	{
+		printf("stb_image  loading error: filename=%s\n", name.c_str());
+	}
+	layer.build(rgba.data(), layerSize, layerSize, 4);
+}
+
+/* Upload one level of one layer, then queue the next finer level. The
+   array samples from the finest level every layer has reached */
+void AssetLoader::uploadArrayLevel(shared_ptr<ArrayUpload> array, GLuint layer, GLuint level)
+{
+	GLuint size = max(array->layerSize >> level, 1u);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, array->id);
+	if (array->compressedFormat)
+	{
+		const CompressedTexture &texture = array->compressed[layer];
+		GLuint l = array->firstLevel[layer] + level;
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, size, size, 1, array->compressedFormat,
+			texture.levelSize[l], texture.levelData[l]);
+	}
+	else
+	{
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+			array->layers[layer].level(level));
+	}
+
+	array->levelsDone[level]++;
+	GLuint base = array->baseLevel;
+	while (base > 0 && array->levelsDone[base - 1] == array->count) base--;
+	if (base != array->baseLevel)
+	{
+		array->baseLevel = base;
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, (GLint)base);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// The pixels are freed with the last of these steps
+	if (level > 0) queueUpload([this, array, layer, level]() { uploadArrayLevel(array, layer, level - 1); });
+}
+
+void AssetLoader::loadTextureArray(const char **filenames, GLuint count, GLuint &texID, GLuint layerSize)
+{
+	shared_ptr<ArrayUpload> array(new ArrayUpload(count));
+	array->layerSize = layerSize;
+	array->numLevels = 1;
+	while ((layerSize >> array->numLevels) > 0) array->numLevels++;
+	array->firstLevel.assign(count, 0);
+	array->levelsDone.assign(array->numLevels, 0);
+	array->baseLevel = array->numLevels - 1;
+
+	// The layers are only stored compressed if every image has a <image>.ktx
+	// from the texcompress tool in one format, with a level of the layer size
+	// and all the levels below it. Mapping the files only reads their headers
+	array->compressedFormat = 0;
+	bool compressed = true;
+	for (GLuint i = 0; i < count && compressed; i++)
+	{
+		CompressedTexture &texture = array->compressed[i];
+		compressed = texture.load(string(filenames[i]) + ".ktx") && compressedFormatSupported(texture.internalFormat)
+			&& (i == 0 || texture.internalFormat == array->compressed[0].internalFormat);
+		GLuint &first = array->firstLevel[i];
+		while (compressed && first < texture.levelData.size() && max(texture.width >> first, 1u) > layerSize) first++;
+		compressed = compressed && texture.width >> first == layerSize && texture.height >> first == layerSize
+			&& texture.levelData.size() - first == array->numLevels;
+	}
+	if (compressed) array->compressedFormat = array->compressed[0].internalFormat;
+	else array->compressed.clear();
+
+	// Storage for every level is made now, and a placeholder fills the
+	// coarsest level, which is all the array samples until more arrive
+	glGenTextures(1, &texID);
+	array->id = texID;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texID);
+	for (GLuint l = 0; l < array->numLevels; l++)
+	{
+		GLuint size = max(layerSize >> l, 1u);
+		if (compressed)
+		{
+			GLuint levelSize = array->compressed[0].levelSize[array->firstLevel[0] + l];
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l, array->compressedFormat, size, size, count, 0, levelSize * count, NULL);
+		}
+		else
+		{
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGBA8, size, size, count, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		}
+	}
+	GLuint last = array->numLevels - 1;
+	if (compressed)
+	{
+		for (GLuint i = 0; i < count; i++)
+		{
+			const CompressedTexture &texture = array->compressed[i];
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, last, 0, 0, i, 1, 1, 1, array->compressedFormat,
+				texture.levelSize[array->firstLevel[i] + last], texture.levelData[array->firstLevel[i] + last]);
+		}
+	}
+	else
+	{
+		vector<unsigned char> placeholder(count * 4, 128);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, last, 0, 0, 0, 1, 1, count, GL_RGBA, GL_UNSIGNED_BYTE, placeholder.data());
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, (GLint)last);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)last);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// One job per layer, so the images decode side by side. A compressed
+	// layer only has its mapped pages read in, so the uploads do not wait on the disk
+	for (GLuint i = 0; i < count; i++)
+	{
+		string name = filenames[i];
+		submit(
+			[array, i, name]()
+			{
+				if (!array->compressedFormat)
+				{
+					buildLayer(name, array->layerSize, array->layers[i]);
+					return;
+				}
+				const CompressedTexture &texture = array->compressed[i];
+				volatile unsigned char touch = 0;
+				for (GLuint l = array->firstLevel[i]; l < texture.levelData.size(); l++)
+					for (GLuint b = 0; b < texture.levelSize[l]; b += 4096) touch ^= texture.levelData[l][b];
+			},
+			[this, array, i]() { uploadArrayLevel(array, i, array->numLevels - 1); });
+	}
+}
+
+void AssetLoader::pump(double budget_ms)
+{
+	auto start = chrono::steady_clock::now();
+	while (true)
+	{
+		function<void()> upload;
+		{
+			lock_guard<mutex> lock(uploadMutex);
+			if (uploads.empty()) return;
+			upload = uploads.front();
+			uploads.pop_front();
+		}
+
+		if (upload) upload();
+
+		{
+			lock_guard<mutex> lock(uploadMutex);
+			inFlight--;
+		}
+
+		double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		if (elapsed >= budget_ms) return;
+	}
+}
+
+void AssetLoader::finish()
+{
+	while (pending() > 0)
+	{
+		{
+			unique_lock<mutex> lock(uploadMutex);
+			uploadReady.wait(lock, [this] { return !uploads.empty() || inFlight == 0; });
+		}
+		pump(1e9);
+	}
+}
+
+void AssetLoader::queueUpload(function<void()> upload)
+{
+	{
+		lock_guard<mutex> lock(uploadMutex);
+		inFlight++;
+		uploads.push_back(upload);
+	}
+	uploadReady.notify_one();
+}
+
+GLuint AssetLoader::pending()
+{
+	lock_guard<mutex> lock(uploadMutex);
+	return inFlight;
+}
@@ -0,0 +1,75 @@
+/* asset_loader.h
+ Asynchronous asset loading. File I/O and decoding run on a pool of worker
+ threads, the GL upload of each finished asset is queued and run on the main
+ thread by pump() within a per-frame time budget so a frame never waits on
+ a large texture.
+ Textures get a 1x1 placeholder immediately so they can be bound straight
+ away; meshes are skipped by their draw call until uploaded.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ArrayUpload;
+
+class AssetLoader
+{
+public:
+	AssetLoader(GLuint numThreads = 0);		// 0 = one worker per hardware thread
+	~AssetLoader();
+
+	/* Queue a texture. texID is valid (and shows the placeholder colour) on return */
+	void loadTexture(const char *filename, GLuint &texID, bool bGenMipmaps, bool flip = true);
+
+	/* Queue several images packed as the layers of one GL_TEXTURE_2D_ARRAY.
+	   When every image has a <image>.ktx in one format with a layerSize level
+	   the compressed levels are used, otherwise every layer is resampled to
+	   layerSize x layerSize RGBA with a full mip chain. Each layer decodes on
+	   its own worker and uploads one mip level per step, coarsest first */
+	void loadTextureArray(const char **filenames, GLuint count, GLuint &texID, GLuint layerSize);
+
+	/* Generic job: work runs on a worker, upload runs on the GL thread afterwards */
+	void submit(std::function<void()> work, std::function<void()> upload);
+
+	/* Run queued uploads on the GL thread until budget_ms is used up.
+	   At least one upload runs per call so loading always makes progress */
+	void pump(double budget_ms);
+
+	/* Block until every queued asset has been uploaded */
+	void finish();
+
+	GLuint pending();
+
+private:
+	struct Job
+	{
+		std::function<void()> work;
+		std::function<void()> upload;
+	};
+
+	void workerLoop();
+
+	/* Queue work for the GL thread directly, from the GL thread */
+	void queueUpload(std::function<void()> upload);
+
+	void uploadArrayLevel(std::shared_ptr<ArrayUpload> array, GLuint layer, GLuint level);
+
+	std::vector<std::thread> workers;
+	std::deque<Job> jobs;				// Waiting for a worker
+	std::deque<std::function<void()> > uploads;	// Decoded, waiting for the GL thread
+	std::mutex jobMutex;
+	std::mutex uploadMutex;
+	std::condition_variable jobReady;
+	std::condition_variable uploadReady;
+	GLuint inFlight;					// Submitted but not uploaded yet
+	bool stopping;
+};
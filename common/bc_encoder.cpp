@@ -0,0 +1,589 @@
+/* bc_encoder.cpp
+ BC1/BC3/BC7 block encoders and decoders
+*/
+
+#include "bc_encoder.h"
+
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BC_ENCODER_SSE2
+#endif
+
+using namespace std;
+
+unsigned int bcBlockSize(BCFormat format)
+{
+	return format == BC_FORMAT_BC1 ? 8 : 16;
+}
+
+unsigned int bcImageSize(BCFormat format, unsigned int width, unsigned int height)
+{
+	return ((width + 3) / 4) * ((height + 3) / 4) * bcBlockSize(format);
+}
+
+
+/* Index of the palette entry closest to each pixel. SSE2 compares one pixel
+   against four palette entries at a time */
+static void nearestIndices(const float *pixels, int numChannels, const float palette[][4], int numEntries, int *indices)
+{
+	for (int p = 0; p < 16; p++)
+	{
+		const float *px = pixels + p * 4;
+		float best = 1e30f;
+		int bestIndex = 0;
+#ifdef BC_ENCODER_SSE2
+		for (int e = 0; e < numEntries; e += 4)
+		{
+			__m128 d = _mm_setzero_ps();
+			for (int c = 0; c < numChannels; c++)
+			{
+				__m128 pal = _mm_set_ps(palette[e + 3][c], palette[e + 2][c], palette[e + 1][c], palette[e][c]);
+				__m128 diff = _mm_sub_ps(pal, _mm_set1_ps(px[c]));
+				d = _mm_add_ps(d, _mm_mul_ps(diff, diff));
+			}
+			float dist[4];
+			_mm_storeu_ps(dist, d);
+			for (int k = 0; k < 4 && e + k < numEntries; k++)
+			{
+				if (dist[k] < best) { best = dist[k]; bestIndex = e + k; }
+			}
+		}
+#else
+		for (int e = 0; e < numEntries; e++)
+		{
+			float dist = 0;
+			for (int c = 0; c < numChannels; c++)
+			{
+				float diff = palette[e][c] - px[c];
+				dist += diff * diff;
+			}
+			if (dist < best) { best = dist; bestIndex = e; }
+		}
+#endif
+		indices[p] = bestIndex;
+	}
+}
+
+/* Principal axis endpoints: project onto the main axis of the colour
+   distribution (power iteration on the covariance) and take the extremes */
+static void principalEndpoints(const float *pixels, int numChannels, float lo[4], float hi[4])
+{
+	float mean[4] = { 0, 0, 0, 0 };
+	for (int p = 0; p < 16; p++)
+		for (int c = 0; c < numChannels; c++) mean[c] += pixels[p * 4 + c] / 16.f;
+
+	float cov[4][4] = {};
+	for (int p = 0; p < 16; p++)
+		for (int i = 0; i < numChannels; i++)
+			for (int j = 0; j < numChannels; j++)
+				cov[i][j] += (pixels[p * 4 + i] - mean[i]) * (pixels[p * 4 + j] - mean[j]);
+
+	float axis[4] = { 1, 1, 1, 1 };
+	for (int it = 0; it < 8; it++)
+	{
+		float next[4] = { 0, 0, 0, 0 };
+		float len = 0;
+		for (int i = 0; i < numChannels; i++)
+		{
+			for (int j = 0; j < numChannels; j++) next[i] += cov[i][j] * axis[j];
+			len += next[i] * next[i];
+		}
+		if (len <= 1e-12f) break;
+		len = sqrt(len);
+		for (int i = 0; i < numChannels; i++) axis[i] = next[i] / len;
+	}
+
+	float tmin = 1e30f, tmax = -1e30f;
+	for (int p = 0; p < 16; p++)
+	{
+		float t = 0;
+		for (int c = 0; c < numChannels; c++) t += (pixels[p * 4 + c] - mean[c]) * axis[c];
+		if (t < tmin) tmin = t;
+		if (t > tmax) tmax = t;
+	}
+	for (int c = 0; c < numChannels; c++)
+	{
+		lo[c] = fmin(fmax(mean[c] + tmin * axis[c], 0.f), 255.f);
+		hi[c] = fmin(fmax(mean[c] + tmax * axis[c], 0.f), 255.f);
+	}
+}
+
+/* Least squares endpoints for a fixed set of interpolation weights */
+static bool refineEndpoints(const float *pixels, int numChannels, const int *indices, const float *weights, float lo[4], float hi[4])
+{
+	float aa = 0, ab = 0, bb = 0;
+	float ax[4] = { 0, 0, 0, 0 }, bx[4] = { 0, 0, 0, 0 };
+	for (int p = 0; p < 16; p++)
+	{
+		float w = weights[indices[p]];
+		float a = 1.f - w, b = w;
+		aa += a * a; ab += a * b; bb += b * b;
+		for (int c = 0; c < numChannels; c++)
+		{
+			ax[c] += a * pixels[p * 4 + c];
+			bx[c] += b * pixels[p * 4 + c];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (fabs(det) < 1e-6f) return false;
+	for (int c = 0; c < numChannels; c++)
+	{
+		lo[c] = fmin(fmax((bb * ax[c] - ab * bx[c]) / det, 0.f), 255.f);
+		hi[c] = fmin(fmax((aa * bx[c] - ab * ax[c]) / det, 0.f), 255.f);
+	}
+	return true;
+}
+
+static void loadBlock(const unsigned char *rgba, float *pixels)
+{
+	for (int i = 0; i < 64; i++) pixels[i] = rgba[i];
+}
+
+
+/* ---- BC1 ---- */
+
+static inline unsigned short packRGB565(const float c[4])
+{
+	int r = (int)(c[0] * 31.f / 255.f + 0.5f);
+	int g = (int)(c[1] * 63.f / 255.f + 0.5f);
+	int b = (int)(c[2] * 31.f / 255.f + 0.5f);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static inline void unpackRGB565(unsigned short v, float c[4])
+{
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (float)((r << 3) | (r >> 2));
+	c[1] = (float)((g << 2) | (g >> 4));
+	c[2] = (float)((b << 3) | (b >> 2));
+	c[3] = 255.f;
+}
+
+static void bc1Palette(unsigned short c0, unsigned short c1, float palette[4][4])
+{
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	for (int c = 0; c < 4; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3.f;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3.f;
+	}
+}
+
+static float blockError(const float *pixels, int numChannels, const float palette[][4], const int *indices)
+{
+	float err = 0;
+	for (int p = 0; p < 16; p++)
+		for (int c = 0; c < numChannels; c++)
+		{
+			float d = palette[indices[p]][c] - pixels[p * 4 + c];
+			err += d * d;
+		}
+	return err;
+}
+
+/* Encode the colour half of a BC1/BC3 block in four colour mode */
+static void encodeColourBlock(const float *pixels, unsigned char *block)
+{
+	// Weight of colour1 for each index
+	static const float weights[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+	float lo[4], hi[4];
+	principalEndpoints(pixels, 3, lo, hi);
+
+	unsigned short bestC0 = 0, bestC1 = 0;
+	int bestIndices[16] = {};
+	float bestError = 1e30f;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		unsigned short c0 = packRGB565(hi), c1 = packRGB565(lo);
+		if (c0 < c1) { unsigned short t = c0; c0 = c1; c1 = t; }
+
+		float palette[4][4];
+		int indices[16];
+		bc1Palette(c0, c1, palette);
+		if (c0 == c1)
+			memset(indices, 0, sizeof(indices));
+		else
+			nearestIndices(pixels, 3, palette, 4, indices);
+
+		float err = blockError(pixels, 3, palette, indices);
+		if (err < bestError)
+		{
+			bestError = err;
+			bestC0 = c0; bestC1 = c1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+
+		// Second pass: least squares fit of colour0 and colour1 to the chosen indices
+		if (!refineEndpoints(pixels, 3, indices, weights, hi, lo)) break;
+	}
+
+	block[0] = bestC0 & 0xff; block[1] = bestC0 >> 8;
+	block[2] = bestC1 & 0xff; block[3] = bestC1 >> 8;
+	unsigned int bits = 0;
+	for (int p = 0; p < 16; p++) bits |= (unsigned int)bestIndices[p] << (p * 2);
+	block[4] = bits & 0xff; block[5] = (bits >> 8) & 0xff; block[6] = (bits >> 16) & 0xff; block[7] = bits >> 24;
+}
+
+void encodeBC1Block(const unsigned char *rgba, unsigned char *block)
+{
+	float pixels[64];
+	loadBlock(rgba, pixels);
+	encodeColourBlock(pixels, block);
+}
+
+static void decodeColourBlock(const unsigned char *block, unsigned char *rgba, bool allowThreeColour)
+{
+	unsigned short c0 = block[0] | (block[1] << 8);
+	unsigned short c1 = block[2] | (block[3] << 8);
+	unsigned int bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned int)block[7] << 24);
+
+	float palette[4][4];
+	bc1Palette(c0, c1, palette);
+	if (allowThreeColour && c0 <= c1)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2.f;
+			palette[3][c] = 0.f;
+		}
+		palette[3][3] = 0.f;
+	}
+
+	for (int p = 0; p < 16; p++)
+	{
+		int i = (bits >> (p * 2)) & 3;
+		for (int c = 0; c < 4; c++) rgba[p * 4 + c] = (unsigned char)(palette[i][c] + 0.5f);
+	}
+}
+
+void decodeBC1Block(const unsigned char *block, unsigned char *rgba)
+{
+	decodeColourBlock(block, rgba, true);
+}
+
+
+/* ---- BC3 (BC4 alpha + BC1 colour) ---- */
+
+static void alphaPalette(int a0, int a1, float palette[8][4])
+{
+	palette[0][0] = (float)a0;
+	palette[1][0] = (float)a1;
+	for (int i = 1; i < 7; i++)
+		palette[i + 1][0] = (float)(((7 - i) * a0 + i * a1) / 7);
+}
+
+void encodeBC3Block(const unsigned char *rgba, unsigned char *block)
+{
+	float pixels[64];
+	loadBlock(rgba, pixels);
+
+	// Alpha: eight interpolated values between the block's max and min
+	int amin = 255, amax = 0;
+	for (int p = 0; p < 16; p++)
+	{
+		int a = rgba[p * 4 + 3];
+		if (a < amin) amin = a;
+		if (a > amax) amax = a;
+	}
+
+	int indices[16] = {};
+	if (amax > amin)
+	{
+		float palette[8][4];
+		alphaPalette(amax, amin, palette);
+		float alpha[64];
+		for (int p = 0; p < 16; p++) alpha[p * 4] = pixels[p * 4 + 3];
+		nearestIndices(alpha, 1, palette, 8, indices);
+	}
+
+	block[0] = (unsigned char)amax;
+	block[1] = (unsigned char)amin;
+	unsigned long long bits = 0;
+	for (int p = 0; p < 16; p++) bits |= (unsigned long long)indices[p] << (p * 3);
+	for (int i = 0; i < 6; i++) block[2 + i] = (bits >> (i * 8)) & 0xff;
+
+	encodeColourBlock(pixels, block + 8);
+}
+
+void decodeBC3Block(const unsigned char *block, unsigned char *rgba)
+{
+	decodeColourBlock(block + 8, rgba, false);
+
+	int a0 = block[0], a1 = block[1];
+	float palette[8][4];
+	alphaPalette(a0, a1, palette);
+	if (a0 <= a1)
+	{
+		// Six value mode with explicit 0 and 255
+		for (int i = 1; i < 5; i++) palette[i + 1][0] = (float)(((5 - i) * a0 + i * a1) / 5);
+		palette[6][0] = 0.f;
+		palette[7][0] = 255.f;
+	}
+
+	unsigned long long bits = 0;
+	for (int i = 0; i < 6; i++) bits |= (unsigned long long)block[2 + i] << (i * 8);
+	for (int p = 0; p < 16; p++)
+		rgba[p * 4 + 3] = (unsigned char)palette[(bits >> (p * 3)) & 7][0];
+}
+
+
+/* ---- BC7 mode 6 ---- */
+
+static const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BitWriter
+{
+	unsigned char *bytes;
+	int pos;
+
+	void write(unsigned int value, int count)
+	{
+		for (int i = 0; i < count; i++, pos++)
+			if (value & (1u << i)) bytes[pos >> 3] |= (unsigned char)(1u << (pos & 7));
+	}
+};
+
+struct BitReader
+{
+	const unsigned char *bytes;
+	int pos;
+
+	unsigned int read(int count)
+	{
+		unsigned int value = 0;
+		for (int i = 0; i < count; i++, pos++)
+			if (bytes[pos >> 3] & (1u << (pos & 7))) value |= 1u << i;
+		return value;
+	}
+};
+
+/* Quantise an endpoint to 7 bits per channel plus a shared p-bit, picking the
+   p-bit that reproduces the endpoint best */
+static void quantiseBC7Endpoint(const float e[4], int q[4], int &pbit, float out[4])
+{
+	float bestError = 1e30f;
+	for (int p = 0; p < 2; p++)
+	{
+		int cand[4];
+		float err = 0;
+		for (int c = 0; c < 4; c++)
+		{
+			int v = (int)floor((e[c] - p) / 2.f + 0.5f);
+			if (v < 0) v = 0;
+			if (v > 127) v = 127;
+			cand[c] = v;
+			float d = (float)((v << 1) | p) - e[c];
+			err += d * d;
+		}
+		if (err < bestError)
+		{
+			bestError = err;
+			pbit = p;
+			for (int c = 0; c < 4; c++)
+			{
+				q[c] = cand[c];
+				out[c] = (float)((cand[c] << 1) | p);
+			}
+		}
+	}
+}
+
+static void bc7Palette(const float e0[4], const float e1[4], float palette[16][4])
+{
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			palette[i][c] = (float)(((64 - BC7_WEIGHTS4[i]) * (int)e0[c] + BC7_WEIGHTS4[i] * (int)e1[c] + 32) >> 6);
+}
+
+void encodeBC7Block(const unsigned char *rgba, unsigned char *block)
+{
+	float pixels[64];
+	loadBlock(rgba, pixels);
+
+	float lo[4], hi[4];
+	principalEndpoints(pixels, 4, lo, hi);
+
+	float weights[16];
+	for (int i = 0; i < 16; i++) weights[i] = BC7_WEIGHTS4[i] / 64.f;
+
+	int bestQ0[4], bestQ1[4], bestP0 = 0, bestP1 = 0, bestIndices[16];
+	float bestError = 1e30f;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		int q0[4], q1[4], p0, p1, indices[16];
+		float e0[4], e1[4], palette[16][4];
+		quantiseBC7Endpoint(lo, q0, p0, e0);
+		quantiseBC7Endpoint(hi, q1, p1, e1);
+		bc7Palette(e0, e1, palette);
+		nearestIndices(pixels, 4, palette, 16, indices);
+
+		float err = blockError(pixels, 4, palette, indices);
+		if (err < bestError)
+		{
+			bestError = err;
+			memcpy(bestQ0, q0, sizeof(q0)); memcpy(bestQ1, q1, sizeof(q1));
+			bestP0 = p0; bestP1 = p1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+
+		if (!refineEndpoints(pixels, 4, indices, weights, lo, hi)) break;
+	}
+
+	// The anchor (first) index is stored with 3 bits, so its top bit must be
+	// clear. Swap the endpoints and invert the indices when it is not
+	if (bestIndices[0] & 8)
+	{
+		for (int c = 0; c < 4; c++) { int t = bestQ0[c]; bestQ0[c] = bestQ1[c]; bestQ1[c] = t; }
+		int t = bestP0; bestP0 = bestP1; bestP1 = t;
+		for (int p = 0; p < 16; p++) bestIndices[p] = 15 - bestIndices[p];
+	}
+
+	memset(block, 0, 16);
+	BitWriter bw = { block, 0 };
+	bw.write(1 << 6, 7);		// Mode 6
+	for (int c = 0; c < 4; c++)
+	{
+		bw.write(bestQ0[c], 7);
+		bw.write(bestQ1[c], 7);
+	}
+	bw.write(bestP0, 1);
+	bw.write(bestP1, 1);
+	bw.write(bestIndices[0], 3);
+	for (int p = 1; p < 16; p++) bw.write(bestIndices[p], 4);
+}
+
+void decodeBC7Block(const unsigned char *block, unsigned char *rgba)
+{
+	BitReader br = { block, 0 };
+	if (br.read(7) != (1 << 6))
+	{
+		// Only mode 6 is produced by the encoder, show anything else as magenta
+		for (int p = 0; p < 16; p++)
+		{
+			rgba[p * 4] = 255; rgba[p * 4 + 1] = 0; rgba[p * 4 + 2] = 255; rgba[p * 4 + 3] = 255;
+		}
+		return;
+	}
+
+	int q0[4], q1[4];
+	for (int c = 0; c < 4; c++)
+	{
+		q0[c] = br.read(7);
+		q1[c] = br.read(7);
+	}
+	int p0 = br.read(1), p1 = br.read(1);
+
+	float e0[4], e1[4], palette[16][4];
+	for (int c = 0; c < 4; c++)
+	{
+		e0[c] = (float)((q0[c] << 1) | p0);
+		e1[c] = (float)((q1[c] << 1) | p1);
+	}
+	bc7Palette(e0, e1, palette);
+
+	for (int p = 0; p < 16; p++)
+	{
+		int i = br.read(p == 0 ? 3 : 4);
+		for (int c = 0; c < 4; c++) rgba[p * 4 + c] = (unsigned char)palette[i][c];
+	}
+}
+
+
+/* ---- Whole images ---- */
+
+/* Gather a 4x4 block as RGBA, repeating the last row/column past the edge */
+static void fetchBlock(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int channels,
+	unsigned int bx, unsigned int by, unsigned char *rgba)
+{
+	for (unsigned int y = 0; y < 4; y++)
+	{
+		unsigned int sy = by * 4 + y < height ? by * 4 + y : height - 1;
+		for (unsigned int x = 0; x < 4; x++)
+		{
+			unsigned int sx = bx * 4 + x < width ? bx * 4 + x : width - 1;
+			const unsigned char *src = pixels + ((size_t)sy * width + sx) * channels;
+			unsigned char *dst = rgba + (y * 4 + x) * 4;
+			dst[0] = src[0];
+			dst[1] = channels > 1 ? src[1] : src[0];
+			dst[2] = channels > 2 ? src[2] : src[0];
+			dst[3] = channels > 3 ? src[3] : 255;
+		}
+	}
+}
+
+void encodeImage(BCFormat format, const unsigned char *pixels, unsigned int width, unsigned int height,
+	unsigned int channels, unsigned char *out, unsigned int numThreads)
+{
+	unsigned int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	unsigned int blockSize = bcBlockSize(format);
+
+	if (numThreads == 0) numThreads = thread::hardware_concurrency();
+	if (numThreads == 0) numThreads = 1;
+	if (numThreads > blocksY) numThreads = blocksY;
+
+	auto encodeRows = [&](unsigned int first)
+	{
+		unsigned char rgba[64];
+		for (unsigned int by = first; by < blocksY; by += numThreads)
+			for (unsigned int bx = 0; bx < blocksX; bx++)
+			{
+				fetchBlock(pixels, width, height, channels, bx, by, rgba);
+				unsigned char *block = out + ((size_t)by * blocksX + bx) * blockSize;
+				if (format == BC_FORMAT_BC1) encodeBC1Block(rgba, block);
+				else if (format == BC_FORMAT_BC3) encodeBC3Block(rgba, block);
+				else encodeBC7Block(rgba, block);
+			}
+	};
+
+	vector<thread> threads;
+	for (unsigned int t = 1; t < numThreads; t++) threads.push_back(thread(encodeRows, t));
+	encodeRows(0);
+	for (auto &t : threads) t.join();
+}
+
+void decodeImage(BCFormat format, const unsigned char *blocks, unsigned int width, unsigned int height, unsigned char *rgba)
+{
+	unsigned int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	unsigned int blockSize = bcBlockSize(format);
+	unsigned char decoded[64];
+
+	for (unsigned int by = 0; by < blocksY; by++)
+		for (unsigned int bx = 0; bx < blocksX; bx++)
+		{
+			const unsigned char *block = blocks + ((size_t)by * blocksX + bx) * blockSize;
+			if (format == BC_FORMAT_BC1) decodeBC1Block(block, decoded);
+			else if (format == BC_FORMAT_BC3) decodeBC3Block(block, decoded);
+			else decodeBC7Block(block, decoded);
+
+			for (unsigned int y = 0; y < 4 && by * 4 + y < height; y++)
+				for (unsigned int x = 0; x < 4 && bx * 4 + x < width; x++)
+					memcpy(rgba + (((size_t)by * 4 + y) * width + bx * 4 + x) * 4, decoded + (y * 4 + x) * 4, 4);
+		}
+}
+
+double imagePSNR(BCFormat format, const unsigned char *pixels, unsigned int width, unsigned int height,
+	unsigned int channels, const unsigned char *blocks)
+{
+	vector<unsigned char> decoded((size_t)width * height * 4);
+	decodeImage(format, blocks, width, height, decoded.data());
+
+	unsigned int compared = (format == BC_FORMAT_BC1 && channels > 3) ? 3 : channels;
+	double sum = 0;
+	for (size_t i = 0; i < (size_t)width * height; i++)
+		for (unsigned int c = 0; c < compared; c++)
+		{
+			double d = (double)pixels[i * channels + c] - decoded[i * 4 + c];
+			sum += d * d;
+		}
+
+	double mse = sum / ((double)width * height * compared);
+	if (mse <= 0) return 99.0;
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,45 @@
+/* bc_encoder.h
+ Block compression (BC1, BC3 and BC7) encoders and decoders for 8-bit RGBA
+ images. BC7 uses mode 6 only (one subset, RGBA endpoints, 4-bit indices),
+ which suits the smooth photographic textures in this project.
+ Blocks are encoded on several threads with SSE2 used for the palette search.
+*/
+
+#pragma once
+
+#include <vector>
+
+enum BCFormat
+{
+	BC_FORMAT_BC1,		// RGB, 4 bits per pixel
+	BC_FORMAT_BC3,		// RGBA, 8 bits per pixel
+	BC_FORMAT_BC7		// RGBA, 8 bits per pixel, higher quality
+};
+
+/* Bytes per 4x4 block */
+unsigned int bcBlockSize(BCFormat format);
+
+/* Size in bytes of a compressed image */
+unsigned int bcImageSize(BCFormat format, unsigned int width, unsigned int height);
+
+/* Single 4x4 blocks, rgba points at 16 pixels of 4 bytes each */
+void encodeBC1Block(const unsigned char *rgba, unsigned char *block);
+void encodeBC3Block(const unsigned char *rgba, unsigned char *block);
+void encodeBC7Block(const unsigned char *rgba, unsigned char *block);
+void decodeBC1Block(const unsigned char *block, unsigned char *rgba);
+void decodeBC3Block(const unsigned char *block, unsigned char *rgba);
+void decodeBC7Block(const unsigned char *block, unsigned char *rgba);
+
+/* Compress a whole image with channels of 3 or 4. Edge blocks repeat the
+   last row and column. Rows of blocks are shared between numThreads threads */
+void encodeImage(BCFormat format, const unsigned char *pixels, unsigned int width, unsigned int height,
+	unsigned int channels, unsigned char *out, unsigned int numThreads = 0);
+
+/* Decompress a whole image to tightly packed RGBA */
+void decodeImage(BCFormat format, const unsigned char *blocks, unsigned int width, unsigned int height,
+	unsigned char *rgba);
+
+/* Peak signal to noise ratio in dB between an image and its compressed
+   version, over the channels present in the source */
+double imagePSNR(BCFormat format, const unsigned char *pixels, unsigned int width, unsigned int height,
+	unsigned int channels, const unsigned char *blocks);
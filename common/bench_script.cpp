@@ -0,0 +1,136 @@
+/* bench_script.cpp
+ Keyframe timelines and key event logs for benchmark runs
+*/
+
+#include "bench_script.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+bool Timeline::parse(const string &text, const string &source)
+{
+	channels.clear();
+	istringstream lines(text);
+	string line;
+	GLuint lineNumber = 0;
+	while (getline(lines, line))
+	{
+		lineNumber++;
+		size_t comment = line.find('#');
+		if (comment != string::npos) line.erase(comment);
+
+		istringstream words(line);
+		GLfloat frame;
+		if (!(words >> frame)) continue;
+
+		string word;
+		while (words >> word)
+		{
+			size_t equals = word.find('=');
+			GLfloat value;
+			if (equals == string::npos || equals == 0 || sscanf(word.c_str() + equals + 1, "%f", &value) != 1)
+			{
+				printf("%s:%u: expected channel=value, not %s\n", source.c_str(), lineNumber, word.c_str());
+				return false;
+			}
+			channels[word.substr(0, equals)].push_back(make_pair(frame, value));
+		}
+	}
+
+	for (auto &channel : channels)
+		stable_sort(channel.second.begin(), channel.second.end(),
+			[](const pair<GLfloat, GLfloat> &a, const pair<GLfloat, GLfloat> &b) { return a.first < b.first; });
+	return true;
+}
+
+bool Timeline::load(const char *filename)
+{
+	ifstream file(filename);
+	if (!file.is_open())
+	{
+		printf("Could not read timeline %s\n", filename);
+		return false;
+	}
+	stringstream text;
+	text << file.rdbuf();
+	return parse(text.str(), filename);
+}
+
+GLfloat Timeline::sample(const string &channel, GLfloat frame, GLfloat fallback) const
+{
+	auto it = channels.find(channel);
+	if (it == channels.end() || it->second.empty()) return fallback;
+
+	const vector<pair<GLfloat, GLfloat> > &keys = it->second;
+	if (frame <= keys.front().first) return keys.front().second;
+	if (frame >= keys.back().first) return keys.back().second;
+
+	auto after = upper_bound(keys.begin(), keys.end(), frame,
+		[](GLfloat f, const pair<GLfloat, GLfloat> &key) { return f < key.first; });
+	auto before = after - 1;
+	GLfloat t = (frame - before->first) / (after->first - before->first);
+	return before->second + (after->second - before->second) * t;
+}
+
+GLuint Timeline::length() const
+{
+	GLfloat last = 0;
+	for (const auto &channel : channels)
+		if (!channel.second.empty()) last = max(last, channel.second.back().first);
+	return (GLuint)last + 1;
+}
+
+InputLog::InputLog() : next(0)
+{
+}
+
+bool InputLog::load(const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file)
+	{
+		printf("Could not read input log %s\n", filename);
+		return false;
+	}
+
+	events.clear();
+	next = 0;
+	InputEvent event;
+	while (fscanf(file, "%u %d %d %d %d", &event.frame, &event.key, &event.scancode, &event.action, &event.mods) == 5)
+		events.push_back(event);
+	fclose(file);
+
+	stable_sort(events.begin(), events.end(), [](const InputEvent &a, const InputEvent &b) { return a.frame < b.frame; });
+	return true;
+}
+
+bool InputLog::save(const char *filename) const
+{
+	FILE *file = fopen(filename, "w");
+	if (!file)
+	{
+		printf("Could not write input log %s\n", filename);
+		return false;
+	}
+	for (const InputEvent &event : events)
+		fprintf(file, "%u %d %d %d %d\n", event.frame, event.key, event.scancode, event.action, event.mods);
+	fclose(file);
+	return true;
+}
+
+void InputLog::record(GLuint frame, int key, int scancode, int action, int mods)
+{
+	InputEvent event = { frame, key, scancode, action, mods };
+	events.push_back(event);
+}
+
+vector<InputEvent> InputLog::eventsFor(GLuint frame)
+{
+	vector<InputEvent> due;
+	while (next < events.size() && events[next].frame <= frame) due.push_back(events[next++]);
+	return due;
+}
@@ -0,0 +1,72 @@
+/* bench_script.h
+ Reproducible input for benchmark runs.
+
+ A Timeline holds keyframes of named channels, one keyframe per line:
+
+     # frame  channel=value ...
+     0    vy=0   step_back=0  particles=1000
+     240  vy=90  step_back=2
+     480  vx=-20 particles=250
+
+ sample() interpolates each channel linearly between the keyframes that
+ set it and holds the first and last values outside them, so channels move
+ independently. The application decides what each channel drives.
+
+ An InputLog records key events with the frame they arrived in and plays
+ them back on the same frames, one event per line:
+
+     frame key scancode action mods
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <map>
+#include <string>
+#include <vector>
+
+class Timeline
+{
+public:
+	/* Parse keyframes from text or a file; errors name the offending line */
+	bool parse(const std::string &text, const std::string &source = "timeline");
+	bool load(const char *filename);
+
+	bool has(const std::string &channel) const { return channels.count(channel) != 0; }
+
+	/* Value of channel at frame, or fallback if no keyframe sets it */
+	GLfloat sample(const std::string &channel, GLfloat frame, GLfloat fallback) const;
+
+	/* One past the last keyframe */
+	GLuint length() const;
+
+private:
+	// Per channel, keyframes sorted by frame
+	std::map<std::string, std::vector<std::pair<GLfloat, GLfloat> > > channels;
+};
+
+struct InputEvent
+{
+	GLuint frame;
+	int key, scancode, action, mods;
+};
+
+class InputLog
+{
+public:
+	InputLog();
+
+	bool load(const char *filename);
+	bool save(const char *filename) const;
+
+	void record(GLuint frame, int key, int scancode, int action, int mods);
+
+	/* Events recorded for frame, in order; call once per frame with
+	   increasing frame numbers */
+	std::vector<InputEvent> eventsFor(GLuint frame);
+
+	std::vector<InputEvent> events;
+
+private:
+	size_t next;				// First event not yet played back
+};
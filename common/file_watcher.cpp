@@ -0,0 +1,128 @@
+/* file_watcher.cpp
+ inotify watches on Linux, modification time polling elsewhere
+*/
+
+#include "file_watcher.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static string normalise(const string &path)
+{
+	string result = path;
+	replace(result.begin(), result.end(), '\\', '/');
+	return result;
+}
+
+static string directoryOf(const string &path)
+{
+	size_t slash = path.find_last_of('/');
+	return slash == string::npos ? "." : path.substr(0, slash);
+}
+
+bool FileWatcher::isWatching(const string &path) const
+{
+	return files.count(normalise(path)) != 0;
+}
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher()
+{
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyFd < 0) perror("FileWatcher: inotify_init1");
+}
+
+FileWatcher::~FileWatcher()
+{
+	if (inotifyFd >= 0) close(inotifyFd);
+}
+
+void FileWatcher::addFile(const string &path)
+{
+	string file = normalise(path);
+	files[file] = path;
+	if (inotifyFd < 0) return;
+
+	string directory = directoryOf(file);
+	for (const auto &watched : directories)
+		if (watched.second == directory) return;
+
+	// Closing after a write, or a file renamed into place
+	int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0) perror(("FileWatcher: " + directory).c_str());
+	else directories[wd] = directory;
+}
+
+vector<string> FileWatcher::changed()
+{
+	vector<string> result;
+	if (inotifyFd < 0) return result;
+
+	alignas(inotify_event) char buffer[4096];
+	ssize_t length;
+	while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+	{
+		for (char *p = buffer; p < buffer + length; p += sizeof(inotify_event) + ((inotify_event *)p)->len)
+		{
+			const inotify_event *event = (const inotify_event *)p;
+			auto directory = directories.find(event->wd);
+			if (directory == directories.end() || !event->len) continue;
+
+			auto file = files.find(directory->second + "/" + event->name);
+			if (file != files.end() && find(result.begin(), result.end(), file->second) == result.end())
+				result.push_back(file->second);
+		}
+	}
+	return result;
+}
+
+#else
+
+static long long modificationTime(const string &path)
+{
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 ? (long long)info.st_mtime : -1;
+}
+
+FileWatcher::FileWatcher() : lastPoll(chrono::steady_clock::now())
+{
+}
+
+FileWatcher::~FileWatcher()
+{
+}
+
+void FileWatcher::addFile(const string &path)
+{
+	string file = normalise(path);
+	files[file] = path;
+	modified[file] = modificationTime(path);
+}
+
+vector<string> FileWatcher::changed()
+{
+	vector<string> result;
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	if (now - lastPoll < chrono::milliseconds(POLL_INTERVAL_MS)) return result;
+	lastPoll = now;
+
+	for (auto &file : modified)
+	{
+		long long time = modificationTime(files[file.first]);
+		if (time == file.second || time < 0) continue;
+		file.second = time;
+		result.push_back(files[file.first]);
+	}
+	return result;
+}
+
+#endif
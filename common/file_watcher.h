@@ -0,0 +1,45 @@
+/* file_watcher.h
+ Reports files that have been written since the last call to changed().
+ On Linux the directories holding the files are watched with inotify and
+ changed() only drains the pending events, so it costs one non-blocking
+ read per call. Elsewhere changed() compares modification times, at most
+ every POLL_INTERVAL_MS.
+ Editors that save by writing a new file and renaming it over the old one
+ are seen as a change too.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+class FileWatcher
+{
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	/* Watch one file; the path is returned by changed() as given here */
+	void addFile(const std::string &path);
+
+	bool isWatching(const std::string &path) const;
+
+	/* Files written since the last call, each listed once */
+	std::vector<std::string> changed();
+
+	static const int POLL_INTERVAL_MS = 250;
+
+private:
+	// Normalised path (forward slashes) to the path as given
+	std::map<std::string, std::string> files;
+
+#ifdef __linux__
+	int inotifyFd;
+	std::map<int, std::string> directories;		// Watch descriptor to directory
+#else
+	std::map<std::string, long long> modified;	// Normalised path to modification time
+	std::chrono::steady_clock::time_point lastPoll;
+#endif
+};
@@ -0,0 +1,445 @@
+/* frame_capture.cpp
+ Pixel pack buffer readback and the encoder workers
+*/
+
+#include "frame_capture.h"
+#include "gl_counters.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+using namespace std;
+
+void encodeQOI(const unsigned char *rgba, GLuint width, GLuint height, vector<unsigned char> &out)
+{
+	out.clear();
+	out.reserve((size_t)width * height * 2 + 22);
+
+	// Header: magic, big endian size, 4 channels, sRGB
+	const unsigned char magic[] = { 'q', 'o', 'i', 'f' };
+	out.insert(out.end(), magic, magic + 4);
+	for (GLuint v : { width, height })
+	{
+		out.push_back((unsigned char)(v >> 24));
+		out.push_back((unsigned char)(v >> 16));
+		out.push_back((unsigned char)(v >> 8));
+		out.push_back((unsigned char)v);
+	}
+	out.push_back(4);
+	out.push_back(0);
+
+	unsigned char index[64][4] = {};
+	unsigned char prev[4] = { 0, 0, 0, 255 };
+	GLuint run = 0;
+	size_t numPixels = (size_t)width * height;
+
+	for (size_t i = 0; i < numPixels; i++)
+	{
+		const unsigned char *px = rgba + i * 4;
+		if (memcmp(px, prev, 4) == 0)
+		{
+			run++;
+			if (run == 62 || i + 1 == numPixels)
+			{
+				out.push_back((unsigned char)(0xC0 | (run - 1)));
+				run = 0;
+			}
+			continue;
+		}
+		if (run)
+		{
+			out.push_back((unsigned char)(0xC0 | (run - 1)));
+			run = 0;
+		}
+
+		GLuint hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+		if (memcmp(index[hash], px, 4) == 0)
+		{
+			out.push_back((unsigned char)hash);
+		}
+		else
+		{
+			memcpy(index[hash], px, 4);
+			if (px[3] == prev[3])
+			{
+				signed char dr = (signed char)(px[0] - prev[0]);
+				signed char dg = (signed char)(px[1] - prev[1]);
+				signed char db = (signed char)(px[2] - prev[2]);
+				signed char drdg = (signed char)(dr - dg);
+				signed char dbdg = (signed char)(db - dg);
+
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+				{
+					out.push_back((unsigned char)(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+				}
+				else if (dg >= -32 && dg <= 31 && drdg >= -8 && drdg <= 7 && dbdg >= -8 && dbdg <= 7)
+				{
+					out.push_back((unsigned char)(0x80 | (dg + 32)));
+					out.push_back((unsigned char)(((drdg + 8) << 4) | (dbdg + 8)));
+				}
+				else
+				{
+					out.push_back(0xFE);
+					out.insert(out.end(), px, px + 3);
+				}
+			}
+			else
+			{
+				out.push_back(0xFF);
+				out.insert(out.end(), px, px + 4);
+			}
+		}
+		memcpy(prev, px, 4);
+	}
+
+	const unsigned char padding[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	out.insert(out.end(), padding, padding + 8);
+}
+
+void convertI420(const unsigned char *rgba, GLuint width, GLuint height, vector<unsigned char> &out)
+{
+	size_t lumaSize = (size_t)width * height;
+	out.resize(lumaSize + lumaSize / 2);
+	unsigned char *yPlane = out.data();
+	unsigned char *uPlane = yPlane + lumaSize;
+	unsigned char *vPlane = uPlane + lumaSize / 4;
+
+	// BT.709 limited range in 8 bit fixed point
+	for (size_t i = 0; i < lumaSize; i++)
+	{
+		const unsigned char *px = rgba + i * 4;
+		yPlane[i] = (unsigned char)(((47 * px[0] + 157 * px[1] + 16 * px[2] + 128) >> 8) + 16);
+	}
+
+	// Chroma from the average of each 2x2 block
+	for (GLuint y = 0; y < height; y += 2)
+	{
+		for (GLuint x = 0; x < width; x += 2)
+		{
+			const unsigned char *p0 = rgba + ((size_t)y * width + x) * 4;
+			const unsigned char *p1 = p0 + (size_t)width * 4;
+			int r = (p0[0] + p0[4] + p1[0] + p1[4] + 2) >> 2;
+			int g = (p0[1] + p0[5] + p1[1] + p1[5] + 2) >> 2;
+			int b = (p0[2] + p0[6] + p1[2] + p1[6] + 2) >> 2;
+			size_t c = (size_t)(y / 2) * (width / 2) + x / 2;
+			uPlane[c] = (unsigned char)(((-26 * r - 87 * g + 112 * b + 128) >> 8) + 128);
+			vPlane[c] = (unsigned char)(((112 * r - 102 * g - 10 * b + 128) >> 8) + 128);
+		}
+	}
+}
+
+FrameCapture::FrameCapture() : maxQueued(8), capturing(false), width(0), height(0), format(CAPTURE_QOI), pipe(false),
+	stream(NULL), issued(0), harvested(0), stopping(false), nextToWrite(0), elapsed(0), framesWritten(0), bytesWritten(0),
+	encodeMicroseconds(0), readbackStalls(0), queueWaits(0), queueWaitTime(0), maxDepth(0), depthSum(0), failed(false)
+{
+	for (GLuint i = 0; i < RING_SIZE; i++)
+	{
+		slots[i].pbo = 0;
+		slots[i].fence = 0;
+		slots[i].frame = 0;
+	}
+}
+
+FrameCapture::~FrameCapture()
+{
+	if (!capturing) return;
+	if (glfwGetCurrentContext())
+	{
+		finish();
+		return;
+	}
+
+	// Without a context the frames in flight are lost, but the workers still stop
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+	for (thread &worker : workers) worker.join();
+	if (stream) pipe ? pclose(stream) : fclose(stream);
+}
+
+bool FrameCapture::start(GLuint width, GLuint height, CaptureFormat format, const string &target, bool pipe, GLuint numThreads)
+{
+	if (capturing) finish();
+	if (format == CAPTURE_YUV && (width % 2 || height % 2))
+	{
+		printf("FrameCapture: I420 needs an even frame size, not %ux%u\n", width, height);
+		return false;
+	}
+
+	this->width = width;
+	this->height = height;
+	this->format = format;
+	this->target = target;
+	this->pipe = pipe && format != CAPTURE_QOI;
+
+	stream = NULL;
+	if (format != CAPTURE_QOI)
+	{
+		stream = this->pipe ? popen(target.c_str(), "wb") : fopen(target.c_str(), "wb");
+		if (!stream)
+		{
+			printf("FrameCapture: could not open %s\n", target.c_str());
+			return false;
+		}
+	}
+
+	GLint previous;
+	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previous);
+	for (GLuint i = 0; i < RING_SIZE; i++)
+	{
+		glGenBuffers(1, &slots[i].pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+		slots[i].fence = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, previous);
+
+	issued = harvested = nextToWrite = 0;
+	framesWritten = 0;
+	bytesWritten = 0;
+	encodeMicroseconds = 0;
+	readbackStalls = queueWaits = maxDepth = 0;
+	queueWaitTime = 0;
+	depthSum = 0;
+	failed = false;
+	stopping = false;
+
+	// hardware_concurrency() may return 0 when it cannot tell
+	if (!numThreads) numThreads = max(2u, thread::hardware_concurrency()) - 1;
+	for (GLuint i = 0; i < numThreads; i++) workers.push_back(thread(&FrameCapture::workerLoop, this));
+
+	capturing = true;
+	startTime = Clock::now();
+	return true;
+}
+
+void FrameCapture::capture(GLuint framebuffer)
+{
+	if (!capturing) return;
+
+	// Copy out whatever has arrived; only a full ring waits for the GPU
+	bool full = issued - harvested == RING_SIZE;
+	if (full) readbackStalls++;
+	harvest(full);
+
+	Slot &slot = slots[issued % RING_SIZE];
+	GLint previousRead, previousPack;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previousPack);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	if (!framebuffer) glReadBuffer(GL_BACK);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.frame = issued++;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, previousPack);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previousRead);
+}
+
+/* Copy finished readbacks to the workers, oldest first. With wait set the
+   oldest is waited for, however long it takes, since capture() is about to
+   reuse its slot; the rest are only taken if already complete */
+void FrameCapture::harvest(bool wait)
+{
+	size_t size = (size_t)width * height * 4;
+	while (harvested < issued)
+	{
+		Slot &slot = slots[harvested % RING_SIZE];
+		GLenum result = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 5000000000ull : 0);
+		while (wait && result == GL_TIMEOUT_EXPIRED)
+		{
+			printf("FrameCapture: still waiting for the readback of frame %u\n", slot.frame);
+			result = glClientWaitSync(slot.fence, 0, 5000000000ull);
+		}
+		if (result == GL_TIMEOUT_EXPIRED) break;
+		if (result == GL_WAIT_FAILED)
+		{
+			// The fence is unusable, so wait for everything instead
+			printf("FrameCapture: waiting for the readback of frame %u failed\n", slot.frame);
+			glFinish();
+		}
+		wait = false;
+
+		// A buffer from the pool, once the workers have room for another frame
+		vector<unsigned char> pixels;
+		{
+			unique_lock<mutex> lock(jobMutex);
+			if (jobs.size() >= maxQueued)
+			{
+				Clock::time_point start = Clock::now();
+				queueWaits++;
+				jobTaken.wait(lock, [this]() { return jobs.size() < maxQueued; });
+				queueWaitTime += chrono::duration<double>(Clock::now() - start).count();
+			}
+			if (!freeBuffers.empty())
+			{
+				pixels.swap(freeBuffers.back());
+				freeBuffers.pop_back();
+			}
+		}
+		pixels.resize(size);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (mapped) memcpy(pixels.data(), mapped, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+		harvested++;
+
+		{
+			lock_guard<mutex> lock(jobMutex);
+			Job job;
+			job.frame = slot.frame;
+			job.pixels.swap(pixels);
+			jobs.push_back(std::move(job));
+			GLuint depth = (GLuint)jobs.size();
+			maxDepth = max(maxDepth, depth);
+			depthSum += depth;
+		}
+		jobReady.notify_one();
+	}
+}
+
+void FrameCapture::workerLoop()
+{
+	vector<unsigned char> scratch, encoded;
+	while (true)
+	{
+		Job job;
+		{
+			unique_lock<mutex> lock(jobMutex);
+			jobReady.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if (jobs.empty()) return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		jobTaken.notify_one();
+
+		Clock::time_point start = Clock::now();
+		encode(job, scratch, encoded);
+		encodeMicroseconds += chrono::duration_cast<chrono::microseconds>(Clock::now() - start).count();
+
+		if (format == CAPTURE_QOI)
+		{
+			char filename[1024];
+			snprintf(filename, sizeof(filename), target.c_str(), job.frame);
+			FILE *file = fopen(filename, "wb");
+			if (file && fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size())
+			{
+				bytesWritten += encoded.size();
+				framesWritten++;
+			}
+			else if (!failed)
+			{
+				failed = true;
+				printf("FrameCapture: could not write %s\n", filename);
+			}
+			if (file) fclose(file);
+		}
+		else
+		{
+			writeOrdered(job.frame, encoded);
+		}
+
+		lock_guard<mutex> lock(jobMutex);
+		freeBuffers.push_back(std::move(job.pixels));
+	}
+}
+
+/* Flip the image upright with opaque alpha, then convert it */
+void FrameCapture::encode(Job &job, vector<unsigned char> &scratch, vector<unsigned char> &encoded)
+{
+	vector<unsigned char> &upright = format == CAPTURE_RGBA ? encoded : scratch;
+	size_t rowSize = (size_t)width * 4;
+	upright.resize(rowSize * height);
+	for (GLuint y = 0; y < height; y++)
+	{
+		unsigned char *dst = &upright[(size_t)y * rowSize];
+		memcpy(dst, &job.pixels[(size_t)(height - 1 - y) * rowSize], rowSize);
+		for (GLuint x = 0; x < width; x++) dst[x * 4 + 3] = 255;
+	}
+
+	if (format == CAPTURE_QOI) encodeQOI(scratch.data(), width, height, encoded);
+	else if (format == CAPTURE_YUV) convertI420(scratch.data(), width, height, encoded);
+}
+
+void FrameCapture::writeOrdered(GLuint frame, vector<unsigned char> &data)
+{
+	lock_guard<mutex> lock(writeMutex);
+	if (frame != nextToWrite)
+	{
+		ready[frame].swap(data);
+		return;
+	}
+
+	vector<unsigned char> *next = &data;
+	while (true)
+	{
+		if (fwrite(next->data(), 1, next->size(), stream) == next->size())
+		{
+			bytesWritten += next->size();
+			framesWritten++;
+		}
+		else if (!failed)
+		{
+			failed = true;
+			printf("FrameCapture: could not write frame %u to %s\n", nextToWrite, target.c_str());
+		}
+		if (next != &data) ready.erase(nextToWrite);
+		nextToWrite++;
+
+		auto it = ready.find(nextToWrite);
+		if (it == ready.end()) break;
+		next = &it->second;
+	}
+}
+
+void FrameCapture::finish()
+{
+	if (!capturing) return;
+
+	while (harvested < issued) harvest(true);
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+	for (thread &worker : workers) worker.join();
+	workers.clear();
+	elapsed = chrono::duration<double>(Clock::now() - startTime).count();
+
+	if (stream) pipe ? pclose(stream) : fclose(stream);
+	stream = NULL;
+	for (GLuint i = 0; i < RING_SIZE; i++)
+	{
+		glDeleteBuffers(1, &slots[i].pbo);
+		slots[i].pbo = 0;
+	}
+	freeBuffers.clear();
+	ready.clear();
+	capturing = false;
+}
+
+void FrameCapture::report(const char *label) const
+{
+	double seconds = capturing ? chrono::duration<double>(Clock::now() - startTime).count() : elapsed;
+	GLuint written = framesWritten;
+	double megabytes = bytesWritten / (1024.0 * 1024.0);
+	printf("%s: %u of %u frames written (%ux%u) in %.2f s, %.1f MB at %.1f MB/s, %.2f ms encoding per frame\n",
+		label, written, issued, width, height, seconds, megabytes, seconds > 0 ? megabytes / seconds : 0.0,
+		written ? encodeMicroseconds / 1000.0 / written : 0.0);
+	printf("  worker queue depth avg %.1f, max %u of %u; %u readback stalls, %u waits for the workers (%.1f ms)\n",
+		harvested ? (double)depthSum / harvested : 0.0, maxDepth, maxQueued, readbackStalls, queueWaits, queueWaitTime * 1000.0);
+}
@@ -0,0 +1,135 @@
+/* frame_capture.h
+ Captures every rendered frame to disk or to an encoder process without
+ stalling the renderer.
+
+ capture() starts an asynchronous glReadPixels into the next of a ring of
+ pixel pack buffers and puts a fence behind it. Buffers whose fence has
+ signalled are copied out on later frames, so the copy never waits for the
+ GPU unless the whole ring is still in flight. The copies go to a pool of
+ worker threads that flip the image upright and encode it:
+
+ CAPTURE_QOI   one QOI image per frame, named by a printf pattern such as
+               "capture/frame_%05u.qoi"
+ CAPTURE_YUV   one raw I420 (BT.709, limited range) stream in a file
+ CAPTURE_RGBA  raw RGBA frames, to a file or piped to an encoder process,
+               for example "ffmpeg -f rawvideo -pix_fmt rgba -s 1920x1080
+               -r 60 -i - out.mp4"
+
+ Streams are written in frame order; frames finished out of order wait for
+ the ones before them. When maxQueued frames are waiting for the workers
+ capture() blocks instead of dropping frames, and the time spent blocked is
+ reported together with the queue depth and the disk throughput.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum CaptureFormat
+{
+	CAPTURE_QOI,
+	CAPTURE_YUV,
+	CAPTURE_RGBA
+};
+
+/* Encode top-down RGBA pixels as a QOI image (alpha is written as stored) */
+void encodeQOI(const unsigned char *rgba, GLuint width, GLuint height, std::vector<unsigned char> &out);
+
+/* Convert top-down RGBA pixels to planar I420. width and height must be even */
+void convertI420(const unsigned char *rgba, GLuint width, GLuint height, std::vector<unsigned char> &out);
+
+class FrameCapture
+{
+public:
+	FrameCapture();
+	~FrameCapture();
+
+	/* Start capturing width x height frames. For CAPTURE_QOI target is a
+	   file name pattern with one %u for the frame number; for the streams it
+	   is a file name, or a command to pipe to if pipe is set. numThreads 0
+	   picks one less than the hardware threads */
+	bool start(GLuint width, GLuint height, CaptureFormat format, const std::string &target, bool pipe = false,
+		GLuint numThreads = 0);
+
+	/* Queue a readback of the current contents of framebuffer (0 reads the
+	   back buffer). Call once per frame before the buffers are swapped */
+	void capture(GLuint framebuffer);
+
+	/* Read back every frame still in flight, wait for the workers and close
+	   the output. Needs the GL context */
+	void finish();
+
+	bool isCapturing() const { return capturing; }
+	void report(const char *label) const;
+
+	static const GLuint RING_SIZE = 4;
+	GLuint maxQueued;				// Frames waiting for a worker before capture() blocks
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Slot
+	{
+		GLuint pbo;
+		GLsync fence;
+		GLuint frame;
+	};
+
+	struct Job
+	{
+		GLuint frame;
+		std::vector<unsigned char> pixels;
+	};
+
+	bool capturing;
+	GLuint width, height;
+	CaptureFormat format;
+	std::string target;
+	bool pipe;
+	FILE *stream;					// Output of the stream formats
+
+	Slot slots[RING_SIZE];
+	GLuint issued;					// Readbacks started
+	GLuint harvested;				// Readbacks copied out, the oldest in flight is harvested % RING_SIZE
+
+	std::vector<std::thread> workers;
+	std::deque<Job> jobs;
+	std::vector<std::vector<unsigned char> > freeBuffers;
+	std::mutex jobMutex;
+	std::condition_variable jobReady;
+	std::condition_variable jobTaken;
+	bool stopping;
+
+	// Encoded stream frames waiting for the ones before them
+	std::map<GLuint, std::vector<unsigned char> > ready;
+	GLuint nextToWrite;
+	std::mutex writeMutex;
+
+	// Statistics
+	Clock::time_point startTime;
+	double elapsed;
+	std::atomic<GLuint> framesWritten;
+	std::atomic<unsigned long long> bytesWritten;
+	std::atomic<unsigned long long> encodeMicroseconds;
+	GLuint readbackStalls;			// Ring full, waited for the GPU
+	GLuint queueWaits;				// Workers behind, waited for a free slot
+	double queueWaitTime;
+	GLuint maxDepth;
+	unsigned long long depthSum;
+	std::atomic<bool> failed;
+
+	void harvest(bool wait);
+	void workerLoop();
+	void encode(Job &job, std::vector<unsigned char> &scratch, std::vector<unsigned char> &encoded);
+	void writeOrdered(GLuint frame, std::vector<unsigned char> &data);
+};
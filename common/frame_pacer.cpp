@@ -0,0 +1,229 @@
+/* frame_pacer.cpp
+ Sleep and spin frame limiter with frame time statistics
+*/
+
+#include "frame_pacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::duration d)
+{
+	return chrono::duration<double>(d).count();
+}
+
+bool parseFramePacing(const char *name, FramePacing &mode)
+{
+	static const char *names[] = { "none", "vsync", "limit", "adaptive" };
+	for (GLuint i = 0; i < 4; i++)
+	{
+		if (strcmp(name, names[i]) == 0)
+		{
+			mode = (FramePacing)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool summariseTimings(const vector<float> &samples, GLuint count, TimingSummary &summary)
+{
+	summary = TimingSummary();
+	if (!count) return false;
+
+	vector<float> sorted(samples.begin(), samples.begin() + count);
+	sort(sorted.begin(), sorted.end());
+	auto percentile = [&sorted](double p) { return sorted[min((size_t)(p * sorted.size()), sorted.size() - 1)]; };
+	summary.min = sorted.front();
+	summary.p50 = percentile(0.5);
+	summary.p95 = percentile(0.95);
+	summary.p99 = percentile(0.99);
+	summary.max = sorted.back();
+	return true;
+}
+
+FramePacer::FramePacer() : mode(FRAME_PACING_NONE), fps(60), idleFps(4), idle(NULL), started(false),
+	oversleepMean(0), oversleepM2(0), oversleepSamples(0), frameTimes(DEFAULT_HISTORY, 0.f), history(DEFAULT_HISTORY)
+{
+	resetStats();
+}
+
+FramePacer::~FramePacer()
+{
+#ifdef _WIN32
+	if (started) timeEndPeriod(1);
+#endif
+}
+
+void FramePacer::setMode(FramePacing mode, double fps)
+{
+	this->mode = mode;
+	if (fps > 0) this->fps = fps;
+}
+
+void FramePacer::start(GLFWwindow *window)
+{
+#ifdef _WIN32
+	// The default scheduler tick of 15.6 ms is longer than a frame
+	if (!started) timeBeginPeriod(1);
+#endif
+	started = true;
+
+	int interval = 0;
+	if (mode == FRAME_PACING_VSYNC)
+	{
+		// 30 fps on a 60 Hz display swaps every second refresh
+		const GLFWvidmode *video = glfwGetVideoMode(glfwGetPrimaryMonitor());
+		int refresh = (video && video->refreshRate > 0) ? video->refreshRate : 60;
+		interval = max(1, (int)floor(refresh / fps + 0.5));
+	}
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval(interval);
+
+	resetStats();
+	deadline = lastFrame = Clock::now();
+}
+
+void FramePacer::resetStats()
+{
+	frames = missed = idleFrames = 0;
+	totalTime = sleepTime = spinTime = 0;
+}
+
+void FramePacer::setHistory(GLuint frames)
+{
+	history = max(frames, 1u);
+	frameTimes.assign(history, 0.f);
+	resetStats();
+}
+
+double FramePacer::spinMargin() const
+{
+	// Until a few sleeps have been measured assume the OS is 1 ms late
+	if (oversleepSamples < 8) return 0.001;
+	double deviation = sqrt(oversleepM2 / (oversleepSamples - 1));
+	return min(oversleepMean + 2 * deviation, 0.004);
+}
+
+void FramePacer::sleepUntil(Clock::time_point target)
+{
+	// Sleep in short steps while the deadline is far enough away, learning
+	// how late each wakeup is
+	Clock::time_point now = Clock::now();
+	while (seconds(target - now) > spinMargin() + 0.001)
+	{
+		Clock::time_point before = now;
+		this_thread::sleep_for(chrono::milliseconds(1));
+		now = Clock::now();
+
+		double late = seconds(now - before) - 0.001;
+		oversleepSamples++;
+		double delta = late - oversleepMean;
+		oversleepMean += delta / oversleepSamples;
+		oversleepM2 += delta * (late - oversleepMean);
+		sleepTime += seconds(now - before);
+	}
+
+	Clock::time_point spinStart = now;
+	while (now < target)
+	{
+		this_thread::yield();
+		now = Clock::now();
+	}
+	spinTime += seconds(now - spinStart);
+}
+
+void FramePacer::endFrame()
+{
+	bool limited = mode == FRAME_PACING_LIMIT || mode == FRAME_PACING_ADAPTIVE;
+	bool idling = mode == FRAME_PACING_ADAPTIVE && idle && idle();
+
+	if (limited)
+	{
+		double rate = idling ? idleFps : fps;
+		Clock::time_point now = Clock::now();
+		deadline += chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0 / rate));
+
+		// A frame that overran starts a new grid rather than rushing to catch up
+		if (deadline < now)
+		{
+			if (!idling) missed++;
+			deadline = now;
+		}
+
+		if (idling)
+		{
+			// Any event ends the wait, and the next frame starts the grid again
+			glfwWaitEventsTimeout(seconds(deadline - now));
+			Clock::time_point woke = Clock::now();
+			sleepTime += seconds(woke - now);
+			if (woke < deadline) deadline = woke;
+			idleFrames++;
+		}
+		else
+		{
+			sleepUntil(deadline);
+			glfwPollEvents();
+		}
+	}
+	else
+	{
+		glfwPollEvents();
+	}
+
+	Clock::time_point now = Clock::now();
+	double frameTime = seconds(now - lastFrame);
+	lastFrame = now;
+	if (!limited) deadline = now;
+
+	frameTimes[frames % history] = (float)(frameTime * 1000.0);
+	frames++;
+	totalTime += frameTime;
+}
+
+void FramePacer::report(const char *label) const
+{
+	static const char *names[] = { "none", "vsync", "limit", "adaptive" };
+	GLuint count = min(frames, history);
+	TimingSummary times;
+	if (!summariseTimings(frameTimes, count, times))
+	{
+		printf("%s: no frames\n", label);
+		return;
+	}
+
+	double average = totalTime * 1000.0 / frames;
+	printf("%s: %s pacing at %.0f fps, %u frames (%u idle), %.1f fps achieved\n", label, names[mode], fps, frames, idleFrames,
+		1000.0 / average);
+	printf("  frame time ms: avg %.2f, min %.2f, p50 %.2f, p95 %.2f, p99 %.2f, max %.2f (last %u frames)\n",
+		average, times.min, times.p50, times.p95, times.p99, times.max, count);
+	printf("  %.1f%% sleeping, %.1f%% spinning, %u missed deadlines, spin margin %.2f ms\n",
+		100.0 * sleepTime / totalTime, 100.0 * spinTime / totalTime, missed, spinMargin() * 1000.0);
+}
+
+void FramePacer::writeJSON(FILE *file) const
+{
+	static const char *names[] = { "none", "vsync", "limit", "adaptive" };
+	GLuint count = min(frames, history);
+	TimingSummary times;
+	summariseTimings(frameTimes, count, times);
+
+	double average = frames ? totalTime * 1000.0 / frames : 0.0;
+	fprintf(file, "{\n\t\t\"pacing\": \"%s\",\n\t\t\"frames\": %u,\n\t\t\"fps\": %.2f,\n", names[mode], frames,
+		average > 0 ? 1000.0 / average : 0.0);
+	fprintf(file, "\t\t\"frame_ms\": { \"avg\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"samples\": %u },\n",
+		average, times.min, times.p50, times.p95, times.p99, times.max, count);
+	fprintf(file, "\t\t\"missed_deadlines\": %u\n\t}", missed);
+}
@@ -0,0 +1,112 @@
+/* frame_pacer.h
+ Paces the main loop so that it draws only as many frames as the content
+ needs instead of spinning a core at full speed.
+
+ FRAME_PACING_NONE     swap interval 0, no waiting (the old behaviour)
+ FRAME_PACING_VSYNC    the driver blocks in glfwSwapBuffers; the swap
+                       interval is the number of refreshes per target frame
+ FRAME_PACING_LIMIT    swap interval 0, the pacer sleeps until each frame's
+                       deadline, then busy waits the last part of the
+                       interval because the OS wakes a sleeping thread late
+ FRAME_PACING_ADAPTIVE like LIMIT, but while the idle callback reports
+                       nothing moving it draws at idleFps and waits for
+                       events, so input still wakes it at once
+
+ Deadlines are kept on a fixed grid from the first frame, so frame times do
+ not drift when one frame is a little late. The pacer also records the time
+ between frames, and how much of it went to sleeping and spinning, for
+ report().
+*/
+
+#pragma once
+
+// Included by wrapper_glfw.h, so only the GL and GLFW headers
+#include <glload/gl_4_4.h>
+#include <GLFW/glfw3.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+enum FramePacing
+{
+	FRAME_PACING_NONE,
+	FRAME_PACING_VSYNC,
+	FRAME_PACING_LIMIT,
+	FRAME_PACING_ADAPTIVE
+};
+
+/* Parse "none", "vsync", "limit" or "adaptive", false if the name is unknown */
+bool parseFramePacing(const char *name, FramePacing &mode);
+
+/* Spread of a set of timings, shared by the pacer's and profiler's reports */
+struct TimingSummary
+{
+	float min, p50, p95, p99, max;
+};
+
+/* Summarise the first count samples. False, with everything 0, if there are none */
+bool summariseTimings(const std::vector<float> &samples, GLuint count, TimingSummary &summary);
+
+class FramePacer
+{
+public:
+	FramePacer();
+	~FramePacer();
+
+	void setMode(FramePacing mode, double fps);
+
+	/* Adaptive mode only: returns true while the scene is not changing */
+	void setIdleCallback(bool(*f)()) { idle = f; }
+
+	/* Apply the swap interval for window and start the frame clock. The
+	   window's context must be current */
+	void start(GLFWwindow *window);
+
+	/* Call after glfwSwapBuffers: waits for the next frame's deadline and
+	   processes window events, which replaces glfwPollEvents */
+	void endFrame();
+
+	/* Frame time percentiles over the last history frames, the share of
+	   that time spent sleeping and spinning, and the missed deadlines */
+	void report(const char *label) const;
+	void resetStats();
+
+	/* Keep the last frames frame times for the percentiles, e.g. a whole
+	   benchmark run so they cover the same frames as the average */
+	void setHistory(GLuint frames);
+
+	/* The frame time statistics as a JSON object, for benchmark results */
+	void writeJSON(FILE *file) const;
+
+	FramePacing mode;
+	double fps;				// Target for LIMIT, ADAPTIVE and VSYNC
+	double idleFps;			// Rate of ADAPTIVE while idle
+
+	static const GLuint DEFAULT_HISTORY = 1024;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	bool(*idle)();
+	bool started;
+	Clock::time_point deadline;
+	Clock::time_point lastFrame;
+
+	// Late wakeup from sleep_for, mean and variance (Welford), which sets
+	// how long before a deadline the pacer stops sleeping and spins
+	double oversleepMean;
+	double oversleepM2;
+	GLuint oversleepSamples;
+
+	std::vector<float> frameTimes;	// Milliseconds, ring buffer
+	GLuint history;
+	GLuint frames;
+	GLuint missed;
+	GLuint idleFrames;
+	double totalTime;
+	double sleepTime;
+	double spinTime;
+
+	void sleepUntil(Clock::time_point target);
+	double spinMargin() const;
+};
@@ -0,0 +1,232 @@
+/* frame_profiler.cpp
+ CPU and GPU zone timers with delayed query readback
+*/
+
+#include "frame_profiler.h"
+#include "gl_counters.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+static const GLuint NO_INTERVAL = (GLuint)-1;
+
+FrameProfiler::FrameProfiler() : enabled(false), active(false), frameIndex(0), droppedFrames(0), overhead(0), frameTime(0),
+	history(DEFAULT_HISTORY)
+{
+	for (GLuint i = 0; i < FRAME_LATENCY; i++)
+	{
+		frames[i].used = 0;
+		frames[i].pending = false;
+	}
+	addZone("frame");
+}
+
+FrameProfiler::~FrameProfiler()
+{
+	if (!glfwGetCurrentContext()) return;
+	for (GLuint i = 0; i < FRAME_LATENCY; i++)
+		if (!frames[i].queries.empty()) glDeleteQueries((GLsizei)frames[i].queries.size(), frames[i].queries.data());
+}
+
+GLuint FrameProfiler::addZone(const char *name)
+{
+	Zone zone;
+	zone.name = name;
+	zone.cpu.assign(history, 0.f);
+	zone.gpu.assign(history, 0.f);
+	zone.cpuSamples = zone.gpuSamples = 0;
+	zone.cpuFrame = 0;
+	zone.used = false;
+	zones.push_back(zone);
+
+	for (GLuint i = 0; i < FRAME_LATENCY; i++) frames[i].open.push_back(NO_INTERVAL);
+	return (GLuint)zones.size() - 1;
+}
+
+/* Takes effect from the next frame, so a frame is never half timed */
+void FrameProfiler::setEnabled(bool enabled)
+{
+	this->enabled = enabled;
+}
+
+void FrameProfiler::beginFrame()
+{
+	active = enabled;
+	if (!active) return;
+
+	FrameQueries &frame = frames[frameIndex % FRAME_LATENCY];
+	if (frame.pending) collect(frame);
+	frame.used = 0;
+	frame.intervals.clear();
+	fill(frame.open.begin(), frame.open.end(), NO_INTERVAL);
+
+	for (Zone &zone : zones)
+	{
+		zone.cpuFrame = 0;
+		zone.used = false;
+	}
+	begin(0);
+}
+
+void FrameProfiler::endFrame()
+{
+	if (!active) return;
+	end(0);
+
+	for (Zone &zone : zones)
+		if (zone.used) push(zone.cpu, zone.cpuSamples, zone.cpuFrame * 1000.0);
+	frameTime += zones[0].cpuFrame;
+
+	frames[frameIndex % FRAME_LATENCY].pending = true;
+	frameIndex++;
+	active = false;
+}
+
+GLuint FrameProfiler::timestamp(FrameQueries &frame)
+{
+	if (frame.used == frame.queries.size())
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+	}
+	glQueryCounter(frame.queries[frame.used], GL_TIMESTAMP);
+	return frame.used++;
+}
+
+void FrameProfiler::begin(GLuint zone)
+{
+	if (!active) return;
+	Clock::time_point entered = Clock::now();
+
+	FrameQueries &frame = frames[frameIndex % FRAME_LATENCY];
+	Interval interval = { zone, timestamp(frame), NO_INTERVAL };
+	frame.open[zone] = (GLuint)frame.intervals.size();
+	frame.intervals.push_back(interval);
+
+	Zone &z = zones[zone];
+	z.start = Clock::now();
+	overhead += chrono::duration<double>(z.start - entered).count();
+}
+
+void FrameProfiler::end(GLuint zone)
+{
+	if (!active) return;
+	Clock::time_point entered = Clock::now();
+
+	Zone &z = zones[zone];
+	z.cpuFrame += chrono::duration<double>(entered - z.start).count();
+	z.used = true;
+
+	FrameQueries &frame = frames[frameIndex % FRAME_LATENCY];
+	if (frame.open[zone] != NO_INTERVAL)
+	{
+		frame.intervals[frame.open[zone]].end = timestamp(frame);
+		frame.open[zone] = NO_INTERVAL;
+	}
+	overhead += chrono::duration<double>(Clock::now() - entered).count();
+}
+
+void FrameProfiler::collect(FrameQueries &frame)
+{
+	frame.pending = false;
+	if (!frame.used) return;
+
+	// Queries complete in order, so the last one stands for the frame
+	GLint available = 0;
+	glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+	{
+		droppedFrames++;
+		return;
+	}
+
+	vector<double> gpuFrame(zones.size(), 0.0);
+	vector<bool> seen(zones.size(), false);
+	for (const Interval &interval : frame.intervals)
+	{
+		if (interval.end == NO_INTERVAL) continue;
+		GLuint64 start, end;
+		glGetQueryObjectui64v(frame.queries[interval.start], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(frame.queries[interval.end], GL_QUERY_RESULT, &end);
+		gpuFrame[interval.zone] += (end - start) / 1e6;
+		seen[interval.zone] = true;
+	}
+
+	for (GLuint i = 0; i < zones.size(); i++)
+		if (seen[i]) push(zones[i].gpu, zones[i].gpuSamples, gpuFrame[i]);
+}
+
+void FrameProfiler::push(vector<float> &ring, GLuint &samples, double ms)
+{
+	ring[samples % ring.size()] = (float)ms;
+	samples++;
+}
+
+/* Print p50, p95 and p99 of the samples in a ring, or a dash if it is empty */
+void FrameProfiler::printPercentiles(const char *what, const vector<float> &ring, GLuint samples) const
+{
+	TimingSummary times;
+	if (summariseTimings(ring, min(samples, history), times)) printf(" %s %6.3f %6.3f %6.3f", what, times.p50, times.p95, times.p99);
+	else printf(" %s        -", what);
+}
+
+void FrameProfiler::resetStats()
+{
+	for (Zone &zone : zones) zone.cpuSamples = zone.gpuSamples = 0;
+	droppedFrames = 0;
+	overhead = frameTime = 0;
+}
+
+void FrameProfiler::setHistory(GLuint frames)
+{
+	history = max(frames, 1u);
+	for (Zone &zone : zones)
+	{
+		zone.cpu.assign(history, 0.f);
+		zone.gpu.assign(history, 0.f);
+	}
+	resetStats();
+}
+
+void FrameProfiler::writeJSON(FILE *file) const
+{
+	fprintf(file, "{\n\t\t\"overhead_percent\": %.3f,\n\t\t\"frames_without_gpu_results\": %u,\n\t\t\"zones\": [",
+		frameTime > 0 ? 100.0 * overhead / frameTime : 0.0, droppedFrames);
+	for (size_t i = 0; i < zones.size(); i++)
+	{
+		const Zone &zone = zones[i];
+		fprintf(file, "%s\n\t\t\t{ \"name\": \"%s\"", i ? "," : "", zone.name.c_str());
+		const vector<float> *rings[2] = { &zone.cpu, &zone.gpu };
+		GLuint samples[2] = { zone.cpuSamples, zone.gpuSamples };
+		const char *names[2] = { "cpu", "gpu" };
+		for (GLuint r = 0; r < 2; r++)
+		{
+			GLuint count = min(samples[r], history);
+			TimingSummary times;
+			if (summariseTimings(*rings[r], count, times))
+				fprintf(file, ", \"%s_ms\": { \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"samples\": %u }", names[r], times.p50,
+					times.p95, times.p99, count);
+			else
+				fprintf(file, ", \"%s_ms\": null", names[r]);
+		}
+		fprintf(file, " }");
+	}
+	fprintf(file, "\n\t\t]\n\t}");
+}
+
+void FrameProfiler::report(const char *label) const
+{
+	printf("%s: %u frames, p50 / p95 / p99 in ms over the last %u\n", label, frameIndex, history);
+	for (const Zone &zone : zones)
+	{
+		printf("  %-18s", zone.name.c_str());
+		printPercentiles("cpu", zone.cpu, zone.cpuSamples);
+		printPercentiles("  gpu", zone.gpu, zone.gpuSamples);
+		printf("\n");
+	}
+	printf("  profiler overhead %.2f%% of frame CPU time, %u frames without GPU results\n",
+		frameTime > 0 ? 100.0 * overhead / frameTime : 0.0, droppedFrames);
+}
@@ -0,0 +1,126 @@
+/* frame_profiler.h
+ Frame timing by named zone, on the CPU with steady_clock and on the GPU
+ with a pair of GL_TIMESTAMP queries around each zone. Timestamps rather
+ than GL_TIME_ELAPSED let zones nest (the shadow pass inside the frame).
+
+ Queries are read FRAME_LATENCY frames after they were issued, by which
+ time the GPU has normally finished them; a frame whose results are still
+ not available is dropped rather than waited for. Each zone keeps the time
+ it took in each of the last history frames, and report() prints the
+ 50th, 95th and 99th percentiles together with the profiler's own CPU
+ overhead.
+
+ A disabled profiler returns from begin() and end() straight away.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+const GLuint NO_PROFILE_ZONE = (GLuint)-1;
+
+class FrameProfiler
+{
+public:
+	FrameProfiler();
+	~FrameProfiler();
+
+	/* Register a zone and return its id. Zone 0 is the whole frame */
+	GLuint addZone(const char *name);
+
+	void setEnabled(bool enabled);
+	bool isEnabled() const { return enabled; }
+
+	/* Bracket each frame; beginFrame() also collects the GPU times of the
+	   frame issued FRAME_LATENCY frames earlier */
+	void beginFrame();
+	void endFrame();
+
+	/* Bracket a zone. Zones may nest, but one zone may not be entered again
+	   before it ends. Entering it again later in the frame adds to its time */
+	void begin(GLuint zone);
+	void end(GLuint zone);
+
+	void report(const char *label) const;
+
+	/* The report as a JSON object, for benchmark results */
+	void writeJSON(FILE *file) const;
+
+	/* Forget the samples so far, e.g. after warming up */
+	void resetStats();
+
+	/* Keep the last frames samples per zone, e.g. a whole benchmark run */
+	void setHistory(GLuint frames);
+
+	static const GLuint FRAME_LATENCY = 3;
+	static const GLuint DEFAULT_HISTORY = 512;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Zone
+	{
+		std::string name;
+		std::vector<float> cpu;		// Milliseconds per frame, ring buffers
+		std::vector<float> gpu;
+		GLuint cpuSamples;
+		GLuint gpuSamples;
+		double cpuFrame;			// Seconds so far this frame
+		Clock::time_point start;
+		bool used;					// Entered this frame
+	};
+
+	// Query indices of one zone's start and end timestamps
+	struct Interval
+	{
+		GLuint zone;
+		GLuint start;
+		GLuint end;
+	};
+
+	struct FrameQueries
+	{
+		std::vector<GLuint> queries;
+		GLuint used;
+		std::vector<Interval> intervals;
+		std::vector<GLuint> open;	// Per zone, the interval it is in, if any
+		bool pending;
+	};
+
+	bool enabled;
+	bool active;					// Enabled when the current frame began
+	std::vector<Zone> zones;
+	FrameQueries frames[FRAME_LATENCY];
+	GLuint frameIndex;
+	GLuint droppedFrames;
+	double overhead;				// Seconds spent in begin() and end()
+	double frameTime;
+	GLuint history;
+
+	GLuint timestamp(FrameQueries &frame);
+	void collect(FrameQueries &frame);
+	static void push(std::vector<float> &ring, GLuint &samples, double ms);
+	void printPercentiles(const char *what, const std::vector<float> &ring, GLuint samples) const;
+};
+
+/* Times the enclosing scope as one zone */
+class ProfileScope
+{
+public:
+	ProfileScope(FrameProfiler *profiler, GLuint zone) : profiler(profiler), zone(zone)
+	{
+		if (profiler && zone != NO_PROFILE_ZONE) profiler->begin(zone);
+	}
+	~ProfileScope()
+	{
+		if (profiler && zone != NO_PROFILE_ZONE) profiler->end(zone);
+	}
+
+private:
+	FrameProfiler *profiler;
+	GLuint zone;
+};
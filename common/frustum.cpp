@@ -0,0 +1,100 @@
+/* frustum.cpp
+ Plane extraction and sphere tests for view frustum culling
+*/
+
+#include "frustum.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FRUSTUM_SSE2
+#endif
+
+using namespace glm;
+
+BoundingSphere transformSphere(const mat4 &model, const vec3 &centre, GLfloat radius)
+{
+	GLfloat scale = max(length(vec3(model[0])), max(length(vec3(model[1])), length(vec3(model[2]))));
+	BoundingSphere sphere;
+	sphere.centre = vec3(model * vec4(centre, 1.f));
+	sphere.radius = radius * scale;
+	return sphere;
+}
+
+BoundingSphere sphereFromPoints(const vec3 *points, GLuint numPoints)
+{
+	BoundingSphere sphere = { vec3(0.f), 0.f };
+	if (!numPoints) return sphere;
+
+	vec3 lo = points[0], hi = points[0];
+	for (GLuint i = 1; i < numPoints; i++)
+	{
+		lo = min(lo, points[i]);
+		hi = max(hi, points[i]);
+	}
+	sphere.centre = (lo + hi) * 0.5f;
+	sphere.radius = length(hi - lo) * 0.5f;
+	return sphere;
+}
+
+Frustum::Frustum()
+{
+	for (GLuint i = 0; i < 6; i++) planes[i] = vec4(0.f, 0.f, 0.f, 1.f);
+}
+
+Frustum::Frustum(const mat4 &viewProjection)
+{
+	set(viewProjection);
+}
+
+/* Gribb and Hartmann: each plane is the last row of the matrix plus or minus one of the others */
+void Frustum::set(const mat4 &m)
+{
+	vec4 rows[4];
+	for (GLuint r = 0; r < 4; r++) rows[r] = vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[3] + rows[2];
+	planes[5] = rows[3] - rows[2];
+	for (GLuint i = 0; i < 6; i++) planes[i] = planes[i] / length(vec3(planes[i]));
+}
+
+bool Frustum::sphereVisible(const BoundingSphere &sphere) const
+{
+	for (GLuint i = 0; i < 6; i++)
+	{
+		if (dot(vec3(planes[i]), sphere.centre) + planes[i].w < -sphere.radius) return false;
+	}
+	return true;
+}
+
+void Frustum::testSpheres(const BoundingSphere *spheres, GLuint count, unsigned char *visible) const
+{
+	GLuint i = 0;
+#ifdef FRUSTUM_SSE2
+	// Four spheres per iteration, one lane each
+	for (; i + 4 <= count; i += 4)
+	{
+		const BoundingSphere *s = spheres + i;
+		__m128 x = _mm_set_ps(s[3].centre.x, s[2].centre.x, s[1].centre.x, s[0].centre.x);
+		__m128 y = _mm_set_ps(s[3].centre.y, s[2].centre.y, s[1].centre.y, s[0].centre.y);
+		__m128 z = _mm_set_ps(s[3].centre.z, s[2].centre.z, s[1].centre.z, s[0].centre.z);
+		__m128 negRadius = _mm_set_ps(-s[3].radius, -s[2].radius, -s[1].radius, -s[0].radius);
+
+		__m128 outside = _mm_setzero_ps();
+		for (GLuint p = 0; p < 6; p++)
+		{
+			__m128 d = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)), _mm_mul_ps(y, _mm_set1_ps(planes[p].y)));
+			d = _mm_add_ps(d, _mm_mul_ps(z, _mm_set1_ps(planes[p].z)));
+			d = _mm_add_ps(d, _mm_set1_ps(planes[p].w));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negRadius));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		for (GLuint k = 0; k < 4; k++) visible[i + k] = (mask & (1 << k)) ? 0 : 1;
+	}
+#endif
+	for (; i < count; i++) visible[i] = sphereVisible(spheres[i]) ? 1 : 0;
+}
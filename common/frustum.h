@@ -0,0 +1,41 @@
+/* frustum.h
+ View frustum culling with bounding spheres. The six planes are taken from
+ a view projection matrix. testSpheres() checks a whole array of spheres,
+ four at a time with SSE2 where it is available, so the cost per object
+ is a handful of instructions.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <glm/glm.hpp>
+
+struct BoundingSphere
+{
+	glm::vec3 centre;
+	GLfloat radius;
+};
+
+/* World bounds of an object space sphere under a model matrix, scaled by
+   the largest axis scale so that non-uniform scaling stays conservative */
+BoundingSphere transformSphere(const glm::mat4 &model, const glm::vec3 &centre, GLfloat radius);
+
+/* Sphere around the axis aligned box of numPoints points */
+BoundingSphere sphereFromPoints(const glm::vec3 *points, GLuint numPoints);
+
+class Frustum
+{
+public:
+	Frustum();
+	explicit Frustum(const glm::mat4 &viewProjection);
+
+	void set(const glm::mat4 &viewProjection);
+
+	bool sphereVisible(const BoundingSphere &sphere) const;
+
+	/* visible[i] is set to 1 if sphere i touches the frustum and 0 if not */
+	void testSpheres(const BoundingSphere *spheres, GLuint count, unsigned char *visible) const;
+
+	// Normalised planes, xyz pointing into the frustum: left, right, bottom, top, near, far
+	glm::vec4 planes[6];
+};
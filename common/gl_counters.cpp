@@ -0,0 +1,20 @@
+/* gl_counters.cpp
+ Storage and reporting for the per-frame GL call counters
+*/
+
+#include "gl_counters.h"
+
+#include <cstdio>
+
+GLCallCounters glCalls = {};
+
+void GLCallCounters::reset()
+{
+	*this = GLCallCounters();
+}
+
+void GLCallCounters::print(const char *label) const
+{
+	printf("%s: %u buffer specifications, %u buffer updates, %u texture binds, %u program binds, %u draws\n",
+		label, bufferSpecifications, bufferUpdates, textureBinds, programBinds, drawCalls);
+}
@@ -0,0 +1,108 @@
+/* gl_counters.h
+ Counts the GL calls made each frame that re-specify buffers, update them,
+ change textures or programs and draw. Including this header after
+ wrapper_glfw.h routes those entry points through small inline wrappers,
+ so existing code is counted without being changed.
+ The application resets glCalls at the start of every frame.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+
+struct GLCallCounters
+{
+	GLuint bufferSpecifications;	// glBufferData and glBufferStorage: storage allocated again
+	GLuint bufferUpdates;			// glBufferSubData: contents replaced in existing storage
+	GLuint textureBinds;
+	GLuint programBinds;
+	GLuint drawCalls;
+
+	void reset();
+	void print(const char *label) const;
+};
+
+/* Counters for the frame being drawn */
+extern GLCallCounters glCalls;
+
+inline void countedBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+	glCalls.bufferSpecifications++;
+	glBufferData(target, size, data, usage);
+}
+
+inline void countedBufferStorage(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags)
+{
+	glCalls.bufferSpecifications++;
+	glBufferStorage(target, size, data, flags);
+}
+
+inline void countedBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+	glCalls.bufferUpdates++;
+	glBufferSubData(target, offset, size, data);
+}
+
+inline void countedBindTexture(GLenum target, GLuint texture)
+{
+	glCalls.textureBinds++;
+	glBindTexture(target, texture);
+}
+
+inline void countedUseProgram(GLuint program)
+{
+	glCalls.programBinds++;
+	glUseProgram(program);
+}
+
+inline void countedDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	glCalls.drawCalls++;
+	glDrawArrays(mode, first, count);
+}
+
+inline void countedDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instancecount)
+{
+	glCalls.drawCalls++;
+	glDrawArraysInstanced(mode, first, count, instancecount);
+}
+
+inline void countedDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+	glCalls.drawCalls++;
+	glDrawElements(mode, count, type, indices);
+}
+
+inline void countedDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void *indices, GLint basevertex)
+{
+	glCalls.drawCalls++;
+	glDrawElementsBaseVertex(mode, count, type, indices, basevertex);
+}
+
+inline void countedMultiDrawElementsIndirect(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride)
+{
+	glCalls.drawCalls++;
+	glMultiDrawElementsIndirect(mode, type, indirect, drawcount, stride);
+}
+
+#undef glBufferData
+#undef glBufferStorage
+#undef glBufferSubData
+#undef glBindTexture
+#undef glUseProgram
+#undef glDrawArrays
+#undef glDrawArraysInstanced
+#undef glDrawElements
+#undef glDrawElementsBaseVertex
+#undef glMultiDrawElementsIndirect
+
+#define glBufferData countedBufferData
+#define glBufferStorage countedBufferStorage
+#define glBufferSubData countedBufferSubData
+#define glBindTexture countedBindTexture
+#define glUseProgram countedUseProgram
+#define glDrawArrays countedDrawArrays
+#define glDrawArraysInstanced countedDrawArraysInstanced
+#define glDrawElements countedDrawElements
+#define glDrawElementsBaseVertex countedDrawElementsBaseVertex
+#define glMultiDrawElementsIndirect countedMultiDrawElementsIndirect
@@ -0,0 +1,68 @@
+/* icosphere.cpp
+ Run time icosphere subdivision with a midpoint cache
+*/
+
+#include "icosphere.h"
+
+#include <cmath>
+#include <unordered_map>
+
+using namespace std;
+
+void makeIcosphere(GLuint level, vector<GLfloat> &positions, vector<GLuint> &indices)
+{
+	// Rounded to float at every level, as each compile time level starts
+	// from the float positions of the one before
+	positions.clear();
+	positions.reserve(icosphere::numVertices(level) * 3);
+	for (GLuint v = 0; v < 12; v++)
+	{
+		const double *p = icosphere::BASE_VERTICES[v];
+		double len = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		for (GLuint c = 0; c < 3; c++) positions.push_back((GLfloat)(p[c] / len));
+	}
+
+	vector<GLuint> triangles(&icosphere::BASE_TRIANGLES[0][0], &icosphere::BASE_TRIANGLES[0][0] + 60);
+	vector<GLuint> next;
+
+	// Keyed by the two end vertices, smaller first, so each edge is split once
+	unordered_map<unsigned long long, GLuint> midpoints;
+
+	for (GLuint l = 0; l < level; l++)
+	{
+		midpoints.clear();
+		next.resize(triangles.size() * 4);
+
+		for (size_t t = 0; t < triangles.size() / 3; t++)
+		{
+			GLuint corner[3] = { triangles[t * 3], triangles[t * 3 + 1], triangles[t * 3 + 2] };
+			GLuint mid[3];
+			for (GLuint e = 0; e < 3; e++)
+			{
+				GLuint a = corner[e], b = corner[(e + 1) % 3];
+				unsigned long long key = a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+
+				auto cached = midpoints.find(key);
+				if (cached != midpoints.end())
+				{
+					mid[e] = cached->second;
+					continue;
+				}
+
+				double m[3];
+				for (GLuint c = 0; c < 3; c++) m[c] = (double)positions[a * 3 + c] + positions[b * 3 + c];
+				double len = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+				mid[e] = (GLuint)(positions.size() / 3);
+				for (GLuint c = 0; c < 3; c++) positions.push_back((GLfloat)(m[c] / len));
+				midpoints[key] = mid[e];
+			}
+
+			GLuint out[12] = { corner[0], mid[0], mid[2], corner[1], mid[1], mid[0],
+				corner[2], mid[2], mid[1], mid[0], mid[1], mid[2] };
+			for (GLuint i = 0; i < 12; i++) next[t * 12 + i] = out[i];
+		}
+		triangles.swap(next);
+	}
+
+	indices.swap(triangles);
+}
@@ -0,0 +1,152 @@
+/* icosphere.h
+ Unit icosphere: an icosahedron whose triangles are split into four at
+ every level with the new vertices pushed out onto the sphere. Triangles
+ are close to equal in size everywhere, unlike a latitude/longitude sphere
+ whose vertices bunch up at the poles.
+
+ IcosphereTable<Level> holds the vertex and index arrays of one level and
+ buildIcosphereTable<Level>() can be evaluated entirely at compile time from
+ the level below, so the levels used by the application cost nothing at
+ start up. Positions are rounded to float at every level. makeIcosphere()
+ builds any level at run time using a cache of edge midpoints so shared
+ vertices are only created once. Both give the same vertices and triangles.
+ Triangles wind counter-clockwise seen from outside.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <vector>
+
+namespace icosphere
+{
+	constexpr GLuint numVertices(GLuint level) { return 10 * (1u << (2 * level)) + 2; }
+	constexpr GLuint numTriangles(GLuint level) { return 20 * (1u << (2 * level)); }
+
+	/* Newton's method, std::sqrt is not constexpr. Starting above the root the
+	   steps only go down, so the first one that does not is rounding noise */
+	constexpr double sqrtConst(double x)
+	{
+		double r = x > 1.0 ? x : 1.0;
+		for (int i = 0; i < 64; i++)
+		{
+			double next = 0.5 * (r + x / r);
+			if (next >= r) break;
+			r = next;
+		}
+		return r;
+	}
+
+	constexpr double GOLDEN = 1.6180339887498948;
+
+	constexpr double BASE_VERTICES[12][3] = {
+		{ -1, GOLDEN, 0 }, { 1, GOLDEN, 0 }, { -1, -GOLDEN, 0 }, { 1, -GOLDEN, 0 },
+		{ 0, -1, GOLDEN }, { 0, 1, GOLDEN }, { 0, -1, -GOLDEN }, { 0, 1, -GOLDEN },
+		{ GOLDEN, 0, -1 }, { GOLDEN, 0, 1 }, { -GOLDEN, 0, -1 }, { -GOLDEN, 0, 1 } };
+
+	constexpr GLuint BASE_TRIANGLES[20][3] = {
+		{ 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+		{ 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+		{ 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+		{ 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 } };
+}
+
+template <GLuint Level>
+struct IcosphereTable
+{
+	static constexpr GLuint NUM_VERTICES = icosphere::numVertices(Level);
+	static constexpr GLuint NUM_INDICES = icosphere::numTriangles(Level) * 3;
+
+	GLfloat positions[NUM_VERTICES * 3];	// Also the normals
+	GLuint indices[NUM_INDICES];
+};
+
+template <GLuint Level>
+constexpr IcosphereTable<Level> buildIcosphereTable();
+
+/* Each level is its own constant, so building one only subdivides the level
+   before it and stays inside the compiler's step limit for a single constant
+   evaluation (GCC -fconstexpr-ops-limit, MSVC /constexpr:steps) */
+template <GLuint Level>
+constexpr IcosphereTable<Level> ICOSPHERE_TABLE = buildIcosphereTable<Level>();
+
+/* Subdivide the previous level at compile time. Every edge is met by two
+   triangles running in opposite directions, so when the first creates the
+   midpoint of (a, b) it files it under b for the second to find as (b, a).
+   Each vertex has at most six neighbours, so that is a short search */
+template <GLuint Level>
+constexpr IcosphereTable<Level> buildIcosphereTable()
+{
+	IcosphereTable<Level> table = {};
+
+	if constexpr (Level == 0)
+	{
+		for (GLuint v = 0; v < 12; v++)
+		{
+			double x = icosphere::BASE_VERTICES[v][0], y = icosphere::BASE_VERTICES[v][1], z = icosphere::BASE_VERTICES[v][2];
+			double len = icosphere::sqrtConst(x * x + y * y + z * z);
+			table.positions[v * 3] = (GLfloat)(x / len);
+			table.positions[v * 3 + 1] = (GLfloat)(y / len);
+			table.positions[v * 3 + 2] = (GLfloat)(z / len);
+		}
+		for (GLuint t = 0; t < 20; t++)
+		{
+			table.indices[t * 3] = icosphere::BASE_TRIANGLES[t][0];
+			table.indices[t * 3 + 1] = icosphere::BASE_TRIANGLES[t][1];
+			table.indices[t * 3 + 2] = icosphere::BASE_TRIANGLES[t][2];
+		}
+	}
+	else
+	{
+		const IcosphereTable<Level - 1> &prev = ICOSPHERE_TABLE<Level - 1>;
+		constexpr GLuint NP = IcosphereTable<Level - 1>::NUM_VERTICES;
+
+		GLuint edgeOther[NP][7] = {};
+		GLuint edgeMid[NP][6] = {};
+		GLuint edgeCount[NP] = {};
+
+		for (GLuint i = 0; i < NP * 3; i++) table.positions[i] = prev.positions[i];
+
+		GLuint numVertices = NP;
+		for (GLuint t = 0; t < icosphere::numTriangles(Level - 1); t++)
+		{
+			GLuint corner[3] = { prev.indices[t * 3], prev.indices[t * 3 + 1], prev.indices[t * 3 + 2] };
+			GLuint mid[3] = {};
+			for (GLuint e = 0; e < 3; e++)
+			{
+				GLuint a = corner[e], b = corner[e == 2 ? 0 : e + 1];
+
+				// b in the first free slot stops the search there if the edge is new
+				GLuint k = 0;
+				edgeOther[a][edgeCount[a]] = b;
+				while (edgeOther[a][k] != b) k++;
+				if (k < edgeCount[a])
+					mid[e] = edgeMid[a][k];
+				else
+				{
+					double x = (double)table.positions[a * 3] + table.positions[b * 3];
+					double y = (double)table.positions[a * 3 + 1] + table.positions[b * 3 + 1];
+					double z = (double)table.positions[a * 3 + 2] + table.positions[b * 3 + 2];
+					double len = icosphere::sqrtConst(x * x + y * y + z * z);
+					table.positions[numVertices * 3] = (GLfloat)(x / len);
+					table.positions[numVertices * 3 + 1] = (GLfloat)(y / len);
+					table.positions[numVertices * 3 + 2] = (GLfloat)(z / len);
+
+					edgeOther[b][edgeCount[b]] = a;
+					edgeMid[b][edgeCount[b]++] = numVertices;
+					mid[e] = numVertices++;
+				}
+			}
+
+			GLuint i = t * 12;
+			table.indices[i] = corner[0]; table.indices[i + 1] = mid[0]; table.indices[i + 2] = mid[2];
+			table.indices[i + 3] = corner[1]; table.indices[i + 4] = mid[1]; table.indices[i + 5] = mid[0];
+			table.indices[i + 6] = corner[2]; table.indices[i + 7] = mid[2]; table.indices[i + 8] = mid[1];
+			table.indices[i + 9] = mid[0]; table.indices[i + 10] = mid[1]; table.indices[i + 11] = mid[2];
+		}
+	}
+	return table;
+}
+
+/* Run time generator for any level, same output as buildIcosphereTable */
+void makeIcosphere(GLuint level, std::vector<GLfloat> &positions, std::vector<GLuint> &indices);
@@ -0,0 +1,144 @@
+/* ktx.cpp
+ KTX 1.1 container support for block compressed textures
+*/
+
+#include "ktx.h"
+
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const GLuint KTX_ENDIAN_REF = 0x04030201;
+
+struct KTXHeader
+{
+	unsigned char identifier[12];
+	GLuint endianness;
+	GLuint glType;
+	GLuint glTypeSize;
+	GLuint glFormat;
+	GLuint glInternalFormat;
+	GLuint glBaseInternalFormat;
+	GLuint pixelWidth;
+	GLuint pixelHeight;
+	GLuint pixelDepth;
+	GLuint numberOfArrayElements;
+	GLuint numberOfFaces;
+	GLuint numberOfMipmapLevels;
+	GLuint bytesOfKeyValueData;
+};
+
+bool CompressedTexture::load(const string &path)
+{
+	levelData.clear();
+	levelSize.clear();
+	if (!mapped.open(path)) return false;
+
+	KTXHeader header;
+	if (mapped.size() < sizeof(header)) return false;
+	memcpy(&header, mapped.data(), sizeof(header));
+
+	// Only little endian, single 2D, block compressed images are written by the encoder tool
+	if (memcmp(header.identifier, KTX_IDENTIFIER, 12) != 0 || header.endianness != KTX_ENDIAN_REF
+		|| header.glType != 0 || header.pixelDepth > 1 || header.numberOfFaces != 1 || header.numberOfArrayElements > 1)
+	{
+		mapped.close();
+		return false;
+	}
+
+	internalFormat = header.glInternalFormat;
+	width = header.pixelWidth;
+	height = header.pixelHeight;
+
+	size_t offset = sizeof(header) + header.bytesOfKeyValueData;
+	GLuint numLevels = header.numberOfMipmapLevels ? header.numberOfMipmapLevels : 1;
+	for (GLuint i = 0; i < numLevels; i++)
+	{
+		GLuint imageSize;
+		if (offset + 4 > mapped.size()) break;
+		memcpy(&imageSize, mapped.data() + offset, 4);
+		offset += 4;
+		if (offset + imageSize > mapped.size()) break;
+
+		levelData.push_back(mapped.data() + offset);
+		levelSize.push_back(imageSize);
+		offset += (imageSize + 3) & ~3u;
+	}
+
+	if (levelData.size() != numLevels)
+	{
+		levelData.clear();
+		levelSize.clear();
+		mapped.close();
+		return false;
+	}
+	return true;
+}
+
+void CompressedTexture::upload() const
+{
+	GLuint w = width, h = height;
+	for (GLuint i = 0; i < levelData.size(); i++)
+	{
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat, w, h, 0, levelSize[i], levelData[i]);
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levelData.size() - 1);
+}
+
+size_t CompressedTexture::byteSize() const
+{
+	size_t total = 0;
+	for (GLuint size : levelSize) total += size;
+	return total;
+}
+
+bool compressedFormatSupported(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			return ogl_ext_EXT_texture_compression_s3tc != 0;
+		case GL_COMPRESSED_RGBA_BPTC_UNORM:
+			return true;		// Core since OpenGL 4.2, which GLWrapper requests
+	}
+	return false;
+}
+
+bool writeKTX(const string &path, GLenum internalFormat, GLenum baseInternalFormat,
+	GLuint width, GLuint height, const vector<vector<unsigned char> > &levels)
+{
+	ofstream file(path, ios::out | ios::binary | ios::trunc);
+	if (!file.is_open()) return false;
+
+	KTXHeader header;
+	memcpy(header.identifier, KTX_IDENTIFIER, 12);
+	header.endianness = KTX_ENDIAN_REF;
+	header.glType = 0;
+	header.glTypeSize = 1;
+	header.glFormat = 0;
+	header.glInternalFormat = internalFormat;
+	header.glBaseInternalFormat = baseInternalFormat;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.pixelDepth = 0;
+	header.numberOfArrayElements = 0;
+	header.numberOfFaces = 1;
+	header.numberOfMipmapLevels = (GLuint)levels.size();
+	header.bytesOfKeyValueData = 0;
+	file.write((const char *)&header, sizeof(header));
+
+	static const char padding[4] = { 0, 0, 0, 0 };
+	for (const auto &level : levels)
+	{
+		GLuint imageSize = (GLuint)level.size();
+		file.write((const char *)&imageSize, 4);
+		file.write((const char *)level.data(), imageSize);
+		file.write(padding, ((imageSize + 3) & ~3u) - imageSize);
+	}
+	return !file.fail();
+}
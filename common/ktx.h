@@ -0,0 +1,52 @@
+/* ktx.h
+ Reader and writer for block compressed textures in the KTX 1.1 container.
+ Files are memory mapped on load and every stored mip level is uploaded
+ with glCompressedTexImage2D.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "texture_cache.h"
+#include <string>
+#include <vector>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+class CompressedTexture
+{
+public:
+	CompressedTexture() : internalFormat(0), width(0), height(0) {}
+
+	GLenum internalFormat;
+	GLuint width, height;
+
+	// One entry per mip level, pointing into the mapped file
+	std::vector<const unsigned char *> levelData;
+	std::vector<GLuint> levelSize;
+
+	bool load(const std::string &path);
+
+	/* Upload into the currently bound GL_TEXTURE_2D */
+	void upload() const;
+
+	size_t byteSize() const;
+
+private:
+	MappedFile mapped;
+};
+
+/* True if the driver can sample the given compressed format */
+bool compressedFormatSupported(GLenum internalFormat);
+
+/* Write mip levels (largest first) to a KTX file */
+bool writeKTX(const std::string &path, GLenum internalFormat, GLenum baseInternalFormat,
+	GLuint width, GLuint height, const std::vector<std::vector<unsigned char> > &levels);
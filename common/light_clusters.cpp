@@ -0,0 +1,226 @@
+/* light_clusters.cpp
+ CPU binning of point lights into view space clusters
+*/
+
+#include "light_clusters.h"
+#include "gl_counters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CLUSTERS_SSE2
+#endif
+
+using namespace glm;
+
+static GLint bitCount(GLuint bits)
+{
+	GLint count = 0;
+	for (; bits; bits &= bits - 1) count++;
+	return count;
+}
+
+/* First and last of cells columns (or rows) that a sphere at (a, z) in the
+   plane of the boundary normals reaches into. Bit k of reaches is set if
+   some of the sphere is past boundary k, of beyond if all of it is */
+static void cellRange(const GLfloat *normalA, const GLfloat *normalZ, GLuint cells, GLfloat a, GLfloat z, GLfloat radius,
+	GLint &first, GLint &last)
+{
+	GLuint reaches = 0, beyond = 0;
+	GLuint k = 0;
+#ifdef CLUSTERS_SSE2
+	// Four boundaries per iteration, one lane each
+	__m128 va = _mm_set1_ps(a), vz = _mm_set1_ps(z);
+	__m128 r = _mm_set1_ps(radius), negR = _mm_set1_ps(-radius);
+	for (; k + 4 <= cells + 1; k += 4)
+	{
+		__m128 d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(normalA + k), va), _mm_mul_ps(_mm_loadu_ps(normalZ + k), vz));
+		reaches |= (GLuint)_mm_movemask_ps(_mm_cmpgt_ps(d, negR)) << k;
+		beyond |= (GLuint)_mm_movemask_ps(_mm_cmpge_ps(d, r)) << k;
+	}
+#endif
+	for (; k <= cells; k++)
+	{
+		GLfloat d = normalA[k] * a + normalZ[k] * z;
+		if (d > -radius) reaches |= 1u << k;
+		if (d >= radius) beyond |= 1u << k;
+	}
+
+	// Both sets are runs from boundary 0, as the distances fall across the grid
+	last = bitCount(reaches & ((1u << cells) - 1)) - 1;
+	first = bitCount(beyond & ((1u << (cells + 1)) - 2));
+}
+
+LightClusters::LightClusters() : scale(0.f), lightCount(0), listEntries(0), longestList(0), dropped(0)
+{
+	dims[0] = CLUSTERS_X;
+	dims[1] = CLUSTERS_Y;
+	dims[2] = CLUSTERS_Z;
+	dims[3] = 0;
+	for (GLuint i = 0; i < 3; i++) buffers[i] = textures[i] = 0;
+}
+
+LightClusters::~LightClusters()
+{
+	if (buffers[0] && glfwGetCurrentContext())
+	{
+		glDeleteTextures(3, textures);
+		glDeleteBuffers(3, buffers);
+	}
+}
+
+void LightClusters::create()
+{
+	static const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+	const GLsizeiptr sizes[3] = { MAX_LIGHTS * 2 * sizeof(vec4), NUM_CLUSTERS * 2 * sizeof(GLuint), MAX_INDICES * sizeof(unsigned short) };
+
+	glGenBuffers(3, buffers);
+	glGenTextures(3, textures);
+	for (GLuint i = 0; i < 3; i++)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, sizes[i], NULL, GL_DYNAMIC_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	grid.resize(NUM_CLUSTERS * 2);
+	filled.resize(NUM_CLUSTERS);
+}
+
+void LightClusters::update(const std::vector<PointLight> &lights, const mat4 &view, const mat4 &projection,
+	GLfloat nearPlane, GLfloat farPlane, GLuint viewportWidth, GLuint viewportHeight)
+{
+	// A boundary at NDC x = a holds the points where
+	// projection[0][0] * x + (projection[2][0] + a) * z = 0
+	for (GLuint k = 0; k <= CLUSTERS_X; k++)
+	{
+		vec2 normal(projection[0][0], projection[2][0] + (2.f * k / CLUSTERS_X - 1.f));
+		normal = normalize(normal);
+		columnX[k] = normal.x;
+		columnZ[k] = normal.y;
+	}
+	for (GLuint k = 0; k <= CLUSTERS_Y; k++)
+	{
+		vec2 normal(projection[1][1], projection[2][1] + (2.f * k / CLUSTERS_Y - 1.f));
+		normal = normalize(normal);
+		rowY[k] = normal.x;
+		rowZ[k] = normal.y;
+	}
+
+	GLfloat slicesPerLog = CLUSTERS_Z / std::log(farPlane / nearPlane);
+	scale = vec4((GLfloat)CLUSTERS_X / viewportWidth, (GLfloat)CLUSTERS_Y / viewportHeight, slicesPerLog,
+		-std::log(nearPlane) * slicesPerLog);
+	auto slice = [this](GLfloat depth)
+	{
+		GLint s = (GLint)std::floor(std::log(depth) * scale.z + scale.w);
+		return std::min(std::max(s, 0), (GLint)CLUSTERS_Z - 1);
+	};
+
+	lightCount = (GLuint)std::min(lights.size(), (size_t)MAX_LIGHTS);
+	dims[3] = lightCount ? 1 : 0;
+	lightData.resize(lightCount * 2);
+	ranges.resize(lightCount * 6);
+	std::fill(grid.begin(), grid.end(), 0);
+
+	// Find each light's clusters and count the entries of every list
+	for (GLuint i = 0; i < lightCount; i++)
+	{
+		const PointLight &light = lights[i];
+		vec3 c = vec3(view * vec4(light.position, 1.f));
+		GLfloat r = light.radius;
+		lightData[2 * i] = vec4(c, r);
+		lightData[2 * i + 1] = vec4(light.colour, 0.f);
+
+		GLuint *range = &ranges[6 * i];
+		range[0] = 1;
+		range[1] = 0;
+		GLfloat nearest = -c.z - r, furthest = -c.z + r;
+		if (furthest <= nearPlane) continue;
+
+		// A sphere reaching behind the near plane may cover any tile
+		GLint x0 = 0, x1 = CLUSTERS_X - 1, y0 = 0, y1 = CLUSTERS_Y - 1;
+		if (nearest > nearPlane)
+		{
+			cellRange(columnX, columnZ, CLUSTERS_X, c.x, c.z, r, x0, x1);
+			cellRange(rowY, rowZ, CLUSTERS_Y, c.y, c.z, r, y0, y1);
+			if (x0 > x1 || y0 > y1) continue;
+		}
+		GLint z0 = slice(std::max(nearest, nearPlane)), z1 = slice(furthest);
+
+		range[0] = x0;
+		range[1] = x1;
+		range[2] = y0;
+		range[3] = y1;
+		range[4] = z0;
+		range[5] = z1;
+		for (GLint z = z0; z <= z1; z++)
+			for (GLint y = y0; y <= y1; y++)
+				for (GLint x = x0; x <= x1; x++)
+					grid[2 * ((z * CLUSTERS_Y + y) * CLUSTERS_X + x) + 1]++;
+	}
+
+	// Lay the lists out one after another, as far as there is room
+	GLuint offset = 0;
+	longestList = dropped = 0;
+	for (GLuint cluster = 0; cluster < NUM_CLUSTERS; cluster++)
+	{
+		GLuint length = grid[2 * cluster + 1];
+		if (offset + length > MAX_INDICES)
+		{
+			dropped += offset + length - MAX_INDICES;
+			length = MAX_INDICES - offset;
+		}
+		grid[2 * cluster] = offset;
+		grid[2 * cluster + 1] = length;
+		longestList = std::max(longestList, length);
+		offset += length;
+	}
+	listEntries = offset;
+
+	indices.resize(listEntries);
+	std::fill(filled.begin(), filled.end(), 0);
+	for (GLuint i = 0; i < lightCount; i++)
+	{
+		const GLuint *range = &ranges[6 * i];
+		if (range[0] > range[1]) continue;
+		for (GLuint z = range[4]; z <= range[5]; z++)
+			for (GLuint y = range[2]; y <= range[3]; y++)
+				for (GLuint x = range[0]; x <= range[1]; x++)
+				{
+					GLuint cluster = (z * CLUSTERS_Y + y) * CLUSTERS_X + x;
+					if (filled[cluster] < grid[2 * cluster + 1])
+						indices[grid[2 * cluster] + filled[cluster]++] = (unsigned short)i;
+				}
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, lightData.size() * sizeof(vec4), lightData.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[1]);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, grid.size() * sizeof(GLuint), grid.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[2]);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, indices.size() * sizeof(unsigned short), indices.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bindTextures() const
+{
+	static const GLuint units[3] = { LIGHT_DATA_UNIT, LIGHT_GRID_UNIT, LIGHT_INDEX_UNIT };
+	for (GLuint i = 0; i < 3; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + units[i]);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::report() const
+{
+	printf("Light clusters: %u lights, %u list entries (%.2f per cluster, longest %u), %u dropped\n", lightCount,
+		listEntries, (double)listEntries / NUM_CLUSTERS, longestList, dropped);
+}
@@ -0,0 +1,91 @@
+/* light_clusters.h
+ Clustered forward lighting for many small point lights. The view frustum
+ is divided into CLUSTERS_X x CLUSTERS_Y tiles on screen and CLUSTERS_Z
+ slices in depth, spaced exponentially so that clusters far away are no
+ flatter than near ones. Each frame update() bins the lights on the CPU
+ into every cluster their sphere of influence can reach and uploads three
+ texture buffers:
+
+   lightdata (unit 4, RGBA32F)     eye space position and radius, then colour
+   lightgrid (unit 5, RG32UI)      offset and length of each cluster's list
+   lightindices (unit 6, R16UI)    the lists of light indices, one after another
+
+ A fragment finds its cluster from gl_FragCoord and its depth and only
+ loops over that cluster's list, so its cost follows the number of lights
+ around it rather than the number in the scene.
+
+ A light's column range is found by testing its centre against all the
+ column boundary planes, four planes at a time with SSE2 where it is
+ available, and counting how many it is beyond: the planes all pass
+ through the eye, so the distances fall monotonically across the screen.
+ Rows are found the same way and slices from the depth range directly.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+struct PointLight
+{
+	glm::vec3 position;		// World space
+	GLfloat radius;			// The light fades to nothing at this distance
+	glm::vec3 colour;
+};
+
+/* Texture units of the three buffers, set for each program in the Shader class */
+const GLuint LIGHT_DATA_UNIT = 4;
+const GLuint LIGHT_GRID_UNIT = 5;
+const GLuint LIGHT_INDEX_UNIT = 6;
+
+class LightClusters
+{
+public:
+	static const GLuint CLUSTERS_X = 16;
+	static const GLuint CLUSTERS_Y = 8;
+	static const GLuint CLUSTERS_Z = 24;
+	static const GLuint NUM_CLUSTERS = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+	static const GLuint MAX_LIGHTS = 256;
+	static const GLuint MAX_INDICES = NUM_CLUSTERS * 32;
+
+	LightClusters();
+	~LightClusters();
+
+	void create();
+
+	/* Bin the first MAX_LIGHTS lights for a camera. The slices cover depths
+	   from nearPlane to farPlane; anything further is in the last one */
+	void update(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection,
+		GLfloat nearPlane, GLfloat farPlane, GLuint viewportWidth, GLuint viewportHeight);
+
+	/* Bind the three buffers to their texture units */
+	void bindTextures() const;
+
+	/* The FrameData values the shaders locate clusters with */
+	glm::vec4 scale;
+	GLuint dims[4];
+
+	// Results of the last update()
+	GLuint lightCount;
+	GLuint listEntries;			// Light indices in all lists together
+	GLuint longestList;
+	GLuint dropped;				// Entries beyond MAX_INDICES
+
+	void report() const;
+
+private:
+	GLuint buffers[3];
+	GLuint textures[3];
+
+	std::vector<glm::vec4> lightData;
+	std::vector<GLuint> grid;			// Offset and length per cluster
+	std::vector<unsigned short> indices;
+	std::vector<GLuint> ranges;			// First and last column, row and slice of each light
+	std::vector<GLuint> filled;			// Entries written to each list so far
+
+	// Column and row boundary planes through the eye, as the x or y and the
+	// z of their normals, pointing towards increasing NDC
+	GLfloat columnX[CLUSTERS_X + 1], columnZ[CLUSTERS_X + 1];
+	GLfloat rowY[CLUSTERS_Y + 1], rowZ[CLUSTERS_Y + 1];
+};
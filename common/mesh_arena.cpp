@@ -0,0 +1,255 @@
+/* mesh_arena.cpp
+ Shared vertex/index arena for static meshes and indirect draw batches
+*/
+
+#include "mesh_arena.h"
+#include "static_geometry.h"
+#include "gl_counters.h"
+
+#include <cstring>
+
+using namespace std;
+
+static const GLuint FLOATS_PER_VERTEX = 12;		// position 3, colour 4, normal 3, texcoord 2
+static const GLuint DRAW_INDEX_ATTRIBUTE = 4;
+
+MeshArena::MeshArena() : vao(0), vertexBuffer(0), indexBuffer(0), drawIndexBuffer(0), dirty(false)
+{
+}
+
+MeshArena::~MeshArena()
+{
+	if (vao && glfwGetCurrentContext())
+	{
+		glDeleteBuffers(1, &vertexBuffer);
+		glDeleteBuffers(1, &indexBuffer);
+		glDeleteBuffers(1, &drawIndexBuffer);
+		glDeleteVertexArrays(1, &vao);
+	}
+}
+
+GLuint MeshArena::addMesh(const string &key, const GLfloat *positions, const GLfloat *normals, const GLfloat *colours,
+	const GLfloat *texcoords, GLuint numVertices, const GLuint *meshIndices, GLuint numIndices)
+{
+	GLuint existing = findMesh(key);
+	if (existing != NO_MESH) return existing;
+
+	ArenaMesh mesh;
+	mesh.baseVertex = (GLint)(vertices.size() / FLOATS_PER_VERTEX);
+	mesh.firstIndex = (GLuint)indices.size();
+	mesh.numVertices = numVertices;
+	mesh.numIndices = numIndices;
+
+	size_t start = vertices.size();
+	vertices.resize(start + (size_t)numVertices * FLOATS_PER_VERTEX, 0.f);
+	for (GLuint i = 0; i < numVertices; i++)
+	{
+		GLfloat *v = &vertices[start + (size_t)i * FLOATS_PER_VERTEX];
+		memcpy(v, positions + i * 3, 3 * sizeof(GLfloat));
+		if (colours) memcpy(v + 3, colours + i * 4, 4 * sizeof(GLfloat));
+		if (normals) memcpy(v + 7, normals + i * 3, 3 * sizeof(GLfloat));
+		if (texcoords) memcpy(v + 10, texcoords + i * 2, 2 * sizeof(GLfloat));
+	}
+	indices.insert(indices.end(), meshIndices, meshIndices + numIndices);
+
+	meshes.push_back(mesh);
+	if (!key.empty()) meshIds[key] = (GLuint)meshes.size() - 1;
+	dirty = true;
+	return (GLuint)meshes.size() - 1;
+}
+
+GLuint MeshArena::findMesh(const string &key) const
+{
+	if (key.empty()) return NO_MESH;
+	auto found = meshIds.find(key);
+	return found == meshIds.end() ? NO_MESH : found->second;
+}
+
+void MeshArena::upload()
+{
+	if (!dirty) return;
+	dirty = false;
+
+	// Immutable buffers cannot grow, so adding meshes recreates them.
+	// This only happens while the scene is loading
+	if (!vao)
+	{
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+
+		vector<GLuint> drawIndices(MAX_DRAWS);
+		for (GLuint i = 0; i < MAX_DRAWS; i++) drawIndices[i] = i;
+		glGenBuffers(1, &drawIndexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+		StaticGeometry::createImmutable(GL_ARRAY_BUFFER, MAX_DRAWS * sizeof(GLuint), drawIndices.data());
+		glVertexAttribIPointer(DRAW_INDEX_ATTRIBUTE, 1, GL_UNSIGNED_INT, 0, 0);
+		glVertexAttribDivisor(DRAW_INDEX_ATTRIBUTE, 1);
+
+		// Without baseInstance the fallback loop supplies the index as a constant attribute
+		if (IndirectBatch::multiDrawSupported()) glEnableVertexAttribArray(DRAW_INDEX_ATTRIBUTE);
+	}
+	else
+	{
+		glBindVertexArray(vao);
+		glDeleteBuffers(1, &vertexBuffer);
+		glDeleteBuffers(1, &indexBuffer);
+	}
+
+	glGenBuffers(1, &vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	StaticGeometry::createImmutable(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data());
+
+	GLsizei stride = FLOATS_PER_VERTEX * sizeof(GLfloat);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(GLfloat)));
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(7 * sizeof(GLfloat)));
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, stride, (void*)(10 * sizeof(GLfloat)));
+	for (GLuint i = 0; i < 4; i++) glEnableVertexAttribArray(i);
+
+	glGenBuffers(1, &indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	StaticGeometry::createImmutable(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data());
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MeshArena::bind() const
+{
+	glBindVertexArray(vao);
+}
+
+size_t MeshArena::byteSize() const
+{
+	return vertices.size() * sizeof(GLfloat) + indices.size() * sizeof(GLuint);
+}
+
+
+void DrawData::setNormalMatrix(const glm::mat4 &modelView)
+{
+	glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(modelView)));
+	normal0 = normal[0];
+	normal1 = normal[1];
+	normal2 = normal[2];
+}
+
+IndirectBatch::IndirectBatch() : commandBuffer(0), dataBuffer(0), dataTexture(0), capacity(0), geometryRevision(0)
+{
+}
+
+IndirectBatch::~IndirectBatch()
+{
+	if (capacity && glfwGetCurrentContext())
+	{
+		glDeleteBuffers(1, &commandBuffer);
+		glDeleteBuffers(1, &dataBuffer);
+		glDeleteTextures(1, &dataTexture);
+	}
+}
+
+bool IndirectBatch::multiDrawSupported()
+{
+	return ogl_IsVersionGEQ(4, 3) || ogl_ext_ARB_multi_draw_indirect;
+}
+
+GLuint IndirectBatch::add(const MeshArena &arena, GLuint mesh)
+{
+	const ArenaMesh &m = arena.mesh(mesh);
+	GLuint draw = (GLuint)commands.size();
+
+	IndirectCommand command = { m.numIndices, 1, m.firstIndex, m.baseVertex, draw };
+	commands.push_back(command);
+	meshFirstIndex.push_back(m.firstIndex);
+	data.push_back(DrawData());
+	visibleDraws.push_back(1);
+	geometryRevision++;
+	return draw;
+}
+
+void IndirectBatch::set(GLuint draw, GLuint firstIndex, GLuint count, const DrawData &drawData)
+{
+	IndirectCommand &command = commands[draw];
+	if (command.firstIndex != meshFirstIndex[draw] + firstIndex || command.count != count || data[draw].model != drawData.model)
+		geometryRevision++;
+
+	commands[draw].firstIndex = meshFirstIndex[draw] + firstIndex;
+	commands[draw].count = count;
+	commands[draw].instanceCount = count ? 1 : 0;
+	data[draw] = drawData;
+}
+
+void IndirectBatch::reserveBuffers()
+{
+	if (capacity >= commands.size()) return;
+
+	if (capacity)
+	{
+		glDeleteBuffers(1, &commandBuffer);
+		glDeleteBuffers(1, &dataBuffer);
+		glDeleteTextures(1, &dataTexture);
+	}
+	capacity = (GLuint)commands.size() * 2;
+	if (capacity > MeshArena::MAX_DRAWS) capacity = MeshArena::MAX_DRAWS;
+
+	glGenBuffers(1, &commandBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, capacity * sizeof(IndirectCommand), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	glGenBuffers(1, &dataBuffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, dataBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, capacity * sizeof(DrawData), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGenTextures(1, &dataTexture);
+	glBindTexture(GL_TEXTURE_BUFFER, dataTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, dataBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void IndirectBatch::draw(const MeshArena &arena, GLenum mode, bool cull)
+{
+	if (commands.empty()) return;
+	reserveBuffers();
+
+	GLuint numDraws = commands.size() < capacity ? (GLuint)commands.size() : capacity;
+
+	// One update of the per-draw data whatever the number of objects
+	glBindBuffer(GL_TEXTURE_BUFFER, dataBuffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, numDraws * sizeof(DrawData), data.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, dataTexture);
+	glActiveTexture(GL_TEXTURE0);
+
+	arena.bind();
+
+	const IndirectCommand *submitted = commands.data();
+	if (cull)
+	{
+		culledCommands.assign(commands.begin(), commands.begin() + numDraws);
+		for (GLuint i = 0; i < numDraws; i++)
+			if (!visibleDraws[i]) culledCommands[i].instanceCount = 0;
+		submitted = culledCommands.data();
+	}
+
+	if (multiDrawSupported())
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, numDraws * sizeof(IndirectCommand), submitted);
+		glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, (void*)0, numDraws, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	else
+	{
+		for (GLuint i = 0; i < numDraws; i++)
+		{
+			const IndirectCommand &command = submitted[i];
+			if (!command.instanceCount) continue;
+			glVertexAttribI1ui(DRAW_INDEX_ATTRIBUTE, i);
+			glDrawElementsBaseVertex(mode, command.count, GL_UNSIGNED_INT,
+				(void*)(command.firstIndex * sizeof(GLuint)), command.baseVertex);
+		}
+	}
+}
@@ -0,0 +1,151 @@
+/* mesh_arena.h
+ GPU driven drawing of static meshes.
+ MeshArena packs every static mesh into one interleaved vertex buffer and
+ one index buffer behind a single vertex array object. IndirectBatch holds
+ one draw command and one block of per-draw data for each object and
+ submits them all with a single glMultiDrawElementsIndirect (GL 4.3 or
+ ARB_multi_draw_indirect). On older contexts the same commands are issued
+ from a loop, so the shaders and data are shared by both paths.
+
+ Per-draw data lives in a texture buffer so the shaders also run on GL 4.0.
+ The vertex shader finds its block through the draw index attribute: the
+ multi-draw path feeds it from an instanced buffer using baseInstance, the
+ fallback loop sets it as a constant attribute before each draw.
+
+ Vertex attributes: position 0, colour 1, normal 2, texcoord 3 (as bound by
+ TinyObjLoader), draw index 4.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct ArenaMesh
+{
+	GLint baseVertex;
+	GLuint firstIndex;
+	GLuint numVertices;
+	GLuint numIndices;
+};
+
+class MeshArena
+{
+public:
+	MeshArena();
+	~MeshArena();
+
+	/* Append a mesh and return its id. Arrays hold numVertices entries of
+	   3 (positions, normals), 4 (colours) or 2 (texcoords) floats; missing
+	   arrays are filled with zeros. Indices are relative to the mesh.
+	   A mesh added again under the same non-empty key is stored only once */
+	GLuint addMesh(const std::string &key, const GLfloat *positions, const GLfloat *normals, const GLfloat *colours, const GLfloat *texcoords,
+		GLuint numVertices, const GLuint *indices, GLuint numIndices);
+
+	const ArenaMesh &mesh(GLuint id) const { return meshes[id]; }
+	GLuint numMeshes() const { return (GLuint)meshes.size(); }
+
+	/* Recreate the GPU buffers if meshes were added since the last call */
+	void upload();
+
+	/* Bind the arena's vertex array object */
+	void bind() const;
+
+	/* Id of the mesh stored under key, or NO_MESH */
+	GLuint findMesh(const std::string &key) const;
+
+	size_t byteSize() const;
+
+	static const GLuint NO_MESH = 0xFFFFFFFF;
+
+	/* Draw index attribute values available to the multi-draw path */
+	static const GLuint MAX_DRAWS = 4096;
+
+private:
+	GLuint vao;
+	GLuint vertexBuffer;
+	GLuint indexBuffer;
+	GLuint drawIndexBuffer;
+
+	std::vector<GLfloat> vertices;		// 12 floats per vertex
+	std::vector<GLuint> indices;
+	std::vector<ArenaMesh> meshes;
+	std::map<std::string, GLuint> meshIds;
+	bool dirty;
+};
+
+/* Layout of GL's indirect element draw command */
+struct IndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+/* Per-draw data, seven RGBA32F texels in the draw data texture buffer: the
+   model matrix, then the columns of the eye space normal matrix with the
+   scalars in their fourth components */
+struct DrawData
+{
+	glm::mat4 model;
+	glm::vec3 normal0;		// See setNormalMatrix()
+	GLfloat layer;			// Texture array layer
+	glm::vec3 normal1;
+	GLfloat padding;		// Unused, keeps the column a whole texel
+	glm::vec3 normal2;
+	GLfloat receiveShadow;	// 1 to darken the mesh where the shadow map is occluded
+
+	/* Store the normal matrix of modelView, the view times the model matrix */
+	void setNormalMatrix(const glm::mat4 &modelView);
+};
+
+class IndirectBatch
+{
+public:
+	IndirectBatch();
+	~IndirectBatch();
+
+	/* Add a draw of an arena mesh and return its index in the batch */
+	GLuint add(const MeshArena &arena, GLuint mesh);
+
+	/* Update a draw for this frame. The index range is relative to the mesh,
+	   which allows a level of detail to be chosen; a count of 0 skips it */
+	void set(GLuint draw, GLuint firstIndex, GLuint count, const DrawData &data);
+
+	/* Hide a draw from culled passes without touching its command, so
+	   passes that ignore culling (such as shadows) still draw it */
+	void setVisible(GLuint draw, bool visible) { visibleDraws[draw] = visible ? 1 : 0; }
+
+	/* Submit all draws, skipping hidden ones if cull is set. The draw data
+	   buffer is bound to texture unit 1 */
+	void draw(const MeshArena &arena, GLenum mode, bool cull = true);
+
+	/* True if draws go through glMultiDrawElementsIndirect */
+	static bool multiDrawSupported();
+
+	GLuint numDraws() const { return (GLuint)commands.size(); }
+
+	/* Changes whenever a draw's model matrix or index range changes, so
+	   cached results such as shadow maps know to update */
+	GLuint revision() const { return geometryRevision; }
+
+private:
+	std::vector<IndirectCommand> commands;
+	std::vector<GLuint> meshFirstIndex;
+	std::vector<DrawData> data;
+	std::vector<unsigned char> visibleDraws;
+	std::vector<IndirectCommand> culledCommands;		// Commands with hidden draws zeroed
+
+	GLuint commandBuffer;
+	GLuint dataBuffer;
+	GLuint dataTexture;
+	GLuint capacity;
+	GLuint geometryRevision;
+
+	void reserveBuffers();
+};
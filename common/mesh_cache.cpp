@@ -0,0 +1,95 @@
+/* mesh_cache.cpp
+ Keyed, reference counted GPU meshes
+*/
+
+#include "mesh_cache.h"
+#include "gl_counters.h"
+
+#include <cstdio>
+
+using namespace std;
+
+GPUMesh::GPUMesh(const string &key) : key(key), numVertices(0), numIndices(0)
+{
+}
+
+GPUMesh::~GPUMesh()
+{
+	// Meshes held by globals can outlive the window and its context
+	if (!buffers.empty() && glfwGetCurrentContext())
+		glDeleteBuffers((GLsizei)buffers.size(), buffers.data());
+}
+
+GLuint GPUMesh::createBuffer(GLenum target, GLsizeiptr size, const void *data)
+{
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(target, buffer);
+	glBufferData(target, size, data, GL_STATIC_DRAW);
+	if (target != GL_ELEMENT_ARRAY_BUFFER) glBindBuffer(target, 0);
+
+	buffers.push_back(buffer);
+	bufferSizes.push_back((size_t)size);
+	return buffer;
+}
+
+size_t GPUMesh::byteSize() const
+{
+	size_t total = 0;
+	for (size_t size : bufferSizes) total += size;
+	return total;
+}
+
+
+shared_ptr<GPUMesh> MeshCache::acquire(const string &key, const function<void(GPUMesh &)> &create)
+{
+	lock_guard<mutex> lock(cacheMutex);
+
+	auto found = meshes.find(key);
+	if (found != meshes.end())
+	{
+		shared_ptr<GPUMesh> mesh = found->second.lock();
+		if (mesh) return mesh;
+	}
+
+	shared_ptr<GPUMesh> mesh(new GPUMesh(key));
+	create(*mesh);
+	meshes[key] = mesh;
+	return mesh;
+}
+
+void MeshCache::report() const
+{
+	lock_guard<mutex> lock(cacheMutex);
+
+	size_t total = 0;
+	printf("Mesh cache:\n");
+	for (const auto &entry : meshes)
+	{
+		shared_ptr<GPUMesh> mesh = entry.second.lock();
+		if (!mesh) continue;
+		printf("  %-40s %3ld users %6u vertices %7u indices %8.1f KB\n", entry.first.c_str(), mesh.use_count() - 1,
+			mesh->numVertices, mesh->numIndices, mesh->byteSize() / 1024.0);
+		total += mesh->byteSize();
+	}
+	printf("  total %.1f KB\n", total / 1024.0);
+}
+
+size_t MeshCache::byteSize() const
+{
+	lock_guard<mutex> lock(cacheMutex);
+
+	size_t total = 0;
+	for (const auto &entry : meshes)
+	{
+		shared_ptr<GPUMesh> mesh = entry.second.lock();
+		if (mesh) total += mesh->byteSize();
+	}
+	return total;
+}
+
+MeshCache &meshCache()
+{
+	static MeshCache cache;
+	return cache;
+}
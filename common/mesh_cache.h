@@ -0,0 +1,60 @@
+/* mesh_cache.h
+ Registry of GPU meshes keyed by how they were made, for example
+ "icosphere:4" or the path of an obj file. Objects asking for a mesh that
+ already exists share its buffers instead of creating their own, and the
+ buffers are deleted when the last user releases its reference.
+ Buffer byte sizes are tracked so memory can be reported per mesh.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class GPUMesh
+{
+public:
+	GPUMesh(const std::string &key);
+	~GPUMesh();
+
+	/* Create a buffer with static contents and return its name. Buffers
+	   are kept in creation order in buffers */
+	GLuint createBuffer(GLenum target, GLsizeiptr size, const void *data);
+
+	std::string key;
+	std::vector<GLuint> buffers;
+	std::vector<size_t> bufferSizes;
+	GLuint numVertices;
+	GLuint numIndices;
+
+	size_t byteSize() const;
+
+private:
+	GPUMesh(const GPUMesh &);
+	GPUMesh &operator=(const GPUMesh &);
+};
+
+class MeshCache
+{
+public:
+	/* Return the mesh for key, calling create on the GL thread to fill a new
+	   mesh if none is cached. The mesh lives while a shared_ptr to it exists */
+	std::shared_ptr<GPUMesh> acquire(const std::string &key, const std::function<void(GPUMesh &)> &create);
+
+	/* Print every live mesh with its number of users and buffer memory */
+	void report() const;
+
+	size_t byteSize() const;
+
+private:
+	mutable std::mutex cacheMutex;
+	std::map<std::string, std::weak_ptr<GPUMesh> > meshes;
+};
+
+/* The cache shared by the whole application */
+MeshCache &meshCache();
@@ -0,0 +1,350 @@
+/* mesh_lod.cpp
+ Quadric error metric simplification after Garland and Heckbert.
+ Only half-edge collapses are used (a vertex is merged into one of its
+ neighbours) so the simplified levels can share the original vertex buffer.
+*/
+
+#include "mesh_lod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+// Symmetric 4x4 quadric stored as its upper triangle
+struct Quadric
+{
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+	Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) {}
+
+	void addPlane(double a, double b, double c, double d, double w)
+	{
+		a2 += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+		b2 += w * b * b; bc += w * b * c; bd += w * b * d;
+		c2 += w * c * c; cd += w * c * d;
+		d2 += w * d * d;
+	}
+
+	void add(const Quadric &q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+
+	double evaluate(double x, double y, double z) const
+	{
+		return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+			+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+			+ c2 * z * z + 2 * cd * z
+			+ d2;
+	}
+};
+
+// A candidate collapse of vertex 'from' into vertex 'to'
+struct Collapse
+{
+	double cost;
+	GLuint from, to;
+	GLuint fromVersion, toVersion;
+
+	bool operator<(const Collapse &c) const { return cost > c.cost; }	// min-heap
+};
+
+static inline unsigned long long edgeKey(GLuint a, GLuint b)
+{
+	if (a > b) { GLuint t = a; a = b; b = t; }
+	return ((unsigned long long)a << 32) | b;
+}
+
+static void faceNormal(const GLfloat *p, GLuint i0, GLuint i1, GLuint i2, double n[3])
+{
+	double e1[3] = { p[i1 * 3] - p[i0 * 3], p[i1 * 3 + 1] - p[i0 * 3 + 1], p[i1 * 3 + 2] - p[i0 * 3 + 2] };
+	double e2[3] = { p[i2 * 3] - p[i0 * 3], p[i2 * 3 + 1] - p[i0 * 3 + 1], p[i2 * 3 + 2] - p[i0 * 3 + 2] };
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+vector<GLuint> simplifyMesh(const GLfloat *positions, GLuint numVertices,
+	const vector<GLuint> &indices, GLuint targetTriangles, GLfloat *outError)
+{
+	GLuint numFaces = (GLuint)indices.size() / 3;
+	vector<GLuint> tri(indices.begin(), indices.begin() + numFaces * 3);
+	vector<bool> faceAlive(numFaces, true);
+	vector<bool> vertexAlive(numVertices, true);
+	vector<GLuint> version(numVertices, 0);
+	vector<vector<GLuint> > vertexFaces(numVertices);
+	vector<Quadric> quadrics(numVertices);
+	unordered_map<unsigned long long, GLuint> edgeUse;
+
+	// Accumulate area weighted face planes into the vertex quadrics
+	for (GLuint f = 0; f < numFaces; f++)
+	{
+		GLuint v[3] = { tri[f * 3], tri[f * 3 + 1], tri[f * 3 + 2] };
+		double n[3];
+		faceNormal(positions, v[0], v[1], v[2], n);
+		double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (len > 0)
+		{
+			n[0] /= len; n[1] /= len; n[2] /= len;
+			double d = -(n[0] * positions[v[0] * 3] + n[1] * positions[v[0] * 3 + 1] + n[2] * positions[v[0] * 3 + 2]);
+			for (int k = 0; k < 3; k++)
+				quadrics[v[k]].addPlane(n[0], n[1], n[2], d, len * 0.5);
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			vertexFaces[v[k]].push_back(f);
+			edgeUse[edgeKey(v[k], v[(k + 1) % 3])]++;
+		}
+	}
+
+	// Boundary edges get a heavily weighted plane perpendicular to the face so
+	// open borders (and seams where the exporter split vertices) stay in place
+	for (GLuint f = 0; f < numFaces; f++)
+	{
+		GLuint v[3] = { tri[f * 3], tri[f * 3 + 1], tri[f * 3 + 2] };
+		double n[3];
+		faceNormal(positions, v[0], v[1], v[2], n);
+		for (int k = 0; k < 3; k++)
+		{
+			GLuint a = v[k], b = v[(k + 1) % 3];
+			if (edgeUse[edgeKey(a, b)] != 1) continue;
+
+			double e[3] = { positions[b * 3] - positions[a * 3], positions[b * 3 + 1] - positions[a * 3 + 1], positions[b * 3 + 2] - positions[a * 3 + 2] };
+			double p[3] = { e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0] };
+			double len = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+			if (len <= 0) continue;
+			p[0] /= len; p[1] /= len; p[2] /= len;
+			double d = -(p[0] * positions[a * 3] + p[1] * positions[a * 3 + 1] + p[2] * positions[a * 3 + 2]);
+			double w = 1000.0 * (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+			quadrics[a].addPlane(p[0], p[1], p[2], d, w);
+			quadrics[b].addPlane(p[0], p[1], p[2], d, w);
+		}
+	}
+
+	priority_queue<Collapse> heap;
+	auto pushEdge = [&](GLuint a, GLuint b)
+	{
+		Quadric q = quadrics[a];
+		q.add(quadrics[b]);
+		Collapse c;
+		c.cost = q.evaluate(positions[b * 3], positions[b * 3 + 1], positions[b * 3 + 2]);
+		c.from = a; c.to = b; c.fromVersion = version[a]; c.toVersion = version[b];
+		heap.push(c);
+		c.cost = q.evaluate(positions[a * 3], positions[a * 3 + 1], positions[a * 3 + 2]);
+		c.from = b; c.to = a; c.fromVersion = version[b]; c.toVersion = version[a];
+		heap.push(c);
+	};
+
+	for (auto &e : edgeUse)
+		pushEdge((GLuint)(e.first >> 32), (GLuint)(e.first & 0xffffffff));
+
+	GLuint liveFaces = numFaces;
+	double maxError = 0;
+	vector<GLuint> fromRing, toRing;
+
+	while (liveFaces > targetTriangles && !heap.empty())
+	{
+		Collapse c = heap.top();
+		heap.pop();
+
+		if (!vertexAlive[c.from] || !vertexAlive[c.to]) continue;
+		if (version[c.from] != c.fromVersion || version[c.to] != c.toVersion) continue;
+
+		// Link condition: an interior edge may share at most two neighbours,
+		// otherwise the collapse would create non-manifold geometry
+		fromRing.clear(); toRing.clear();
+		for (GLuint f : vertexFaces[c.from])
+			if (faceAlive[f]) for (int k = 0; k < 3; k++) fromRing.push_back(tri[f * 3 + k]);
+		for (GLuint f : vertexFaces[c.to])
+			if (faceAlive[f]) for (int k = 0; k < 3; k++) toRing.push_back(tri[f * 3 + k]);
+		sort(fromRing.begin(), fromRing.end());
+		fromRing.erase(unique(fromRing.begin(), fromRing.end()), fromRing.end());
+		sort(toRing.begin(), toRing.end());
+		toRing.erase(unique(toRing.begin(), toRing.end()), toRing.end());
+		GLuint shared = 0;
+		for (GLuint v : fromRing)
+			if (v != c.from && v != c.to && binary_search(toRing.begin(), toRing.end(), v)) shared++;
+		if (shared > 2) continue;
+
+		// Reject collapses that would flip or degenerate a surviving triangle
+		bool flips = false;
+		for (GLuint f : vertexFaces[c.from])
+		{
+			if (!faceAlive[f]) continue;
+			GLuint v[3] = { tri[f * 3], tri[f * 3 + 1], tri[f * 3 + 2] };
+			if (v[0] == c.to || v[1] == c.to || v[2] == c.to) continue;
+
+			double before[3], after[3];
+			faceNormal(positions, v[0], v[1], v[2], before);
+			for (int k = 0; k < 3; k++) if (v[k] == c.from) v[k] = c.to;
+			faceNormal(positions, v[0], v[1], v[2], after);
+			double dotp = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+			double lenb = sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]);
+			double lena = sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+			if (lena <= 1e-12 || dotp < 0.2 * lena * lenb)
+			{
+				flips = true;
+				break;
+			}
+		}
+		if (flips) continue;
+
+		// Collapse: faces using the edge die, the rest are rewired onto 'to'
+		for (GLuint f : vertexFaces[c.from])
+		{
+			if (!faceAlive[f]) continue;
+			GLuint *v = &tri[f * 3];
+			if (v[0] == c.to || v[1] == c.to || v[2] == c.to)
+			{
+				faceAlive[f] = false;
+				liveFaces--;
+				continue;
+			}
+			for (int k = 0; k < 3; k++) if (v[k] == c.from) v[k] = c.to;
+			vertexFaces[c.to].push_back(f);
+		}
+		vertexFaces[c.from].clear();
+		vertexAlive[c.from] = false;
+		quadrics[c.to].add(quadrics[c.from]);
+		version[c.to]++;
+		if (c.cost > maxError) maxError = c.cost;
+
+		for (GLuint v : fromRing)
+			if (v != c.from && v != c.to && vertexAlive[v]) pushEdge(c.to, v);
+		for (GLuint v : toRing)
+			if (v != c.from && v != c.to && vertexAlive[v]) pushEdge(c.to, v);
+	}
+
+	vector<GLuint> result;
+	result.reserve(liveFaces * 3);
+	for (GLuint f = 0; f < numFaces; f++)
+	{
+		if (!faceAlive[f]) continue;
+		result.push_back(tri[f * 3]);
+		result.push_back(tri[f * 3 + 1]);
+		result.push_back(tri[f * 3 + 2]);
+	}
+
+	if (outError) *outError = (GLfloat)maxError;
+	return result;
+}
+
+void buildLODChain(const GLfloat *positions, GLuint numVertices, const vector<GLuint> &indices,
+	GLuint numLevels, GLfloat ratio, vector<GLuint> &outIndices, vector<LODLevel> &outLevels)
+{
+	GLuint numFaces = (GLuint)indices.size() / 3;
+	vector<vector<GLuint> > levelIndices(numLevels);
+	vector<GLfloat> levelError(numLevels, 0.f);
+	vector<thread> workers;
+
+	levelIndices[0] = indices;
+
+	// Every level is simplified from the full mesh so they can run side by side
+	GLfloat target = (GLfloat)numFaces;
+	for (GLuint i = 1; i < numLevels; i++)
+	{
+		target *= ratio;
+		GLuint targetTriangles = (GLuint)target;
+		workers.push_back(thread([&, i, targetTriangles]() {
+			levelIndices[i] = simplifyMesh(positions, numVertices, indices, targetTriangles, &levelError[i]);
+		}));
+	}
+	for (auto &w : workers) w.join();
+
+	outIndices.clear();
+	outLevels.clear();
+	for (GLuint i = 0; i < numLevels; i++)
+	{
+		LODLevel level;
+		level.indexOffset = (GLuint)outIndices.size();
+		level.indexCount = (GLuint)levelIndices[i].size();
+		level.error = levelError[i];
+		outLevels.push_back(level);
+		outIndices.insert(outIndices.end(), levelIndices[i].begin(), levelIndices[i].end());
+	}
+}
+
+/* FNV-1a over the raw geometry */
+static void hashBytes(unsigned long long &h, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= bytes[i];
+		h *= 1099511628211ULL;
+	}
+}
+
+unsigned long long hashMesh(const GLfloat *positions, GLuint numVertices, const vector<GLuint> &indices,
+	GLuint numLevels, GLfloat ratio)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	hashBytes(h, positions, numVertices * 3 * sizeof(GLfloat));
+	hashBytes(h, indices.data(), indices.size() * sizeof(GLuint));
+	hashBytes(h, &numLevels, sizeof(numLevels));
+	hashBytes(h, &ratio, sizeof(ratio));
+	return h;
+}
+
+static const char LOD_CACHE_MAGIC[4] = { 'L', 'O', 'D', '1' };
+
+bool loadLODCache(const string &path, unsigned long long key, vector<GLuint> &outIndices, vector<LODLevel> &outLevels)
+{
+	ifstream file(path, ios::in | ios::binary);
+	if (!file.is_open()) return false;
+
+	char magic[4];
+	unsigned long long fileKey;
+	GLuint numLevels, numIndices;
+	file.read(magic, 4);
+	file.read((char *)&fileKey, sizeof(fileKey));
+	if (!file || memcmp(magic, LOD_CACHE_MAGIC, 4) != 0 || fileKey != key) return false;
+
+	// The counts are checked against what is left of the file before anything
+	// is allocated, so a damaged cache is rebuilt rather than trusted
+	streamoff start = file.tellg();
+	file.seekg(0, ios::end);
+	unsigned long long remaining = (unsigned long long)(file.tellg() - start);
+	file.seekg(start);
+
+	file.read((char *)&numLevels, sizeof(numLevels));
+	if (!file || numLevels == 0 || numLevels > remaining / sizeof(LODLevel)) return false;
+	outLevels.resize(numLevels);
+	file.read((char *)outLevels.data(), numLevels * sizeof(LODLevel));
+	remaining -= sizeof(numLevels) + numLevels * sizeof(LODLevel);
+
+	file.read((char *)&numIndices, sizeof(numIndices));
+	if (!file || remaining < sizeof(numIndices) || numIndices > (remaining - sizeof(numIndices)) / sizeof(GLuint))
+		return false;
+	for (const LODLevel &level : outLevels)
+		if (level.indexOffset > numIndices || level.indexCount > numIndices - level.indexOffset) return false;
+
+	outIndices.resize(numIndices);
+	file.read((char *)outIndices.data(), numIndices * sizeof(GLuint));
+	return !file.fail();
+}
+
+bool saveLODCache(const string &path, unsigned long long key, const vector<GLuint> &indices, const vector<LODLevel> &levels)
+{
+	ofstream file(path, ios::out | ios::binary | ios::trunc);
+	if (!file.is_open()) return false;
+
+	GLuint numLevels = (GLuint)levels.size();
+	GLuint numIndices = (GLuint)indices.size();
+	file.write(LOD_CACHE_MAGIC, 4);
+	file.write((const char *)&key, sizeof(key));
+	file.write((const char *)&numLevels, sizeof(numLevels));
+	file.write((const char *)levels.data(), numLevels * sizeof(LODLevel));
+	file.write((const char *)&numIndices, sizeof(numIndices));
+	file.write((const char *)indices.data(), numIndices * sizeof(GLuint));
+	return !file.fail();
+}
@@ -0,0 +1,41 @@
+/* mesh_lod.h
+ Builds a chain of simplified index buffers (levels of detail) for an indexed
+ triangle mesh using quadric error metric (QEM) half-edge collapses.
+ Vertices are never moved or created, so every level indexes the same vertex
+ buffer and keeps the original normals, colours and texture coordinates.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <string>
+#include <vector>
+
+// One level in a LOD chain, stored as a range in a shared element buffer
+struct LODLevel
+{
+	GLuint indexOffset;		// Offset into the shared element buffer (in indices)
+	GLuint indexCount;
+	GLfloat error;			// Largest quadric error accepted while building this level
+};
+
+/* Simplify a triangle list down to roughly targetTriangles triangles.
+   positions is tightly packed xyz, indices is a GL_TRIANGLES list.
+   Returns the new index list, the accepted error is written to outError */
+std::vector<GLuint> simplifyMesh(const GLfloat *positions, GLuint numVertices,
+	const std::vector<GLuint> &indices, GLuint targetTriangles, GLfloat *outError = NULL);
+
+/* Build numLevels levels, each with ratio times the triangles of the previous one.
+   Level 0 is the original index list. Levels 1..n are built in parallel. */
+void buildLODChain(const GLfloat *positions, GLuint numVertices, const std::vector<GLuint> &indices,
+	GLuint numLevels, GLfloat ratio, std::vector<GLuint> &outIndices, std::vector<LODLevel> &outLevels);
+
+/* Cache the LOD chain next to the source file. The key is a hash of the source
+   geometry and of the buildLODChain() settings, so a stale cache is ignored
+   after the model or the number of levels or their ratio changes */
+unsigned long long hashMesh(const GLfloat *positions, GLuint numVertices, const std::vector<GLuint> &indices,
+	GLuint numLevels, GLfloat ratio);
+bool loadLODCache(const std::string &path, unsigned long long key,
+	std::vector<GLuint> &outIndices, std::vector<LODLevel> &outLevels);
+bool saveLODCache(const std::string &path, unsigned long long key,
+	const std::vector<GLuint> &indices, const std::vector<LODLevel> &levels);
@@ -0,0 +1,381 @@
+/* program_builder.cpp
+ Batched shader compilation with a program binary cache
+*/
+
+#include "program_builder.h"
+#include "gl_counters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+
+using namespace std;
+
+static const GLenum STAGES[3] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+static const char *STAGE_NAMES[3] = { "vertex", "geometry", "fragment" };
+static const char CACHE_MAGIC[4] = { 'S', 'G', 'P', 'B' };
+
+static unsigned long long fnv1a(const void *data, size_t size, unsigned long long hash = 14695981039346656037ull)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+ProgramBuilder::ProgramBuilder(GLWrapper *glw, const string &cacheDir) : cacheHits(0), compiled(0), buildMs(0), glw(glw),
+	cacheDir(cacheDir), cacheEnabled(!cacheDir.empty())
+{
+}
+
+static string directoryOf(const string &path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == string::npos ? "" : path.substr(0, slash + 1);
+}
+
+/* Position of path in files, added at the end if it is new */
+static GLuint fileNumber(vector<string> &files, const string &path)
+{
+	auto found = find(files.begin(), files.end(), path);
+	if (found != files.end()) return (GLuint)(found - files.begin());
+	files.push_back(path);
+	return (GLuint)files.size() - 1;
+}
+
+GLuint ProgramBuilder::add(const char *vertex, const char *geometry, const char *fragment, const char *defines)
+{
+	Program program;
+	program.paths[0] = vertex;
+	program.paths[1] = geometry ? geometry : "";
+	program.paths[2] = fragment;
+	program.defines = defines ? defines : "";
+
+	for (GLuint i = 0; i < programs.size(); i++)
+	{
+		const Program &other = programs[i];
+		if (other.paths[0] == program.paths[0] && other.paths[1] == program.paths[1] && other.paths[2] == program.paths[2] &&
+			other.defines == program.defines) return i;
+	}
+
+	program.hash = 0;
+	program.id = 0;
+	program.shaders[0] = program.shaders[1] = program.shaders[2] = 0;
+	program.fromCache = false;
+	programs.push_back(program);
+	return (GLuint)programs.size() - 1;
+}
+
+string ProgramBuilder::cachePath(const Program &program) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", program.hash);
+	return cacheDir + "/" + name;
+}
+
+bool ProgramBuilder::expand(const string &path, string &out, vector<string> &files, vector<string> &included,
+	string &error) const
+{
+	// Once per stage, which also ends include cycles
+	if (find(included.begin(), included.end(), path) != included.end()) return true;
+	included.push_back(path);
+	GLuint number = fileNumber(files, path);
+
+	string text = glw->readFile(path.c_str());
+	if (text.empty())
+	{
+		error = "Could not read shader " + path;
+		return false;
+	}
+
+	GLuint line = 1;
+	for (size_t start = 0; start < text.size(); line++)
+	{
+		size_t end = text.find('\n', start);
+		if (end == string::npos) end = text.size();
+
+		size_t first = text.find_first_not_of(" \t", start);
+		if (first < end && text.compare(first, 8, "#include") == 0)
+		{
+			size_t open = text.find('"', first + 8);
+			size_t close = open < end ? text.find('"', open + 1) : string::npos;
+			if (close >= end)
+			{
+				error = path + "(" + to_string(line) + "): expected #include \"file\"";
+				return false;
+			}
+			string name = directoryOf(path) + text.substr(open + 1, close - open - 1);
+			out += "#line 1 " + to_string(fileNumber(files, name)) + "\n";
+			if (!expand(name, out, files, included, error)) return false;
+			out += "#line " + to_string(line + 1) + " " + to_string(number) + "\n";
+		}
+		else
+		{
+			out.append(text, start, end - start);
+			out += '\n';
+		}
+		start = end + 1;
+	}
+	return true;
+}
+
+bool ProgramBuilder::preprocess(Program &program, string &error) const
+{
+	string defines;
+	size_t start = 0;
+	while ((start = program.defines.find_first_not_of(' ', start)) != string::npos)
+	{
+		size_t end = program.defines.find(' ', start);
+		string define = program.defines.substr(start, end == string::npos ? string::npos : end - start);
+		size_t equals = define.find('=');
+		defines += "#define " + (equals == string::npos ? define + " 1" : define.substr(0, equals) + " " + define.substr(equals + 1)) + "\n";
+		start = end;
+	}
+
+	program.files.clear();
+	for (GLuint stage = 0; stage < 3; stage++)
+	{
+		program.sources[stage].clear();
+		if (program.paths[stage].empty()) continue;
+
+		vector<string> included;
+		string &source = program.sources[stage];
+		if (!expand(program.paths[stage], source, program.files, included, error)) return false;
+
+		// Nothing but comments may come before #version
+		size_t version = source.find("#version");
+		if (defines.empty() || version == string::npos) continue;
+		size_t end = source.find('\n', version);
+		GLuint line = (GLuint)count(source.begin(), source.begin() + version, '\n') + 2;
+		source.insert(end + 1, defines + "#line " + to_string(line) + " " + to_string(fileNumber(program.files, program.paths[stage])) + "\n");
+	}
+	return true;
+}
+
+bool ProgramBuilder::loadBinary(Program &program)
+{
+	FILE *file = fopen(cachePath(program).c_str(), "rb");
+	if (!file) return false;
+
+	char magic[4];
+	GLuint header[2];
+	vector<char> binary;
+	bool read = fread(magic, 1, 4, file) == 4 && memcmp(magic, CACHE_MAGIC, 4) == 0 && fread(header, sizeof(GLuint), 2, file) == 2;
+	if (read)
+	{
+		// A damaged file is a miss, not a length to allocate
+		long start = ftell(file);
+		read = fseek(file, 0, SEEK_END) == 0 && ftell(file) - start == (long)header[1] && fseek(file, start, SEEK_SET) == 0;
+	}
+	if (read)
+	{
+		binary.resize(header[1]);
+		read = fread(binary.data(), 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if (!read) return false;
+
+	// A driver update may refuse binaries from the old version
+	program.id = glCreateProgram();
+	glProgramBinary(program.id, header[0], binary.data(), (GLsizei)binary.size());
+	GLint status = GL_FALSE;
+	glGetProgramiv(program.id, GL_LINK_STATUS, &status);
+	if (status == GL_TRUE) return true;
+
+	glDeleteProgram(program.id);
+	program.id = 0;
+	return false;
+}
+
+void ProgramBuilder::saveBinary(const Program &program)
+{
+	GLint length = 0;
+	glGetProgramiv(program.id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(program.id, length, NULL, &format, binary.data());
+
+	FILE *file = fopen(cachePath(program).c_str(), "wb");
+	if (!file) return;
+	GLuint header[2] = { format, (GLuint)length };
+	fwrite(CACHE_MAGIC, 1, 4, file);
+	fwrite(header, sizeof(GLuint), 2, file);
+	fwrite(binary.data(), 1, binary.size(), file);
+	fclose(file);
+}
+
+/* Compile and link without reading any status, so nothing waits */
+void ProgramBuilder::submit(Program &program)
+{
+	program.id = glCreateProgram();
+	for (GLuint stage = 0; stage < 3; stage++)
+	{
+		if (program.paths[stage].empty()) continue;
+		GLuint shader = glCreateShader(STAGES[stage]);
+		const char *source = program.sources[stage].c_str();
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		glAttachShader(program.id, shader);
+		program.shaders[stage] = shader;
+	}
+	glProgramParameteri(program.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program.id);
+}
+
+/* Wait for a submitted program and report the first error it has */
+void ProgramBuilder::check(Program &program)
+{
+	GLint status = GL_FALSE;
+	glGetProgramiv(program.id, GL_LINK_STATUS, &status);
+
+	string error;
+	if (status == GL_FALSE)
+	{
+		for (GLuint stage = 0; stage < 3 && error.empty(); stage++)
+		{
+			if (!program.shaders[stage]) continue;
+			GLint compiledOk = GL_FALSE, length = 0;
+			glGetShaderiv(program.shaders[stage], GL_COMPILE_STATUS, &compiledOk);
+			if (compiledOk) continue;
+			glGetShaderiv(program.shaders[stage], GL_INFO_LOG_LENGTH, &length);
+			vector<char> log(length > 1 ? length : 1);
+			glGetShaderInfoLog(program.shaders[stage], (GLsizei)log.size(), NULL, log.data());
+			error = "Compile error in " + string(STAGE_NAMES[stage]) + " shader " + program.paths[stage] + "\n\t" + log.data();
+		}
+		if (error.empty())
+		{
+			GLint length = 0;
+			glGetProgramiv(program.id, GL_INFO_LOG_LENGTH, &length);
+			vector<char> log(length > 1 ? length : 1);
+			glGetProgramInfoLog(program.id, (GLsizei)log.size(), NULL, log.data());
+			error = "Link error in " + program.paths[0] + " + " + program.paths[2] + "\n\t" + log.data();
+		}
+
+		// Logs number the files as the #line directives did
+		error += "\tFiles:";
+		for (GLuint i = 0; i < program.files.size(); i++) error += " " + to_string(i) + " " + program.files[i];
+	}
+
+	for (GLuint stage = 0; stage < 3; stage++)
+	{
+		if (!program.shaders[stage]) continue;
+		glDetachShader(program.id, program.shaders[stage]);
+		glDeleteShader(program.shaders[stage]);
+		program.shaders[stage] = 0;
+	}
+	if (!error.empty()) throw runtime_error(error);
+}
+
+GLuint ProgramBuilder::compile(GLuint index, vector<string> &files, string &error) const
+{
+	// Only the paths and defines, which replace() leaves alone
+	Program program;
+	for (GLuint stage = 0; stage < 3; stage++)
+	{
+		program.paths[stage] = programs[index].paths[stage];
+		program.shaders[stage] = 0;
+	}
+	program.defines = programs[index].defines;
+	if (!preprocess(program, error)) return 0;
+	files = program.files;
+
+	submit(program);
+	try
+	{
+		check(program);
+	}
+	catch (runtime_error &e)
+	{
+		glDeleteProgram(program.id);
+		error = e.what();
+		return 0;
+	}
+	return program.id;
+}
+
+vector<GLuint> ProgramBuilder::programsUsing(const string &path) const
+{
+	vector<GLuint> result;
+	for (GLuint i = 0; i < programs.size(); i++)
+		if (find(programs[i].files.begin(), programs[i].files.end(), path) != programs[i].files.end()) result.push_back(i);
+	return result;
+}
+
+void ProgramBuilder::replace(GLuint index, GLuint id, const vector<string> &files)
+{
+	programs[index].id = id;
+	programs[index].files = files;
+}
+
+void ProgramBuilder::build()
+{
+	auto start = chrono::steady_clock::now();
+	cacheHits = compiled = 0;
+
+	GLint binaryFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+	bool useCache = cacheEnabled && binaryFormats > 0;
+	if (useCache) makeDirectory(cacheDir.c_str());
+
+	// The same source can compile differently on another driver
+	string driver = string((const char *)glGetString(GL_VENDOR)) + "|" + (const char *)glGetString(GL_RENDERER) + "|" +
+		(const char *)glGetString(GL_VERSION);
+	unsigned long long driverHash = fnv1a(driver.data(), driver.size());
+
+	for (Program &program : programs)
+	{
+		string error;
+		if (!preprocess(program, error)) throw runtime_error(error);
+
+		program.hash = driverHash;
+		for (GLuint stage = 0; stage < 3; stage++)
+		{
+			program.hash = fnv1a(STAGE_NAMES[stage], strlen(STAGE_NAMES[stage]) + 1, program.hash);
+			program.hash = fnv1a(program.sources[stage].data(), program.sources[stage].size(), program.hash);
+		}
+		program.fromCache = useCache && loadBinary(program);
+		if (program.fromCache) cacheHits++;
+	}
+
+	// Let the driver use as many compiler threads as it likes
+	typedef void (APIENTRY *MaxCompilerThreadsProc)(GLuint count);
+	MaxCompilerThreadsProc maxCompilerThreads = NULL;
+	if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+		maxCompilerThreads = (MaxCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+	else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+		maxCompilerThreads = (MaxCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+	if (maxCompilerThreads) maxCompilerThreads(0xFFFFFFFF);
+
+	for (Program &program : programs)
+		if (!program.fromCache) submit(program);
+
+	for (Program &program : programs)
+	{
+		if (program.fromCache) continue;
+		check(program);
+		compiled++;
+		if (useCache) saveBinary(program);
+	}
+
+	buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void ProgramBuilder::report() const
+{
+	printf("Shaders: %u programs, %u from the binary cache, %u compiled, %.1f ms\n", size(), cacheHits, compiled, buildMs);
+}
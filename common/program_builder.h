@@ -0,0 +1,100 @@
+/* program_builder.h
+ Builds a set of shader programs together, with a cache of linked program
+ binaries on disk.
+
+ Each program is keyed by a 64 bit FNV-1a hash of its stage sources and of
+ the GL vendor, renderer and version strings, so editing a shader or
+ updating the driver misses the cache instead of loading a stale binary.
+ A binary the driver rejects is compiled from source again.
+
+ Programs not in the cache are compiled without waiting: every compile and
+ link is submitted first and only then are their statuses read, so a
+ driver with GL_KHR_parallel_shader_compile (or the ARB version) or its own
+ background compiler works on all of them at once. Successful links are
+ written back to the cache.
+
+ Sources are preprocessed before compiling: a line #include "file" is
+ replaced by that file, found relative to the including one and included
+ once per stage, and the program's defines follow the #version line. A
+ #line directive numbers each file by its position in files(), so compile
+ errors name the file and line they are on. Adding the same files with the
+ same defines again returns the existing program, so each variant is built
+ (and cached on disk) once.
+
+ For hot reloading, compile() builds one program on whichever context is
+ current, and programsUsing() finds the programs a changed file is part of.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <string>
+#include <vector>
+
+class ProgramBuilder
+{
+public:
+	/* Binaries are kept in cacheDir, an empty string disables the cache */
+	ProgramBuilder(GLWrapper *glw, const std::string &cacheDir = "shader_cache");
+
+	/* Queue a program, geometry may be NULL. defines is a space separated
+	   list of NAME or NAME=VALUE, each defined for every stage. Returns its
+	   index, which is shared with an identical variant added earlier */
+	GLuint add(const char *vertex, const char *geometry, const char *fragment, const char *defines = NULL);
+
+	/* Load or compile every queued program. Throws std::runtime_error with
+	   the compile or link log of the first program that fails */
+	void build();
+
+	GLuint program(GLuint index) const { return programs[index].id; }
+	GLuint size() const { return (GLuint)programs.size(); }
+
+	/* Every file read for a program by the last build, includes too */
+	const std::vector<std::string> &files(GLuint index) const { return programs[index].files; }
+
+	/* Indices of the programs that read path */
+	std::vector<GLuint> programsUsing(const std::string &path) const;
+
+	/* Record a rebuilt program, and the files it read, in place of the one at index */
+	void replace(GLuint index, GLuint id, const std::vector<std::string> &files);
+
+	/* Read, preprocess, compile and link one program again, waiting for the
+	   result. Returns 0 and sets error to the log if it fails. Only reads
+	   the paths and defines, so another thread with its own context may
+	   call it while replace() is used */
+	GLuint compile(GLuint index, std::vector<std::string> &files, std::string &error) const;
+
+	void report() const;
+
+	// Results of the last build()
+	GLuint cacheHits;
+	GLuint compiled;
+	double buildMs;
+
+private:
+	struct Program
+	{
+		std::string paths[3];		// Vertex, geometry, fragment; empty if unused
+		std::string defines;
+		std::string sources[3];		// After preprocessing
+		std::vector<std::string> files;
+		unsigned long long hash;
+		GLuint id;
+		GLuint shaders[3];
+		bool fromCache;
+	};
+
+	GLWrapper *glw;
+	std::string cacheDir;
+	bool cacheEnabled;
+	std::vector<Program> programs;
+
+	std::string cachePath(const Program &program) const;
+	bool preprocess(Program &program, std::string &error) const;
+	bool expand(const std::string &path, std::string &out, std::vector<std::string> &files,
+		std::vector<std::string> &included, std::string &error) const;
+	bool loadBinary(Program &program);
+	void saveBinary(const Program &program);
+	static void submit(Program &program);
+	static void check(Program &program);
+};
@@ -0,0 +1,481 @@
+/* render_queue.cpp
+ Sorted draw submission with redundant state elimination
+*/
+
+#include "render_queue.h"
+#include "gl_counters.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+using namespace glm;
+
+/* Key layout, most significant first:
+   opaque:      pass (2) | program (8) | texture (16) | depth (24) | sequence (14)
+   transparent: pass (2) | far to near depth (24) | unused (24) | sequence (14)
+   The pass is 0 for opaque packets, 1 for opaque packets drawn under an
+   occlusion query and 2 for transparent packets. Transparent packets at
+   the same depth keep their submission order */
+static const GLuint SEQUENCE_BITS = 14;
+static const GLuint DEPTH_BITS = 24;
+
+DrawPacket::DrawPacket() : pipeline(NULL), textureTarget(0), texture(0), transparent(false), castsShadow(false),
+	receivesShadow(false), shadowPipeline(NULL), shadowRevision(0), model(1.f), centre(0.f), radius(0.f),
+	occlusionTest(false), material(0), alpha(1.f), pointSize(1.f), visible(true), profileZone(NO_PROFILE_ZONE),
+	shadowProfileZone(NO_PROFILE_ZONE), key(0)
+{
+}
+
+void RenderQueueStats::reset()
+{
+	*this = RenderQueueStats();
+}
+
+void RenderQueueStats::print(const char *label) const
+{
+	printf("%s: %u program changes, %u texture changes, %u blend changes, %u uniform blocks, %u uniform range binds, %u draws, %u shadow draws in %u shadow passes, %u culled, %u occlusion queries\n",
+		label, programChanges, textureChanges, blendChanges, uniformBlocks, uniformRangeBinds, draws, shadowDraws, shadowPasses,
+		culled, occlusionQueries);
+}
+
+RenderQueue::RenderQueue() : proxyPipeline(NULL), proxyVAO(0), frameUniforms(), farPlane(100.f), shadowMap(NULL),
+	lightClusters(NULL), profiler(NULL), shadowPassZone(NO_PROFILE_ZONE), materialBuffer(0), materialStride(0),
+	materialsChanged(false)
+{
+	stats.reset();
+	proxyBuffers[0] = proxyBuffers[1] = 0;
+}
+
+RenderQueue::~RenderQueue()
+{
+	if (!glfwGetCurrentContext()) return;
+	if (!queries.empty()) glDeleteQueries((GLsizei)queries.size(), queries.data());
+	if (materialBuffer) glDeleteBuffers(1, &materialBuffer);
+	if (proxyVAO)
+	{
+		glDeleteBuffers(2, proxyBuffers);
+		glDeleteVertexArrays(1, &proxyVAO);
+	}
+}
+
+void RenderQueue::enableOcclusionQueries(Shader *proxyPipeline)
+{
+	this->proxyPipeline = proxyPipeline;
+	if (proxyVAO) return;
+
+	// Cube from -1 to 1, scaled to the bounding sphere of each packet
+	static const GLfloat corners[] = { -1, -1, -1,  1, -1, -1,  1, 1, -1,  -1, 1, -1,
+		-1, -1, 1,  1, -1, 1,  1, 1, 1,  -1, 1, 1 };
+	static const GLuint indices[] = { 0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+		3, 6, 2, 3, 7, 6,  0, 4, 7, 0, 7, 3,  1, 2, 6, 1, 6, 5 };
+
+	GLint previousVAO;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+
+	glGenVertexArrays(1, &proxyVAO);
+	glBindVertexArray(proxyVAO);
+	glGenBuffers(2, proxyBuffers);
+	glBindBuffer(GL_ARRAY_BUFFER, proxyBuffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, proxyBuffers[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(previousVAO);
+}
+
+GLuint RenderQueue::add(const DrawPacket &packet)
+{
+	packets.push_back(packet);
+	return (GLuint)packets.size() - 1;
+}
+
+GLuint RenderQueue::addMaterial(const MaterialUniforms &material)
+{
+	materials.push_back(material);
+	materialsChanged = true;
+	return (GLuint)materials.size() - 1;
+}
+
+void RenderQueue::uploadMaterials()
+{
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	materialStride = ((GLuint)sizeof(MaterialUniforms) + alignment - 1) / alignment * alignment;
+
+	vector<unsigned char> data(materialStride * materials.size());
+	for (GLuint i = 0; i < materials.size(); i++)
+		memcpy(&data[i * materialStride], &materials[i], sizeof(MaterialUniforms));
+
+	if (!materialBuffer) glGenBuffers(1, &materialBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, materialBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	materialsChanged = false;
+}
+
+void RenderQueue::setFrame(const mat4 &view, const mat4 &projection, const vec4 &lightpos, GLuint colourmode, GLfloat farPlane)
+{
+	frameUniforms.view = view;
+	frameUniforms.projection = projection;
+	frameUniforms.lightpos = lightpos;
+	frameUniforms.colourmode = colourmode;
+	this->farPlane = farPlane;
+}
+
+/* The shadow pass has no blending or textures, so every caster is sorted
+   as opaque by its depth-only program */
+GLuint RenderQueue::pipelineIndex(const Shader *pipeline)
+{
+	for (GLuint i = 0; i < pipelines.size(); i++)
+		if (pipelines[i] == pipeline) return i;
+	pipelines.push_back(pipeline);
+	return (GLuint)pipelines.size() - 1;
+}
+
+uint64_t RenderQueue::makeKey(const DrawPacket &packet, GLuint sequence, const mat4 &view, bool shadowPass)
+{
+	// Distance along the view direction, quantised over the depth range
+	vec4 p = view * packet.model * vec4(packet.centre, 1.f);
+	GLfloat d = clamp(-p.z / farPlane, 0.f, 1.f);
+	uint64_t depth = (uint64_t)(d * ((1 << DEPTH_BITS) - 1));
+	uint64_t seq = sequence & ((1 << SEQUENCE_BITS) - 1);
+
+	if (packet.transparent && !shadowPass)
+	{
+		uint64_t farToNear = ((1 << DEPTH_BITS) - 1) - depth;
+		return (2ull << 62) | (farToNear << 38) | seq;
+	}
+
+	const Shader *pipeline = shadowPass ? packet.shadowPipeline : packet.pipeline;
+	uint64_t pass = (!shadowPass && proxyPipeline && packet.occlusionTest) ? 1 : 0;
+	// Past 256 pipelines the numbers share slots, which only loosens the grouping
+	uint64_t program = pipelineIndex(pipeline) & 0xFF;
+	uint64_t texture = shadowPass ? 0 : packet.texture & 0xFFFF;
+	return (pass << 62) | (program << 54) | (texture << 38) | (depth << SEQUENCE_BITS) | seq;
+}
+
+void RenderQueue::execute()
+{
+	stats.reset();
+	cull();
+
+	// Culled packets may still cast a shadow into view
+	order.clear();
+	shadowOrder.clear();
+	for (GLuint i = 0; i < packets.size(); i++)
+	{
+		DrawPacket &packet = packets[i];
+		if (!packet.visible) continue;
+		if (shadowMap && packet.castsShadow && packet.shadowPipeline) shadowOrder.push_back(i);
+		if (!inFrustum[i]) continue;
+		packet.key = makeKey(packet, i, frameUniforms.view, false);
+		order.push_back(i);
+	}
+	sort(order.begin(), order.end(), [this](GLuint a, GLuint b) { return packets[a].key < packets[b].key; });
+
+	// Bounding boxes the camera is inside would be clipped by the near
+	// plane, so those packets are drawn without a query
+	proxyOrder.clear();
+	queried.assign(packets.size(), 0);
+	if (proxyPipeline)
+	{
+		if (queries.size() < packets.size())
+		{
+			GLuint first = (GLuint)queries.size();
+			queries.resize(packets.size());
+			glGenQueries((GLsizei)(packets.size() - first), &queries[first]);
+		}
+
+		vec3 camera = vec3(inverse(frameUniforms.view)[3]);
+		for (GLuint i : order)
+		{
+			const DrawPacket &packet = packets[i];
+			if (!packet.occlusionTest || packet.radius <= 0.f) continue;
+			if (length(camera - bounds[i].centre) < bounds[i].radius * 1.8f) continue;
+			proxyOrder.push_back(i);
+			queried[i] = 1;
+		}
+	}
+
+	// Reuse the shadow map if nothing it shows has changed
+	bool drawShadows = shadowMap && (castersChanged() || !shadowMap->isValid());
+	if (!drawShadows) shadowOrder.clear();
+
+	// Casters are sorted by their keys from the light's point of view
+	shadowKeys.resize(packets.size());
+	for (GLuint i : shadowOrder)
+		shadowKeys[i] = makeKey(packets[i], i, shadowMap->view, true);
+	sort(shadowOrder.begin(), shadowOrder.end(), [this](GLuint a, GLuint b) { return shadowKeys[a] < shadowKeys[b]; });
+
+	// Write this frame's uniform blocks in one pass before any draw: the
+	// main and shadow FrameData blocks and an ObjectData block per draw
+	if (objectRing.capacity() < packets.size() * 3)
+	{
+		frameRing.create(sizeof(FrameUniforms), 2);
+		objectRing.create(sizeof(ObjectUniforms), (GLuint)packets.size() * 3 + 64);
+	}
+
+	frameUniforms.shadows = shadowMap ? (shadowMap->type == SHADOW_MAP_CUBE ? 2 : 1) : 0;
+	if (shadowMap)
+	{
+		frameUniforms.pcfRadius = shadowMap->pcfRadius;
+		frameUniforms.shadowBias = shadowMap->bias;
+		frameUniforms.lightspace = shadowMap->textureMatrix();
+		frameUniforms.shadowMapSize = (GLfloat)shadowMap->size;
+		frameUniforms.shadowLight = vec4(shadowMap->lightPosition, shadowMap->farPlane);
+	}
+	frameUniforms.clusterDims[3] = 0;
+	if (lightClusters)
+	{
+		frameUniforms.clusterScale = lightClusters->scale;
+		for (GLuint i = 0; i < 4; i++) frameUniforms.clusterDims[i] = lightClusters->dims[i];
+	}
+
+	frameRing.map();
+	GLuint frameOffset = frameRing.push(&frameUniforms);
+	stats.uniformBlocks++;
+	GLuint shadowFrameOffset = 0;
+	if (drawShadows)
+	{
+		FrameUniforms shadowFrame = frameUniforms;
+		shadowFrame.view = shadowMap->view;
+		shadowFrame.projection = shadowMap->projection;
+		shadowFrameOffset = frameRing.push(&shadowFrame);
+		stats.uniformBlocks++;
+	}
+	frameRing.unmap();
+	if (materialsChanged) uploadMaterials();
+
+	// The matrices are multiplied here once per draw instead of for every
+	// vertex. The normal matrix keeps normals perpendicular under scaling
+	objectRing.map();
+	objectOffsets.resize(order.size());
+	shadowOffsets.resize(shadowOrder.size());
+	for (GLuint pass = 0; pass < 2; pass++)
+	{
+		const vector<GLuint> &passOrder = pass ? shadowOrder : order;
+		vector<GLuint> &offsets = pass ? shadowOffsets : objectOffsets;
+		const mat4 &view = (pass && shadowMap) ? shadowMap->view : frameUniforms.view;
+		const mat4 &projection = (pass && shadowMap) ? shadowMap->projection : frameUniforms.projection;
+		for (GLuint i = 0; i < passOrder.size(); i++)
+		{
+			const DrawPacket &packet = packets[passOrder[i]];
+			ObjectUniforms object = {};
+			object.model = packet.model;
+			object.alphaValue = packet.alpha;
+			object.size = packet.pointSize;
+			object.receiveShadow = packet.receivesShadow ? 1 : 0;
+			object.modelView = view * packet.model;
+			object.mvp = projection * object.modelView;
+			mat3 normalMatrix = transpose(inverse(mat3(object.modelView)));
+			for (GLuint c = 0; c < 3; c++) object.normalMatrix[c] = vec4(normalMatrix[c], 0.f);
+			offsets[i] = objectRing.push(&object);
+			stats.uniformBlocks++;
+		}
+	}
+
+	// The proxy cube spans -1 to 1, so it is scaled by the world radius
+	proxyOffsets.resize(proxyOrder.size());
+	for (GLuint i = 0; i < proxyOrder.size(); i++)
+	{
+		const BoundingSphere &sphere = bounds[proxyOrder[i]];
+		ObjectUniforms object = {};
+		object.model = scale(translate(mat4(1.f), sphere.centre), vec3(sphere.radius));
+		object.alphaValue = 1.f;
+		object.size = 1.f;
+		object.modelView = frameUniforms.view * object.model;
+		object.mvp = frameUniforms.projection * object.modelView;
+		proxyOffsets[i] = objectRing.push(&object);
+		stats.uniformBlocks++;
+	}
+	objectRing.unmap();
+
+	if (drawShadows)
+	{
+		frameRing.bind(FRAME_BLOCK_BINDING, shadowFrameOffset);
+		stats.uniformRangeBinds++;
+		ProfileScope scope(profiler, shadowPassZone);
+		shadowMap->begin();
+		submit(shadowOrder, shadowOffsets, true);
+		shadowMap->end();
+		stats.shadowPasses++;
+	}
+
+	frameRing.bind(FRAME_BLOCK_BINDING, frameOffset);
+	stats.uniformRangeBinds++;
+	if (shadowMap)
+	{
+		shadowMap->bindTexture();
+		stats.textureChanges++;
+	}
+	if (lightClusters)
+	{
+		lightClusters->bindTextures();
+		stats.textureChanges += 3;
+	}
+	submit(order, objectOffsets, false);
+
+	frameRing.fence();
+	objectRing.fence();
+}
+
+void RenderQueue::cull()
+{
+	frustum.set(frameUniforms.projection * frameUniforms.view);
+
+	bounds.resize(packets.size());
+	inFrustum.assign(packets.size(), 1);
+	for (GLuint i = 0; i < packets.size(); i++)
+		bounds[i] = transformSphere(packets[i].model, packets[i].centre, packets[i].radius);
+
+	// Unbounded packets are tested too, then forced back in, so that the
+	// spheres stay in one contiguous array
+	frustum.testSpheres(bounds.data(), (GLuint)bounds.size(), inFrustum.data());
+	for (GLuint i = 0; i < packets.size(); i++)
+	{
+		if (packets[i].radius <= 0.f) inFrustum[i] = 1;
+		else if (!inFrustum[i] && packets[i].visible) stats.culled++;
+	}
+}
+
+void RenderQueue::drawProxies()
+{
+	GLint previousVAO;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+
+	// Depth is tested but nothing is written
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glUseProgram(proxyPipeline->shaderID);
+	stats.programChanges++;
+	glBindVertexArray(proxyVAO);
+
+	for (GLuint i = 0; i < proxyOrder.size(); i++)
+	{
+		objectRing.bind(OBJECT_BLOCK_BINDING, proxyOffsets[i]);
+		stats.uniformRangeBinds++;
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[proxyOrder[i]]);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+		stats.occlusionQueries++;
+	}
+
+	glBindVertexArray(previousVAO);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+bool RenderQueue::castersChanged()
+{
+	casterState.clear();
+	for (GLuint i : shadowOrder)
+	{
+		const DrawPacket &packet = packets[i];
+		casterState.push_back((GLfloat)i);
+		casterState.push_back((GLfloat)packet.shadowRevision);
+		const GLfloat *m = &packet.model[0][0];
+		casterState.insert(casterState.end(), m, m + 16);
+	}
+
+	if (casterState == lastCasterState) return false;
+	lastCasterState.swap(casterState);
+	return true;
+}
+
+void RenderQueue::submit(const vector<GLuint> &order, const vector<GLuint> &offsets, bool shadowPass)
+{
+	// Other code may have changed bindings since the last frame, so the
+	// first packet sets everything
+	GLuint currentProgram = 0;
+	GLenum currentTarget = 0;
+	GLuint currentTexture = 0;
+	GLuint currentMaterial = 0;
+	bool textureKnown = false;
+	bool materialKnown = false;
+	bool blend = false;
+	bool proxiesDrawn = shadowPass || proxyOrder.empty();
+	glDisable(GL_BLEND);
+
+	for (GLuint i = 0; i < order.size(); i++)
+	{
+		const DrawPacket &packet = packets[order[i]];
+
+		// Once the plain opaque packets are in the depth buffer, test the rest
+		if (!proxiesDrawn && (packet.key >> 62) != 0)
+		{
+			drawProxies();
+			currentProgram = 0;
+			proxiesDrawn = true;
+		}
+
+		const Shader &shader = shadowPass ? *packet.shadowPipeline : *packet.pipeline;
+
+		if (shader.shaderID != currentProgram)
+		{
+			glUseProgram(shader.shaderID);
+			currentProgram = shader.shaderID;
+			stats.programChanges++;
+		}
+
+		if (!shadowPass && packet.textureTarget && (!textureKnown || packet.textureTarget != currentTarget || packet.texture != currentTexture))
+		{
+			glBindTexture(packet.textureTarget, packet.texture);
+			currentTarget = packet.textureTarget;
+			currentTexture = packet.texture;
+			textureKnown = true;
+			stats.textureChanges++;
+		}
+
+		// Depth-only programs have no material
+		if (!shadowPass && !materials.empty() && (!materialKnown || packet.material != currentMaterial))
+		{
+			glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, materialBuffer,
+				packet.material * materialStride, sizeof(MaterialUniforms));
+			currentMaterial = packet.material;
+			materialKnown = true;
+			stats.uniformRangeBinds++;
+		}
+
+		bool transparent = packet.transparent && !shadowPass;
+		if (transparent != blend)
+		{
+			if (transparent) glEnable(GL_BLEND);
+			else glDisable(GL_BLEND);
+			blend = transparent;
+			stats.blendChanges++;
+		}
+
+		objectRing.bind(OBJECT_BLOCK_BINDING, offsets[i]);
+		stats.uniformRangeBinds++;
+
+		if (shadowPass)
+		{
+			ProfileScope scope(profiler, packet.shadowProfileZone);
+			if (packet.drawShadow) packet.drawShadow();
+			else packet.draw();
+			stats.shadowDraws++;
+		}
+		else if (queried[order[i]])
+		{
+			// Skipped by the GPU if no sample of the bounding box passed
+			ProfileScope scope(profiler, packet.profileZone);
+			glBeginConditionalRender(queries[order[i]], GL_QUERY_NO_WAIT);
+			packet.draw();
+			glEndConditionalRender();
+			stats.draws++;
+		}
+		else
+		{
+			ProfileScope scope(profiler, packet.profileZone);
+			packet.draw();
+			stats.draws++;
+		}
+	}
+
+	if (blend) glDisable(GL_BLEND);
+}
@@ -0,0 +1,195 @@
+/* render_queue.h
+ Retained render queue. Each object adds a draw packet once (pipeline,
+ texture, blending and a callback that issues the mesh draw) and updates
+ the packet's per-draw data every frame. execute() sorts the packets by a
+ 64-bit key, opaque front-to-back grouped by shader and texture and
+ transparent back-to-front, and skips any state that is already set.
+ Shaders are numbered for the key in the order the queue first meets them,
+ so a hot reloaded program, which has a new name, keeps its place.
+ Frame constants go into one FrameData block per frame and every packet's
+ per-draw values into an ObjectData block of a uniform ring buffer, so the
+ uniform traffic does not depend on how many programs are used. The
+ materials added to the queue are uploaded once into a MaterialData buffer
+ and the main pass selects each packet's block when it changes.
+ With a shadow map set, the packets flagged as casters are drawn into it
+ with their depth-only pipeline, and receivers sample it in the main pass.
+ The shadow pass is skipped while the map is valid and no caster's model
+ matrix or shadowRevision has changed since it was drawn. With light
+ clusters set, their buffers are bound for the main pass as well.
+ Packets with a bounding radius are culled against the view frustum, all
+ in one batch. With occlusion queries enabled, packets flagged for
+ occlusion testing are sorted after the other opaque packets. When the
+ queue reaches them, their bounding boxes are drawn invisibly inside
+ queries, and each packet is then drawn under conditional rendering, so
+ the GPU skips it when the opaque scene (the walls, the table) hides it.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "shader.h"
+#include "uniform_blocks.h"
+#include "shadow_map.h"
+#include "light_clusters.h"
+#include "frustum.h"
+#include "frame_profiler.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct DrawPacket
+{
+	DrawPacket();
+
+	Shader *pipeline;
+	GLenum textureTarget;		// 0 when the draw samples no texture
+	GLuint texture;
+	bool transparent;			// Blended and drawn back-to-front after the opaque packets
+	std::function<void()> draw;	// Binds the mesh and issues the draw call
+
+	// Shadows. Casters are drawn into the shadow map with shadowPipeline and
+	// drawShadow, or draw if it is empty
+	bool castsShadow;
+	bool receivesShadow;
+	Shader *shadowPipeline;
+	std::function<void()> drawShadow;
+	GLuint shadowRevision;		// Changed by the owner when the caster's shape changes
+
+	// Per-draw data, updated by the owner every frame
+	glm::mat4 model;
+	glm::vec3 centre;			// Object space point used for depth sorting and culling
+	GLfloat radius;				// Object space bounding sphere radius, 0 is never culled
+	bool occlusionTest;
+	GLuint material;			// Index returned by RenderQueue::addMaterial()
+	GLfloat alpha;
+	GLfloat pointSize;
+	bool visible;
+
+	// Profiler zones timing draw and drawShadow, NO_PROFILE_ZONE for none
+	GLuint profileZone;
+	GLuint shadowProfileZone;
+
+	uint64_t key;
+};
+
+/* State changes and uniform uploads issued by the last execute() */
+struct RenderQueueStats
+{
+	GLuint programChanges;
+	GLuint textureChanges;
+	GLuint blendChanges;
+	GLuint uniformBlocks;			// Blocks written to the uniform rings
+	GLuint uniformRangeBinds;		// glBindBufferRange calls selecting a block
+	GLuint draws;
+	GLuint shadowDraws;
+	GLuint shadowPasses;			// 0 when the cached shadow map was reused
+	GLuint culled;					// Packets outside the view frustum
+	GLuint occlusionQueries;
+
+	void reset();
+	void print(const char *label) const;
+};
+
+class RenderQueue
+{
+public:
+	RenderQueue();
+	~RenderQueue();
+
+	/* Returns a handle used to update the packet later */
+	GLuint add(const DrawPacket &packet);
+	DrawPacket &packet(GLuint handle) { return packets[handle]; }
+
+	/* Returns the index of the material for DrawPacket::material */
+	GLuint addMaterial(const MaterialUniforms &material);
+
+	/* Values shared by every draw this frame, written once into the FrameData block */
+	void setFrame(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec4 &lightpos,
+		GLuint colourmode, GLfloat farPlane);
+
+	/* Render casters into shadowMap before each frame, or no shadows if NULL */
+	void setShadowMap(ShadowMap *shadowMap) { this->shadowMap = shadowMap; }
+
+	/* Light the main pass with the point lights binned in clusters as well,
+	   or only the one light if NULL */
+	void setLightClusters(LightClusters *lightClusters) { this->lightClusters = lightClusters; }
+
+	/* Time the packets' zones, and the whole shadow pass as shadowPassZone */
+	void setProfiler(FrameProfiler *profiler, GLuint shadowPassZone = NO_PROFILE_ZONE)
+	{
+		this->profiler = profiler;
+		this->shadowPassZone = shadowPassZone;
+	}
+
+	/* Test packets flagged with occlusionTest against the opaque scene by
+	   drawing their bounding boxes with proxyPipeline */
+	void enableOcclusionQueries(Shader *proxyPipeline);
+
+	/* Sort the visible packets and draw them */
+	void execute();
+
+	RenderQueueStats stats;
+
+private:
+	std::vector<DrawPacket> packets;
+	std::vector<GLuint> order;
+	std::vector<GLuint> shadowOrder;
+	std::vector<uint64_t> shadowKeys;		// Indexed by packet
+	std::vector<GLfloat> casterState;		// What the shadow map was drawn from
+	std::vector<GLfloat> lastCasterState;
+
+	// Culling, indexed by packet
+	Frustum frustum;
+	std::vector<BoundingSphere> bounds;
+	std::vector<unsigned char> inFrustum;
+
+	// Occlusion queries, indexed by packet except the proxy lists
+	Shader *proxyPipeline;
+	GLuint proxyVAO;
+	GLuint proxyBuffers[2];
+	std::vector<GLuint> queries;
+	std::vector<unsigned char> queried;		// The packet is drawn under its query this frame
+	std::vector<GLuint> proxyOrder;
+	std::vector<GLuint> proxyOffsets;
+
+	FrameUniforms frameUniforms;
+	GLfloat farPlane;
+	ShadowMap *shadowMap;
+	LightClusters *lightClusters;
+	FrameProfiler *profiler;
+	GLuint shadowPassZone;
+
+	UniformRing frameRing;
+	UniformRing objectRing;
+	std::vector<GLuint> objectOffsets;
+	std::vector<GLuint> shadowOffsets;
+
+	// Every pipeline met so far, in the order of their numbers in the keys
+	std::vector<const Shader *> pipelines;
+
+	std::vector<MaterialUniforms> materials;
+	GLuint materialBuffer;
+	GLuint materialStride;		// Padded to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	bool materialsChanged;
+
+	uint64_t makeKey(const DrawPacket &packet, GLuint sequence, const glm::mat4 &view, bool shadowPass);
+
+	/* The number of pipeline in the keys, adding it if it is new */
+	GLuint pipelineIndex(const Shader *pipeline);
+
+	/* Copy the materials into materialBuffer */
+	void uploadMaterials();
+
+	/* Draw packets in order, each with the object block at the same index of offsets */
+	void submit(const std::vector<GLuint> &order, const std::vector<GLuint> &offsets, bool shadowPass);
+
+	/* True if the casters differ from the ones the shadow map holds */
+	bool castersChanged();
+
+	/* Frustum test of every bounded visible packet, fills inFrustum */
+	void cull();
+
+	/* Draw the bounding boxes of proxyOrder, each inside its packet's query */
+	void drawProxies();
+};
@@ -0,0 +1,148 @@
+/* render_target.cpp
+ Offscreen framebuffers for headless rendering
+*/
+
+#include "render_target.h"
+#include "gl_counters.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+RenderTarget::RenderTarget() : width(0), height(0), samples(0), fbo(0), colour(0), depth(0), resolveFbo(0), resolveColour(0)
+{
+}
+
+RenderTarget::~RenderTarget()
+{
+	if (glfwGetCurrentContext()) release();
+}
+
+void RenderTarget::release()
+{
+	if (resolveFbo)
+	{
+		glDeleteFramebuffers(1, &resolveFbo);
+		glDeleteRenderbuffers(1, &resolveColour);
+	}
+	if (fbo)
+	{
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteRenderbuffers(1, &colour);
+		glDeleteRenderbuffers(1, &depth);
+	}
+	fbo = colour = depth = resolveFbo = resolveColour = 0;
+}
+
+static GLuint createRenderbuffer(GLenum format, GLuint width, GLuint height, GLuint samples)
+{
+	GLuint renderbuffer;
+	glGenRenderbuffers(1, &renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+	if (samples) glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, format, width, height);
+	else glRenderbufferStorage(GL_RENDERBUFFER, format, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	return renderbuffer;
+}
+
+bool RenderTarget::create(GLuint width, GLuint height, GLuint samples)
+{
+	release();
+
+	// Software renderers such as llvmpipe support fewer samples than hardware
+	GLint maxSamples = 0;
+	glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+	this->width = width;
+	this->height = height;
+	this->samples = min(samples, (GLuint)max(maxSamples, 0));
+	if (this->samples == 1) this->samples = 0;
+
+	GLint previous;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+
+	colour = createRenderbuffer(GL_RGBA8, width, height, this->samples);
+	depth = createRenderbuffer(GL_DEPTH24_STENCIL8, width, height, this->samples);
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colour);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+	if (complete && this->samples)
+	{
+		resolveColour = createRenderbuffer(GL_RGBA8, width, height, 0);
+		glGenFramebuffers(1, &resolveFbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, resolveFbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolveColour);
+		complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+	if (!complete) printf("RenderTarget: %ux%u framebuffer with %u samples is incomplete\n", width, height, this->samples);
+	return complete;
+}
+
+void RenderTarget::bind() const
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, width, height);
+}
+
+void RenderTarget::resolve() const
+{
+	if (!resolveFbo) return;
+
+	GLint previous;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFbo);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previous);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous);
+}
+
+void RenderTarget::readPixels(vector<unsigned char> &rgba) const
+{
+	rgba.resize((size_t)width * height * 4);
+
+	GLint previous;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, resolvedFramebuffer());
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previous);
+}
+
+bool RenderTarget::save(const char *filename) const
+{
+	vector<unsigned char> rgba;
+	readPixels(rgba);
+	return writePPM(filename, width, height, rgba.data());
+}
+
+bool writePPM(const char *filename, GLuint width, GLuint height, const unsigned char *rgba)
+{
+	FILE *file = fopen(filename, "wb");
+	if (!file)
+	{
+		printf("Could not write %s\n", filename);
+		return false;
+	}
+
+	fprintf(file, "P6\n%u %u\n255\n", width, height);
+	vector<unsigned char> row(width * 3);
+	for (GLuint y = 0; y < height; y++)
+	{
+		const unsigned char *src = rgba + (size_t)(height - 1 - y) * width * 4;
+		for (GLuint x = 0; x < width; x++)
+		{
+			row[x * 3] = src[x * 4];
+			row[x * 3 + 1] = src[x * 4 + 1];
+			row[x * 3 + 2] = src[x * 4 + 2];
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+	fclose(file);
+	return true;
+}
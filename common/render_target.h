@@ -0,0 +1,53 @@
+/* render_target.h
+ Offscreen framebuffer with colour and depth renderbuffers, used in place
+ of the window's default framebuffer when rendering headless. With
+ samples > 0 the scene is drawn multisampled and resolve() blits it into a
+ single sampled framebuffer, which is where the pixels are read from.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <vector>
+
+class RenderTarget
+{
+public:
+	RenderTarget();
+	~RenderTarget();
+
+	/* Create (or recreate) the framebuffers. samples is clamped to
+	   GL_MAX_SAMPLES. Returns false if the framebuffer is incomplete */
+	bool create(GLuint width, GLuint height, GLuint samples);
+
+	/* Draw into the target and set the viewport to cover it */
+	void bind() const;
+
+	/* Resolve the multisampled image; a no-op without multisampling */
+	void resolve() const;
+
+	/* Framebuffer holding the resolved image, for reading back */
+	GLuint resolvedFramebuffer() const { return resolveFbo ? resolveFbo : fbo; }
+
+	/* Synchronous read of the resolved image, RGBA rows bottom up */
+	void readPixels(std::vector<unsigned char> &rgba) const;
+
+	/* Read the resolved image and write it as a binary PPM, top row first */
+	bool save(const char *filename) const;
+
+	GLuint width;
+	GLuint height;
+	GLuint samples;
+
+private:
+	GLuint fbo;
+	GLuint colour;
+	GLuint depth;
+	GLuint resolveFbo;			// 0 without multisampling
+	GLuint resolveColour;
+
+	void release();
+};
+
+/* Write RGBA rows stored bottom up as a binary PPM */
+bool writePPM(const char *filename, GLuint width, GLuint height, const unsigned char *rgba);
@@ -0,0 +1,53 @@
+/* shader.cpp
+ Connects the uniform blocks of a shader program to their binding points
+*/
+
+#include "shader.h"
+#include "uniform_blocks.h"
+#include "shadow_map.h"
+#include "light_clusters.h"
+
+#include <cstdio>
+
+Shader::Shader() : shaderID(0)
+{
+}
+
+Shader::Shader(GLuint shaderID) {
+	printf("Creating shader object\n");
+	this->shaderID = shaderID;
+
+	// Programs that do not use a block simply do not have it
+	GLuint frameBlock = glGetUniformBlockIndex(shaderID, "FrameData");
+	if (frameBlock != GL_INVALID_INDEX) glUniformBlockBinding(shaderID, frameBlock, FRAME_BLOCK_BINDING);
+
+	GLuint objectBlock = glGetUniformBlockIndex(shaderID, "ObjectData");
+	if (objectBlock != GL_INVALID_INDEX) glUniformBlockBinding(shaderID, objectBlock, OBJECT_BLOCK_BINDING);
+
+	GLuint materialBlock = glGetUniformBlockIndex(shaderID, "MaterialData");
+	if (materialBlock != GL_INVALID_INDEX) glUniformBlockBinding(shaderID, materialBlock, MATERIAL_BLOCK_BINDING);
+
+	GLuint facesBlock = glGetUniformBlockIndex(shaderID, "ShadowFaces");
+	if (facesBlock != GL_INVALID_INDEX) glUniformBlockBinding(shaderID, facesBlock, SHADOW_FACES_BLOCK_BINDING);
+
+	GLint loc = glGetUniformLocation(shaderID, "tex1");
+	if (loc >= 0) glProgramUniform1i(shaderID, loc, 0);
+
+	// Per-draw data of indirect batches is a texture buffer on unit 1
+	loc = glGetUniformLocation(shaderID, "drawdata");
+	if (loc >= 0) glProgramUniform1i(shaderID, loc, 1);
+
+	// Receivers sample a 2D shadow map from unit 2 and a cube shadow map from unit 3
+	loc = glGetUniformLocation(shaderID, "shadowmap");
+	if (loc >= 0) glProgramUniform1i(shaderID, loc, 2);
+	loc = glGetUniformLocation(shaderID, "shadowcube");
+	if (loc >= 0) glProgramUniform1i(shaderID, loc, 3);
+
+	// Clustered point lights
+	loc = glGetUniformLocation(shaderID, "lightdata");
+	if (loc >= 0) glProgramUniform1i(shaderID, loc, LIGHT_DATA_UNIT);
+	loc = glGetUniformLocation(shaderID, "lightgrid");
+	if (loc >= 0) glProgramUniform1i(shaderID, loc, LIGHT_GRID_UNIT);
+	loc = glGetUniformLocation(shaderID, "lightindices");
+	if (loc >= 0) glProgramUniform1i(shaderID, loc, LIGHT_INDEX_UNIT);
+}
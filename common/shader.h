@@ -0,0 +1,18 @@
+/* shader.h
+ Shader program whose uniforms come from the FrameData and ObjectData
+ uniform blocks. The blocks are attached to their binding points once when
+ the program is wrapped, so no uniform locations are looked up by name.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+
+// Custom Shader class that connects the uniform blocks of a program
+class Shader {
+public:
+	GLuint shaderID;
+
+	Shader();
+	Shader(GLuint shaderID);
+};
@@ -0,0 +1,120 @@
+/* shader_reloader.cpp
+ Background shader rebuilds on a shared context
+*/
+
+#include "shader_reloader.h"
+#include "gl_counters.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+ShaderReloader::ShaderReloader(GLWrapper *glw, ProgramBuilder *builder) : reloads(0), failures(0), builder(builder), stopping(false)
+{
+	// Windows can only be created on the main thread
+	context = glw->createSharedContext();
+	if (!context) return;
+
+	for (GLuint i = 0; i < builder->size(); i++)
+		for (const string &file : builder->files(i)) watcher.addFile(file);
+
+	worker = thread(&ShaderReloader::run, this);
+}
+
+ShaderReloader::~ShaderReloader()
+{
+	if (!context) return;
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+	worker.join();
+
+	// Programs that were never handed over
+	if (glfwGetCurrentContext())
+	{
+		for (Result &result : results)
+		{
+			glDeleteSync(result.fence);
+			glDeleteProgram(result.program);
+		}
+		glfwDestroyWindow(context);
+	}
+}
+
+void ShaderReloader::run()
+{
+	glfwMakeContextCurrent(context);
+	for (;;)
+	{
+		GLuint index;
+		{
+			unique_lock<mutex> lock(jobMutex);
+			jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (stopping) break;
+			index = jobs.front();
+			jobs.pop_front();
+		}
+
+		vector<string> files;
+		string error;
+		GLuint program = builder->compile(index, files, error);
+		if (!program)
+		{
+			printf("Shader reload failed, keeping the previous program\n%s\n", error.c_str());
+			lock_guard<mutex> lock(jobMutex);
+			failures++;
+			continue;
+		}
+
+		// The main context may only use the program once this context's
+		// commands have completed
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+
+		lock_guard<mutex> lock(jobMutex);
+		results.push_back({ index, program, fence, files });
+	}
+	glfwMakeContextCurrent(NULL);
+}
+
+vector<ReloadedProgram> ShaderReloader::poll()
+{
+	vector<ReloadedProgram> ready;
+	if (!context) return ready;
+
+	vector<string> changed = watcher.changed();
+	lock_guard<mutex> lock(jobMutex);
+
+	for (const string &path : changed)
+	{
+		for (GLuint index : builder->programsUsing(path))
+		{
+			if (find(jobs.begin(), jobs.end(), index) != jobs.end()) continue;
+			jobs.push_back(index);
+			printf("Reloading shader program %u after %s changed\n", index, path.c_str());
+		}
+	}
+	if (!jobs.empty()) jobReady.notify_one();
+
+	// Hand over in order, so a later rebuild of a program replaces an earlier one
+	size_t done = 0;
+	for (; done < results.size(); done++)
+	{
+		Result &result = results[done];
+		if (glClientWaitSync(result.fence, 0, 0) == GL_TIMEOUT_EXPIRED) break;
+		glDeleteSync(result.fence);
+		ready.push_back({ result.index, result.program });
+		reloads++;
+
+		// An edit may have added an include. Files already watched are left
+		// alone, so a save made during the compile is still reported
+		builder->replace(result.index, result.program, result.files);
+		for (const string &file : result.files)
+			if (!watcher.isWatching(file)) watcher.addFile(file);
+	}
+	results.erase(results.begin(), results.begin() + done);
+	return ready;
+}
@@ -0,0 +1,74 @@
+/* shader_reloader.h
+ Rebuilds shader programs when their source files are saved, without
+ stalling the frames drawn meanwhile.
+
+ A FileWatcher follows every file of the programs in a ProgramBuilder.
+ Changed programs are compiled and linked by a worker thread on a second
+ context that shares objects with the main one, so the driver can take as
+ long as it likes. Each finished program is fenced and flushed, and poll()
+ only hands it over once the fence has signalled: the main thread never
+ waits on a compile, it only tests a fence and reads the watcher's events.
+
+ The caller swaps the new program in at the start of a frame and deletes
+ the old one; the builder already holds the new one by then. A program
+ that fails to compile or link is dropped with its log printed, leaving
+ the running one in use.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "program_builder.h"
+#include "file_watcher.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ReloadedProgram
+{
+	GLuint index;		// Index in the ProgramBuilder
+	GLuint program;
+};
+
+class ShaderReloader
+{
+public:
+	/* Watches the files of every program in builder, which must outlive this */
+	ShaderReloader(GLWrapper *glw, ProgramBuilder *builder);
+	~ShaderReloader();
+
+	/* Queue programs whose files changed and return the ones rebuilt and
+	   ready to draw with. Call at the start of a frame */
+	std::vector<ReloadedProgram> poll();
+
+	bool isRunning() const { return context != NULL; }
+
+	GLuint reloads;
+	GLuint failures;
+
+private:
+	struct Result
+	{
+		GLuint index;
+		GLuint program;
+		GLsync fence;
+		std::vector<std::string> files;
+	};
+
+	ProgramBuilder *builder;
+	FileWatcher watcher;
+	GLFWwindow *context;		// Shared with the main context, current on the worker
+
+	std::thread worker;
+	std::mutex jobMutex;
+	std::condition_variable jobReady;
+	std::deque<GLuint> jobs;	// Program indices, each queued once
+	std::vector<Result> results;
+	bool stopping;
+
+	void run();
+};
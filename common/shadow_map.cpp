@@ -0,0 +1,161 @@
+/* shadow_map.cpp
+ Depth textures and framebuffers for the shadow pass
+*/
+
+#include "shadow_map.h"
+#include "gl_counters.h"
+
+#include <cstdio>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace glm;
+
+ShadowMap::ShadowMap() : type(SHADOW_MAP_2D), size(0), texture(0), view(1.f), projection(1.f), lightPosition(0.f),
+	farPlane(1.f), pcfRadius(1), bias(0.0005f), fbo(0), facesBuffer(0), valid(false), previousFramebuffer(0)
+{
+}
+
+ShadowMap::~ShadowMap()
+{
+	if (glfwGetCurrentContext()) release();
+}
+
+void ShadowMap::release()
+{
+	if (!fbo) return;
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &texture);
+	if (facesBuffer) glDeleteBuffers(1, &facesBuffer);
+	fbo = texture = facesBuffer = 0;
+}
+
+void ShadowMap::create(GLuint size, ShadowMapType type)
+{
+	release();
+	this->size = size;
+	this->type = type;
+	valid = false;
+
+	GLenum target = type == SHADOW_MAP_CUBE ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+	glGenTextures(1, &texture);
+	glBindTexture(target, texture);
+	if (type == SHADOW_MAP_CUBE)
+	{
+		for (GLuint face = 0; face < 6; face++)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+	else
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+
+		// Anything outside the map is lit
+		GLfloat border[] = { 1.f, 1.f, 1.f, 1.f };
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameterfv(target, GL_TEXTURE_BORDER_COLOR, border);
+	}
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(target, 0);
+
+	GLint current;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &current);
+
+	// Attaching the whole cube makes the framebuffer layered, so gl_Layer
+	// written by the geometry shader selects the face
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		printf("ShadowMap: %ux%u depth framebuffer is incomplete\n", size, size);
+	glBindFramebuffer(GL_FRAMEBUFFER, current);
+
+	if (type == SHADOW_MAP_CUBE)
+	{
+		glGenBuffers(1, &facesBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, facesBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, 6 * sizeof(mat4), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+}
+
+/* A new view only invalidates the map if it differs from the one it holds */
+void ShadowMap::setView(const mat4 &view, const mat4 &projection)
+{
+	if (view != this->view || projection != this->projection) valid = false;
+	this->view = view;
+	this->projection = projection;
+}
+
+void ShadowMap::lookFrom(const vec3 &position, const vec3 &direction, GLfloat fov, GLfloat nearPlane, GLfloat farPlane)
+{
+	// Any up vector not parallel to the direction will do
+	vec3 up = abs(direction.y) > 0.99f * length(direction) ? vec3(0, 0, -1) : vec3(0, 1, 0);
+	lightPosition = position;
+	this->farPlane = farPlane;
+	setView(lookAt(position, position + direction, up), perspective(radians(fov), 1.f, nearPlane, farPlane));
+}
+
+void ShadowMap::placeAt(const vec3 &position, GLfloat nearPlane, GLfloat farPlane)
+{
+	lightPosition = position;
+	this->farPlane = farPlane;
+	bool wasValid = valid;
+	setView(translate(mat4(1.f), -position), perspective(radians(90.f), 1.f, nearPlane, farPlane));
+	if (wasValid && valid) return;
+
+	// Face order and up vectors of the GL cube map convention
+	static const vec3 directions[6] = { vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1) };
+	static const vec3 ups[6] = { vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0) };
+	mat4 faces[6];
+	for (GLuint i = 0; i < 6; i++)
+		faces[i] = projection * lookAt(position, position + directions[i], ups[i]);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, facesBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(faces), faces);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ShadowMap::begin()
+{
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	glViewport(0, 0, size, size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	if (facesBuffer) glBindBufferBase(GL_UNIFORM_BUFFER, SHADOW_FACES_BLOCK_BINDING, facesBuffer);
+
+	// Push the casters' depth back a little so lit surfaces do not shadow themselves
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.f, 4.f);
+}
+
+void ShadowMap::end()
+{
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFramebuffer);
+	glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+	valid = true;
+}
+
+void ShadowMap::bindTexture() const
+{
+	glActiveTexture(GL_TEXTURE0 + textureUnit());
+	glBindTexture(type == SHADOW_MAP_CUBE ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+mat4 ShadowMap::textureMatrix() const
+{
+	// Clip space [-1, 1] to texture space [0, 1]
+	mat4 toTexture = translate(mat4(1.f), vec3(0.5f)) * scale(mat4(1.f), vec3(0.5f));
+	return toTexture * projection * view;
+}
@@ -0,0 +1,88 @@
+/* shadow_map.h
+ Depth-only shadow map rendered from the light. The casters are drawn into
+ a depth texture from the light's point of view, then every receiver
+ compares its distance from the light with the map. The texture uses depth
+ comparison with linear filtering, so each lookup is a hardware 2x2
+ percentage closer filter, and the shaders widen it with a kernel of
+ (2 * pcfRadius + 1)^2 lookups.
+
+ SHADOW_MAP_2D is a single perspective view (sampler2DShadow shadowmap on
+ texture unit 2). SHADOW_MAP_CUBE covers every direction around a point
+ light (samplerCubeShadow shadowcube on unit 3); all six faces are drawn in
+ one layered pass, a geometry shader sending each primitive to the faces
+ with the ShadowFaces block, and the map stores the distance from the
+ light divided by the far plane.
+
+ The map keeps its contents until invalidate() is called or the light
+ moves, so the render queue only redraws it when something has changed.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <glm/glm.hpp>
+
+enum ShadowMapType
+{
+	SHADOW_MAP_2D,
+	SHADOW_MAP_CUBE
+};
+
+/* Binding point of the ShadowFaces uniform block (mat4 faces[6]) */
+const GLuint SHADOW_FACES_BLOCK_BINDING = 2;
+
+class ShadowMap
+{
+public:
+	ShadowMap();
+	~ShadowMap();
+
+	/* Create (or recreate) a size x size map, or six faces of that size for a cube */
+	void create(GLuint size, ShadowMapType type = SHADOW_MAP_2D);
+
+	/* Perspective view of the scene from a light at position looking along direction (2D maps) */
+	void lookFrom(const glm::vec3 &position, const glm::vec3 &direction, GLfloat fov, GLfloat nearPlane, GLfloat farPlane);
+
+	/* Six 90 degree views around a point light (cube maps) */
+	void placeAt(const glm::vec3 &position, GLfloat nearPlane, GLfloat farPlane);
+
+	/* Redirect drawing into the map and clear it. end() restores the previous
+	   framebuffer and viewport and marks the contents valid */
+	void begin();
+	void end();
+
+	/* Force the next frame to redraw the map */
+	void invalidate() { valid = false; }
+	bool isValid() const { return valid; }
+
+	/* Bind the depth texture for sampling on its texture unit */
+	void bindTexture() const;
+	GLuint textureUnit() const { return type == SHADOW_MAP_CUBE ? 3 : 2; }
+
+	/* World space to shadow map texture coordinates and depth (2D maps) */
+	glm::mat4 textureMatrix() const;
+
+	ShadowMapType type;
+	GLuint size;
+	GLuint texture;
+
+	// For a cube map, view is the translation to the light and projection
+	// the shared 90 degree projection of the faces
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec3 lightPosition;
+	GLfloat farPlane;
+
+	GLint pcfRadius;		// 0 uses the hardware 2x2 filter alone
+	GLfloat bias;			// Depth bias applied by the receivers
+
+private:
+	GLuint fbo;
+	GLuint facesBuffer;		// ShadowFaces uniform block of a cube map
+	bool valid;
+	GLint previousFramebuffer;
+	GLint previousViewport[4];
+
+	void release();
+	void setView(const glm::mat4 &view, const glm::mat4 &projection);
+};
@@ -7,6 +7,10 @@
 */
 
 #include "sphere_tex.h"
+#include "gl_counters.h"
+#include "icosphere.h"
+
+#include <cstdio>
 
 /* I don't like using namespaces in header files but have less issues with them in
 seperate cpp files */
@@ -21,8 +25,11 @@ Sphere::Sphere(bool useTexture)
 	attribute_v_colours = 1;
 	attribute_v_normal = 2;
 	attribute_v_texcoord = 3;
+	numindices = 0;
 	numspherevertices = 0;		// We set this when we know the numlats and numlongs values in makeSphere
 	drawmode = 0;
+	boundCentre = glm::vec3(0.f);
+	boundRadius = 1.f;
 
 	// Initialise other member variables (good practice)
 	sphereBufferObject = 0;
@@ -40,9 +47,21 @@ Sphere::~Sphere()
 }
 
 
-/* Make a sphere from two triangle fans (one at each pole) and triangle strips along latitudes */
-/* This version uses indexed vertex buffers for both the fans at the poles and the latitude strips */
+/* Make a sphere, or share the buffers of an identical one made before */
 void Sphere::makeSphere(GLuint numlats, GLuint numlongs)
+{
+	this->numlats = numlats;
+	this->numlongs = numlongs;
+
+	char key[64];
+	snprintf(key, sizeof(key), "sphere:%u,%u%s", numlats, numlongs, enableTexture ? ",tex" : "");
+	mesh = meshCache().acquire(key, [this](GPUMesh &m) { generateSphere(m); });
+	useMesh();
+}
+
+/* Make a sphere from two triangle fans (one at each pole) and triangle strips along latitudes */
+/* The fans and strips are unrolled into one indexed triangle list so the sphere is a single draw */
+void Sphere::generateSphere(GPUMesh &mesh)
 {
 	GLuint i, j;
 	/* Calculate the number of vertices required in sphere */
@@ -50,8 +69,6 @@ void Sphere::makeSphere(GLuint numlats, GLuint numlongs)
 
 	// Store the number of sphere vertices in an attribute because we need it later when drawing it
 	numspherevertices = numvertices;
-	this->numlats = numlats;
-	this->numlongs = numlongs;
 
 	// Create the temporary arrays to create the sphere vertex attributes
 	GLfloat* pVertices = new GLfloat[numvertices * 3];
@@ -68,69 +85,61 @@ void Sphere::makeSphere(GLuint numlats, GLuint numlongs)
 		pColours[i * 4 + 3] = 1.f;
 	}
 
-	/* Generate the vertex buffer object */
-	glGenBuffers(1, &sphereBufferObject);
-	glBindBuffer(GL_ARRAY_BUFFER, sphereBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)* numvertices * 3, pVertices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	/* Store the normals in a buffer object */
-	glGenBuffers(1, &sphereNormals);
-	glBindBuffer(GL_ARRAY_BUFFER, sphereNormals);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)* numvertices * 3, pVertices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	/* Store the colours in a buffer object */
-	glGenBuffers(1, &sphereColours);
-	glBindBuffer(GL_ARRAY_BUFFER, sphereColours);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)* numvertices * 4, pColours, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	/* Store the texture coords in a buffer object */
-	/* Create the texture coordinate  buffer for the cube */
-	if (enableTexture)
-	{
-		glGenBuffers(1, &sphereTexCoords);
-		glBindBuffer(GL_ARRAY_BUFFER, sphereTexCoords);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)* numvertices * 2, pTexCoords, GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-	}
-
-	/* Calculate the number of indices in our index array and allocate memory for it */
-	GLuint numindices = ((numlongs * 2)) * (numlats - 2) + ((numlongs + 1) * 2);
+	/* Calculate the number of indices in our index array and allocate memory for it.
+	   Each fan of numlongs + 1 vertices gives numlongs - 1 triangles and each
+	   strip of numlongs * 2 vertices gives numlongs * 2 - 2 triangles */
+	numindices = 3 * (2 * (numlongs - 1) + (numlats - 2) * (numlongs * 2 - 2));
 	GLuint* pindices = new GLuint[numindices];
+	GLuint* pfan = new GLuint[numlongs * 2];	// Vertices of the current fan or strip
 
-	// fill "indices" to define triangle strips
 	GLuint index = 0;		// Current index
 
-	// Define indices for the first triangle fan for one pole
+	// Define triangles for the first triangle fan for one pole
 	for (i = 0; i < numlongs + 1; i++)
 	{
-		pindices[index++] = i;
+		pfan[i] = i;
+	}
+	for (i = 1; i < numlongs; i++)
+	{
+		pindices[index++] = pfan[0];
+		pindices[index++] = pfan[i];
+		pindices[index++] = pfan[i + 1];
 	}
 
+	// Define triangles for the strips, swapping the first two vertices of every
+	// odd triangle to keep the winding of the strip
 	GLuint start = 1;		// Start index for each latitude row
 	for (j = 0; j < numlats - 2; j++)
 	{
 		for (i = 0; i < numlongs; i++)
 		{
-			pindices[index++] = start + i;
-			pindices[index++] = start + i + numlongs;
+			pfan[i * 2] = start + i;
+			pfan[i * 2 + 1] = start + i + numlongs;
+		}
+		for (i = 0; i < numlongs * 2 - 2; i++)
+		{
+			pindices[index++] = pfan[(i & 1) ? i + 1 : i];
+			pindices[index++] = pfan[(i & 1) ? i : i + 1];
+			pindices[index++] = pfan[i + 2];
 		}
 		start += numlongs;
 	}
 
-	// Define indices for the last triangle fan for the south pole region
+	// Define triangles for the last triangle fan for the south pole region
+	GLuint fancount = 0;
 	for (i = numvertices - 1; i > (numvertices - numlongs - 2); i--)
 	{
-		pindices[index++] = i;
+		pfan[fancount++] = i;
+	}
+	for (i = 1; i < numlongs; i++)
+	{
+		pindices[index++] = pfan[0];
+		pindices[index++] = pfan[i];
+		pindices[index++] = pfan[i + 1];
 	}
+	delete [] pfan;
 
-	// Generate a buffer for the indices
-	glGenBuffers(1, &elementbuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, numindices * sizeof(GLuint), pindices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	createBuffers(mesh, pVertices, pColours, pTexCoords, pindices);
 
 	delete [] pTexCoords;
 	delete [] pindices;
@@ -138,6 +147,115 @@ void Sphere::makeSphere(GLuint numlats, GLuint numlongs)
 	delete [] pVertices;
 }
 
+/* Create the vertex attribute and index buffers. numspherevertices and
+   numindices give the array sizes, pTexCoords is only read with textures enabled */
+void Sphere::createBuffers(GPUMesh &mesh, const GLfloat *pVertices, const GLfloat *pColours, const GLfloat *pTexCoords, const GLuint *pindices)
+{
+	GLuint numvertices = numspherevertices;
+	mesh.numVertices = numspherevertices;
+	mesh.numIndices = numindices;
+
+	/* Generate the vertex buffer object */
+	mesh.createBuffer(GL_ARRAY_BUFFER, sizeof(GLfloat)* numvertices * 3, pVertices);
+
+	/* Store the normals in a buffer object */
+	mesh.createBuffer(GL_ARRAY_BUFFER, sizeof(GLfloat)* numvertices * 3, pVertices);
+
+	/* Store the colours in a buffer object */
+	mesh.createBuffer(GL_ARRAY_BUFFER, sizeof(GLfloat)* numvertices * 4, pColours);
+
+	/* Store the texture coords in a buffer object */
+	if (enableTexture)
+	{
+		mesh.createBuffer(GL_ARRAY_BUFFER, sizeof(GLfloat)* numvertices * 2, pTexCoords);
+	}
+
+	// Generate a buffer for the indices
+	mesh.createBuffer(GL_ELEMENT_ARRAY_BUFFER, numindices * sizeof(GLuint), pindices);
+}
+
+/* Take the buffer names and sizes from the shared mesh */
+void Sphere::useMesh()
+{
+	numspherevertices = mesh->numVertices;
+	numindices = mesh->numIndices;
+	sphereBufferObject = mesh->buffers[0];
+	sphereNormals = mesh->buffers[1];
+	sphereColours = mesh->buffers[2];
+	sphereTexCoords = enableTexture ? mesh->buffers[3] : 0;
+	elementbuffer = mesh->buffers.back();
+}
+
+
+/* Make an icosphere. The compile time tables mean the common levels need
+   no generation at start up; only colours and texture coordinates are computed */
+static constexpr IcosphereTable<3> ICOSPHERE_LEVEL_3 = buildIcosphereTable<3>();
+static constexpr IcosphereTable<4> ICOSPHERE_LEVEL_4 = buildIcosphereTable<4>();
+
+void Sphere::makeIcosphere(GLuint level)
+{
+	char key[64];
+	snprintf(key, sizeof(key), "icosphere:%u%s", level, enableTexture ? ",tex" : "");
+	mesh = meshCache().acquire(key, [this, level](GPUMesh &m) { generateIcosphere(m, level); });
+	useMesh();
+}
+
+void Sphere::generateIcosphere(GPUMesh &mesh, GLuint level)
+{
+	vector<GLfloat> positions, colours, texcoords;
+	vector<GLuint> indices;
+	const GLfloat *pVertices;
+	const GLuint *pindices;
+
+	if (level == 3)
+	{
+		numspherevertices = ICOSPHERE_LEVEL_3.NUM_VERTICES;
+		numindices = ICOSPHERE_LEVEL_3.NUM_INDICES;
+		pVertices = ICOSPHERE_LEVEL_3.positions;
+		pindices = ICOSPHERE_LEVEL_3.indices;
+	}
+	else if (level == 4)
+	{
+		numspherevertices = ICOSPHERE_LEVEL_4.NUM_VERTICES;
+		numindices = ICOSPHERE_LEVEL_4.NUM_INDICES;
+		pVertices = ICOSPHERE_LEVEL_4.positions;
+		pindices = ICOSPHERE_LEVEL_4.indices;
+	}
+	else
+	{
+		::makeIcosphere(level, positions, indices);
+		numspherevertices = (GLuint)positions.size() / 3;
+		numindices = (GLuint)indices.size();
+		pVertices = positions.data();
+		pindices = indices.data();
+	}
+
+	/* Colours are the x,y,z components of the vertices as for the lat/long sphere */
+	colours.resize(numspherevertices * 4);
+	for (GLuint i = 0; i < numspherevertices; i++)
+	{
+		colours[i * 4] = pVertices[i * 3];
+		colours[i * 4 + 1] = pVertices[i * 3 + 1];
+		colours[i * 4 + 2] = pVertices[i * 3 + 2];
+		colours[i * 4 + 3] = 1.f;
+	}
+
+	/* Texture coordinates as normalised lat/long values, with the pole along z
+	   as in makeUnitSphere. Vertices are not duplicated along the dateline */
+	if (enableTexture)
+	{
+		texcoords.resize(numspherevertices * 2);
+		for (GLuint i = 0; i < numspherevertices; i++)
+		{
+			const GLfloat *p = pVertices + i * 3;
+			texcoords[i * 2] = atan2(p[1], p[0]) / (2.f * 3.141592f) + 0.5f;
+			texcoords[i * 2 + 1] = asin(glm::clamp(p[2], -1.f, 1.f)) / 3.141592f + 0.5f;
+		}
+	}
+
+	createBuffers(mesh, pVertices, colours.data(), texcoords.data(), pindices);
+}
+
 
 /* Define the vertex positions and texture coordinates for a sphere. 
   The array of vertices must have previously been created.
@@ -195,8 +313,6 @@ void Sphere::makeUnitSphere(GLfloat *pVertices, GLfloat *pTexCoords)
 /* Draws the sphere form the previously defined vertex and index buffers */
 void Sphere::drawSphere(int drawmode)
 {
-	GLuint i;
-
 	/* Draw the vertices as GL_POINTS */
 	glBindBuffer(GL_ARRAY_BUFFER, sphereBufferObject);
 	glVertexAttribPointer(attribute_v_coord, 3, GL_FLOAT, GL_FALSE, 0, 0);
@@ -240,22 +356,7 @@ void Sphere::drawSphere(int drawmode)
 		/* Bind the indexed vertex buffer */
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 
-		/* Draw the north pole regions as a triangle  */
-		glDrawElements(GL_TRIANGLE_FAN, numlongs + 1, GL_UNSIGNED_INT, (GLvoid*)(0));
-
-		/* Calculate offsets into the indexed array. Note that we multiply offsets by 4
-		because it is a memory offset the indices are type GLuint which is 4-bytes */
-		GLuint lat_offset_jump = (numlongs * 2);
-		GLuint lat_offset_start = numlongs + 1;
-		GLuint lat_offset_current = lat_offset_start * 4;
-
-		/* Draw the triangle strips of latitudes */
-		for (i = 0; i < numlats - 2; i++)
-		{
-			glDrawElements(GL_TRIANGLE_STRIP, numlongs * 2, GL_UNSIGNED_INT, (GLvoid*)(lat_offset_current));
-			lat_offset_current += (lat_offset_jump * 4);
-		}
-		/* Draw the south pole as a triangle fan */
-		glDrawElements(GL_TRIANGLE_FAN, numlongs + 1, GL_UNSIGNED_INT, (GLvoid*)(lat_offset_current));
+		/* Draw the poles and all latitude bands in one call */
+		glDrawElements(GL_TRIANGLES, numindices, GL_UNSIGNED_INT, (GLvoid*)(0));
 	}
 }
\ No newline at end of file
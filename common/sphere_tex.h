@@ -7,6 +7,7 @@
 #pragma once
 
 #include "wrapper_glfw.h"
+#include "mesh_cache.h"
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -16,9 +17,17 @@ public:
 	Sphere(bool useTexture = true);
 	~Sphere();
 
+	/* Spheres with the same parameters share one set of buffers from the mesh cache */
 	void makeSphere(GLuint numlats, GLuint numlongs);
+
+	/* Icosphere with 20 * 4^level triangles. Levels 3 and 4 come from tables
+	   built at compile time, other levels are subdivided at run time */
+	void makeIcosphere(GLuint level);
 	void drawSphere(int drawmode);
 
+	// Shared buffers of this sphere's parameters
+	std::shared_ptr<GPUMesh> mesh;
+
 	// Define vertex buffer object names (e.g as globals)
 	GLuint sphereBufferObject;
 	GLuint sphereNormals;
@@ -32,11 +41,20 @@ public:
 	GLuint attribute_v_texcoord;
 
 	unsigned int numspherevertices;
+	unsigned int numindices;		// Triangle list indices, drawn with one call
 	unsigned int numlats;
 	unsigned int numlongs;
 	unsigned int drawmode;
 	bool enableTexture;
 
+	// Bounding sphere in object space, the sphere is generated with radius 1
+	glm::vec3 boundCentre;
+	GLfloat boundRadius;
+
 private:
 	void makeUnitSphere(GLfloat *pVertices, GLfloat *pTexCoords);
+	void generateSphere(GPUMesh &mesh);
+	void generateIcosphere(GPUMesh &mesh, GLuint level);
+	void createBuffers(GPUMesh &mesh, const GLfloat *pVertices, const GLfloat *pColours, const GLfloat *pTexCoords, const GLuint *pindices);
+	void useMesh();
 };
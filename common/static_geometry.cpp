@@ -0,0 +1,100 @@
+/* static_geometry.cpp
+ Instanced drawing of geometry uploaded once into immutable buffers
+*/
+
+#include "static_geometry.h"
+#include "gl_counters.h"
+
+#include <cstddef>
+
+StaticGeometry::StaticGeometry() : numVertices(0), numInstances(0), bounds(), vao(0), instanceBuffer(0), mode(GL_TRIANGLES)
+{
+}
+
+StaticGeometry::~StaticGeometry()
+{
+	if (vao && glfwGetCurrentContext())
+	{
+		glDeleteBuffers(1, &instanceBuffer);
+		glDeleteVertexArrays(1, &vao);
+	}
+}
+
+/* glBufferStorage needs OpenGL 4.4 or ARB_buffer_storage, otherwise the
+   buffer is specified once with glBufferData and never touched again */
+void StaticGeometry::createImmutable(GLenum target, GLsizeiptr size, const void *data)
+{
+	if (ogl_IsVersionGEQ(4, 4) || ogl_ext_ARB_buffer_storage)
+		glBufferStorage(target, size, data, 0);
+	else
+		glBufferData(target, size, data, GL_STATIC_DRAW);
+}
+
+void StaticGeometry::create(const std::string &key, const GLfloat *vertexData, GLuint numVertices, GLenum mode,
+	const std::vector<StaticInstance> &instances)
+{
+	this->numVertices = numVertices;
+	this->numInstances = (GLuint)instances.size();
+	this->mode = mode;
+
+	std::vector<glm::vec3> corners;
+	for (const StaticInstance &instance : instances)
+		for (GLuint i = 0; i < numVertices; i++)
+			corners.push_back(glm::vec3(instance.model * glm::vec4(vertexData[i * 3], vertexData[i * 3 + 1], vertexData[i * 3 + 2], 1.f)));
+	bounds = sphereFromPoints(corners.data(), (GLuint)corners.size());
+
+	// The attribute layout lives in its own vertex array object so drawing
+	// does not disturb the attributes of the other objects
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	vertices = meshCache().acquire(key, [=](GPUMesh &mesh)
+	{
+		GLuint buffer;
+		GLsizeiptr size = numVertices * 9 * sizeof(GLfloat);
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		createImmutable(GL_ARRAY_BUFFER, size, vertexData);
+		mesh.buffers.push_back(buffer);
+		mesh.bufferSizes.push_back((size_t)size);
+		mesh.numVertices = numVertices;
+	});
+	glBindBuffer(GL_ARRAY_BUFFER, vertices->buffers[0]);
+
+	for (GLuint i = 0; i < 3; i++)
+	{
+		glVertexAttribPointer(i, 3, GL_FLOAT, GL_FALSE, 0, (void*)(i * numVertices * 3 * sizeof(GLfloat)));
+		glEnableVertexAttribArray(i);
+	}
+
+	glGenBuffers(1, &instanceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	createImmutable(GL_ARRAY_BUFFER, instances.size() * sizeof(StaticInstance), instances.data());
+
+	// Matrices take one attribute per column
+	GLsizei stride = sizeof(StaticInstance);
+	for (GLuint i = 0; i < 4; i++)
+	{
+		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offsetof(StaticInstance, model) + i * sizeof(glm::vec4)));
+		glVertexAttribDivisor(3 + i, 1);
+		glEnableVertexAttribArray(3 + i);
+	}
+	for (GLuint i = 0; i < 3; i++)
+	{
+		glVertexAttribPointer(7 + i, 3, GL_FLOAT, GL_FALSE, stride, (void*)(offsetof(StaticInstance, normalmatrix) + i * sizeof(glm::vec3)));
+		glVertexAttribDivisor(7 + i, 1);
+		glEnableVertexAttribArray(7 + i);
+	}
+	glVertexAttribIPointer(10, 1, GL_INT, stride, (void*)offsetof(StaticInstance, layer));
+	glVertexAttribDivisor(10, 1);
+	glEnableVertexAttribArray(10);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+void StaticGeometry::draw() const
+{
+	glBindVertexArray(vao);
+	glDrawArraysInstanced(mode, 0, numVertices, numInstances);
+}
@@ -0,0 +1,56 @@
+/* static_geometry.h
+ Geometry that never changes after start up, such as the quads making up
+ the room. The vertex data is uploaded once into an immutable buffer and
+ every copy of it becomes an instance with its own model matrix, normal
+ matrix and texture array layer, so the whole set is drawn with one call.
+ Vertex attributes: position 0, normal 1, texcoord 2 (planar layout as in
+ floor_data), instance model matrix 3-6, normal matrix 7-9, layer 10.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include "mesh_cache.h"
+#include "frustum.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct StaticInstance
+{
+	glm::mat4 model;
+	glm::mat3 normalmatrix;		// Inverse transpose of the model matrix, the shader applies the view
+	GLint layer;
+};
+
+class StaticGeometry
+{
+public:
+	StaticGeometry();
+	~StaticGeometry();
+
+	/* Upload numVertices positions, normals and texcoords (three floats each,
+	   stored one block after another) and the instances. Only call once.
+	   The vertex buffer is shared through the mesh cache under key */
+	void create(const std::string &key, const GLfloat *vertexData, GLuint numVertices, GLenum mode,
+		const std::vector<StaticInstance> &instances);
+
+	/* Draw every instance. Leaves the geometry's vertex array object bound */
+	void draw() const;
+
+	/* Create the storage of the bound buffer once with its final contents */
+	static void createImmutable(GLenum target, GLsizeiptr size, const void *data);
+
+	GLuint numVertices;
+	GLuint numInstances;
+
+	// World space bounds of all the instances, found in create()
+	BoundingSphere bounds;
+
+private:
+	GLuint vao;
+	std::shared_ptr<GPUMesh> vertices;
+	GLuint instanceBuffer;
+	GLenum mode;
+};
@@ -0,0 +1,381 @@
+/* texture_cache.cpp
+ CPU mip chain generation and the raw mip level disk cache
+*/
+
+#include "texture_cache.h"
+#include "stb_image.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTURE_CACHE_SSE2
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char MIP_CACHE_MAGIC[4] = { 'M', 'I', 'P', '1' };
+
+// Fixed size header at the start of a cache file, followed by the level table and pixels
+struct MipCacheHeader
+{
+	char magic[4];
+	GLuint width, height, channels, numLevels;
+	GLuint flip;
+	unsigned long long sourceSize;
+	long long sourceTime;
+};
+
+MappedFile::MappedFile()
+{
+	bytes = NULL;
+	length = 0;
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const string &path)
+{
+	close();
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	length = (size_t)fileSize.QuadPart;
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping) bytes = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	fstat(fd, &st);
+	length = (size_t)st.st_size;
+	void *p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p != MAP_FAILED) bytes = (const unsigned char *)p;
+#endif
+	if (!bytes || length == 0)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (bytes) UnmapViewOfFile(bytes);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (bytes) munmap((void *)bytes, length);
+	if (fd >= 0) ::close(fd);
+	fd = -1;
+#endif
+	bytes = NULL;
+	length = 0;
+}
+
+
+/* Box filter one level down. The vertical pass sums row pairs into 16-bit
+   lanes with SSE2, the horizontal pass adds neighbouring pixels and rounds */
+void downsampleBox(const unsigned char *src, GLuint width, GLuint height, GLuint channels, unsigned char *dst)
+{
+	GLuint dw = width > 1 ? width / 2 : 1;
+	GLuint dh = height > 1 ? height / 2 : 1;
+	GLuint stride = width * channels;
+	vector<unsigned short> sums(stride);
+
+	for (GLuint y = 0; y < dh; y++)
+	{
+		const unsigned char *row0 = src + (size_t)(y * 2) * stride;
+		const unsigned char *row1 = (height > 1) ? row0 + stride : row0;
+
+		GLuint x = 0;
+#ifdef TEXTURE_CACHE_SSE2
+		__m128i zero = _mm_setzero_si128();
+		for (; x + 16 <= stride; x += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(row0 + x));
+			__m128i b = _mm_loadu_si128((const __m128i *)(row1 + x));
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			_mm_storeu_si128((__m128i *)(&sums[x]), lo);
+			_mm_storeu_si128((__m128i *)(&sums[x + 8]), hi);
+		}
+#endif
+		for (; x < stride; x++)
+			sums[x] = (unsigned short)(row0[x] + row1[x]);
+
+		unsigned char *out = dst + (size_t)y * dw * channels;
+		for (GLuint px = 0; px < dw; px++)
+		{
+			GLuint s0 = px * 2 * channels;
+			GLuint s1 = (width > 1) ? s0 + channels : s0;
+			for (GLuint c = 0; c < channels; c++)
+				out[px * channels + c] = (unsigned char)((sums[s0 + c] + sums[s1 + c] + 2) >> 2);
+		}
+	}
+}
+
+void resampleBilinear(const unsigned char *src, GLuint width, GLuint height, GLuint channels,
+	unsigned char *dst, GLuint dstWidth, GLuint dstHeight)
+{
+	float sx = (float)width / dstWidth, sy = (float)height / dstHeight;
+	for (GLuint y = 0; y < dstHeight; y++)
+	{
+		float fy = (y + 0.5f) * sy - 0.5f;
+		if (fy < 0) fy = 0;
+		GLuint y0 = (GLuint)fy;
+		GLuint y1 = y0 + 1 < height ? y0 + 1 : y0;
+		float ty = fy - y0;
+		for (GLuint x = 0; x < dstWidth; x++)
+		{
+			float fx = (x + 0.5f) * sx - 0.5f;
+			if (fx < 0) fx = 0;
+			GLuint x0 = (GLuint)fx;
+			GLuint x1 = x0 + 1 < width ? x0 + 1 : x0;
+			float tx = fx - x0;
+			for (GLuint c = 0; c < channels; c++)
+			{
+				float a = src[((size_t)y0 * width + x0) * channels + c] * (1 - tx) + src[((size_t)y0 * width + x1) * channels + c] * tx;
+				float b = src[((size_t)y1 * width + x0) * channels + c] * (1 - tx) + src[((size_t)y1 * width + x1) * channels + c] * tx;
+				dst[((size_t)y * dstWidth + x) * channels + c] = (unsigned char)(a * (1 - ty) + b * ty + 0.5f);
+			}
+		}
+	}
+}
+
+void MipChain::build(const unsigned char *src, GLuint width, GLuint height, GLuint channels)
+{
+	this->width = width;
+	this->height = height;
+	this->channels = channels;
+	mapped.close();
+	pixelOffset = 0;
+	levels.clear();
+
+	// Lay out every level first so the pixels can go in one allocation
+	GLuint w = width, h = height, offset = 0;
+	while (true)
+	{
+		MipLevel level;
+		level.width = w;
+		level.height = h;
+		level.offset = offset;
+		level.size = w * h * channels;
+		levels.push_back(level);
+		offset += level.size;
+		if (w == 1 && h == 1) break;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+
+	owned.resize(offset);
+	memcpy(owned.data(), src, levels[0].size);
+	for (size_t i = 1; i < levels.size(); i++)
+	{
+		const MipLevel &prev = levels[i - 1];
+		downsampleBox(&owned[prev.offset], prev.width, prev.height, channels, &owned[levels[i].offset]);
+	}
+}
+
+size_t MipChain::byteSize() const
+{
+	return levels.empty() ? 0 : levels.back().offset + levels.back().size;
+}
+
+static bool sourceStamp(const string &imagefile, unsigned long long &size, long long &time)
+{
+	error_code ec;
+	size = (unsigned long long)filesystem::file_size(imagefile, ec);
+	if (ec) return false;
+	time = (long long)filesystem::last_write_time(imagefile, ec).time_since_epoch().count();
+	return !ec;
+}
+
+bool MipChain::loadCache(const string &imagefile, bool flip)
+{
+	MipCacheHeader expected;
+	if (!sourceStamp(imagefile, expected.sourceSize, expected.sourceTime)) return false;
+	if (!mapped.open(imagefile + ".mips")) return false;
+
+	const unsigned char *p = mapped.data();
+	MipCacheHeader header;
+	if (mapped.size() < sizeof(header))
+	{
+		mapped.close();
+		return false;
+	}
+	memcpy(&header, p, sizeof(header));
+
+	if (memcmp(header.magic, MIP_CACHE_MAGIC, 4) != 0 || header.flip != (GLuint)flip
+		|| header.sourceSize != expected.sourceSize || header.sourceTime != expected.sourceTime
+		|| mapped.size() < sizeof(header) + header.numLevels * sizeof(MipLevel))
+	{
+		mapped.close();
+		return false;
+	}
+
+	width = header.width;
+	height = header.height;
+	channels = header.channels;
+	levels.resize(header.numLevels);
+	memcpy(levels.data(), p + sizeof(header), header.numLevels * sizeof(MipLevel));
+	pixelOffset = sizeof(header) + header.numLevels * sizeof(MipLevel);
+	owned.clear();
+
+	if (mapped.size() < pixelOffset + byteSize())
+	{
+		mapped.close();
+		return false;
+	}
+	return true;
+}
+
+bool MipChain::saveCache(const string &imagefile, bool flip) const
+{
+	MipCacheHeader header;
+	if (!sourceStamp(imagefile, header.sourceSize, header.sourceTime)) return false;
+	memcpy(header.magic, MIP_CACHE_MAGIC, 4);
+	header.width = width;
+	header.height = height;
+	header.channels = channels;
+	header.numLevels = (GLuint)levels.size();
+	header.flip = flip;
+
+	// Write to a temporary name first so a reader never maps a half written file
+	string cachefile = imagefile + ".mips";
+	string tempfile = cachefile + ".tmp";
+	{
+		ofstream file(tempfile, ios::out | ios::binary | ios::trunc);
+		if (!file.is_open()) return false;
+		file.write((const char *)&header, sizeof(header));
+		file.write((const char *)levels.data(), levels.size() * sizeof(MipLevel));
+		file.write((const char *)pixels(), byteSize());
+		if (file.fail()) return false;
+	}
+	error_code ec;
+	filesystem::rename(tempfile, cachefile, ec);
+	return !ec;
+}
+
+void MipChain::upload() const
+{
+	// Note: this is not a full check of all pixel format types, just the most common ones!
+	GLenum pixel_format = GL_RGBA;
+	if (channels == 3) pixel_format = GL_RGB;
+	else if (channels == 2) pixel_format = GL_RG;
+	else if (channels == 1) pixel_format = GL_RED;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (GLuint i = 0; i < levels.size(); i++)
+		glTexImage2D(GL_TEXTURE_2D, i, pixel_format, levels[i].width, levels[i].height, 0, pixel_format, GL_UNSIGNED_BYTE, level(i));
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+}
+
+
+/* Decode one image the slow way and keep the result in chain */
+static bool decodeImage(const char *filename, bool flip, MipChain &chain)
+{
+	int width, height, nrChannels;
+	unsigned char *data = stbi_load(filename, &width, &height, &nrChannels, 0);
+	if (!data) return false;
+
+	if (flip)
+	{
+		size_t stride = (size_t)width * nrChannels;
+		vector<unsigned char> row(stride);
+		for (int y = 0; y < height / 2; y++)
+		{
+			unsigned char *top = data + y * stride;
+			unsigned char *bottom = data + (height - 1 - y) * stride;
+			memcpy(row.data(), top, stride);
+			memcpy(top, bottom, stride);
+			memcpy(bottom, row.data(), stride);
+		}
+	}
+
+	chain.build(data, width, height, nrChannels);
+	stbi_image_free(data);
+	return true;
+}
+
+bool loadMipChain(const char *filename, bool flip, MipChain &chain)
+{
+	if (chain.loadCache(filename, flip)) return true;
+	if (!decodeImage(filename, flip, chain)) return false;
+	if (!chain.saveCache(filename, flip))
+		cerr << "Could not write mip cache for " << filename << endl;
+	return true;
+}
+
+void benchmarkTextureLoads(const char **filenames, GLuint count, GLuint numThreads, bool flip)
+{
+	if (numThreads == 0) numThreads = thread::hardware_concurrency();
+	if (numThreads == 0) numThreads = 1;
+
+	// Runs pass(i) for every image spread over the threads, returns milliseconds
+	auto run = [&](bool warm) -> double
+	{
+		auto start = chrono::steady_clock::now();
+		vector<thread> threads;
+		for (GLuint t = 0; t < numThreads; t++)
+		{
+			threads.push_back(thread([&, t]() {
+				for (GLuint i = t; i < count; i += numThreads)
+				{
+					MipChain chain;
+					if (warm)
+					{
+						if (!chain.loadCache(filenames[i], flip)) continue;
+						// Touch every page so the timing includes reading the file
+						volatile unsigned int sum = 0;
+						for (size_t b = 0; b < chain.byteSize(); b += 4096) sum += chain.pixels()[b];
+					}
+					else if (decodeImage(filenames[i], flip, chain))
+					{
+						chain.saveCache(filenames[i], flip);
+					}
+				}
+			}));
+		}
+		for (auto &t : threads) t.join();
+		return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	};
+
+	cout << "Texture load benchmark: " << count << " images on " << numThreads << " threads" << endl;
+	double cold = run(false);
+	cout << "  cold (decode + CPU mips + write cache): " << cold << " ms" << endl;
+	double warm = run(true);
+	cout << "  warm (mapped mip cache):                " << warm << " ms" << endl;
+}
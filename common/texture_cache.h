@@ -0,0 +1,91 @@
+/* texture_cache.h
+ Builds the full mip chain of a decoded image on the CPU and caches it on
+ disk as raw mip levels next to the source image (<image>.mips).
+ Later launches memory map the cache file and upload it straight away
+ without decoding the image or calling glGenerateMipmap.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <string>
+#include <vector>
+
+// Read only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool open(const std::string &path);
+	void close();
+
+	const unsigned char *data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const unsigned char *bytes;
+	size_t length;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#else
+	int fd;
+#endif
+};
+
+struct MipLevel
+{
+	GLuint width, height;
+	GLuint offset;		// Byte offset of the level in the pixel data
+	GLuint size;
+};
+
+// A mip chain, either owned in memory or pointing into a mapped cache file
+class MipChain
+{
+public:
+	MipChain() : width(0), height(0), channels(0), pixelOffset(0) {}
+
+	GLuint width, height, channels;
+	std::vector<MipLevel> levels;
+
+	const unsigned char *pixels() const { return mapped.data() ? mapped.data() + pixelOffset : owned.data(); }
+	const unsigned char *level(GLuint i) const { return pixels() + levels[i].offset; }
+
+	/* Build every level down to 1x1 from tightly packed 8-bit pixels */
+	void build(const unsigned char *src, GLuint width, GLuint height, GLuint channels);
+
+	/* Load from or save to the cache. The source file's size and modification
+	   time are stored in the cache so an edited image is decoded again */
+	bool loadCache(const std::string &imagefile, bool flip);
+	bool saveCache(const std::string &imagefile, bool flip) const;
+
+	/* Upload every level into the currently bound GL_TEXTURE_2D */
+	void upload() const;
+
+	size_t byteSize() const;
+
+private:
+	std::vector<unsigned char> owned;
+	MappedFile mapped;
+	size_t pixelOffset;
+};
+
+/* Use the cached mip chain for an image if it is up to date, otherwise decode
+   the image, build the chain and write the cache. Needs no GL context */
+bool loadMipChain(const char *filename, bool flip, MipChain &chain);
+
+/* Halve an image with a 2x2 box filter. SSE2 is used for the vertical pass */
+void downsampleBox(const unsigned char *src, GLuint width, GLuint height, GLuint channels, unsigned char *dst);
+
+/* Bilinear resize, used to bring images to a common size for array layers */
+void resampleBilinear(const unsigned char *src, GLuint width, GLuint height, GLuint channels,
+	unsigned char *dst, GLuint dstWidth, GLuint dstHeight);
+
+/* Decode the images cold (stb_image + CPU mips) and warm (mapped cache) on
+   numThreads threads and print the timings. Needs no GL context */
+void benchmarkTextureLoads(const char **filenames, GLuint count, GLuint numThreads, bool flip);
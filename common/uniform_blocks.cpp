@@ -0,0 +1,97 @@
+/* uniform_blocks.cpp
+ Ring buffer of per-draw uniform blocks
+*/
+
+#include "uniform_blocks.h"
+#include "gl_counters.h"
+
+#include <cstdio>
+#include <cstring>
+
+UniformRing::UniformRing() : buffer(0), blockSize(0), dataSize(0), blocksPerFrame(0), numFrames(0), segment(0), used(0), mapped(NULL)
+{
+	for (GLuint i = 0; i < 4; i++) fences[i] = 0;
+}
+
+UniformRing::~UniformRing()
+{
+	// Globals are destroyed after the window has closed
+	if (!glfwGetCurrentContext()) return;
+	for (GLuint i = 0; i < numFrames; i++)
+		if (fences[i]) glDeleteSync(fences[i]);
+	if (buffer) glDeleteBuffers(1, &buffer);
+}
+
+void UniformRing::create(GLuint blockSize, GLuint blocksPerFrame, GLuint numFrames)
+{
+	for (GLuint i = 0; i < this->numFrames; i++)
+	{
+		if (fences[i]) glDeleteSync(fences[i]);
+		fences[i] = 0;
+	}
+	if (buffer) glDeleteBuffers(1, &buffer);
+
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+	this->dataSize = blockSize;
+	this->blockSize = (blockSize + alignment - 1) / alignment * alignment;
+	this->blocksPerFrame = blocksPerFrame;
+	this->numFrames = numFrames < 4 ? numFrames : 4;
+	segment = 0;
+	used = 0;
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)this->blockSize * blocksPerFrame * this->numFrames, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformRing::map()
+{
+	segment = (segment + 1) % numFrames;
+	used = 0;
+
+	if (fences[segment])
+	{
+		if (glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+			printf("UniformRing: timed out waiting for the GPU\n");
+		glDeleteSync(fences[segment]);
+		fences[segment] = 0;
+	}
+
+	// The fence guarantees the segment is idle, so the driver need not synchronise
+	GLsizeiptr size = (GLsizeiptr)blockSize * blocksPerFrame;
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	mapped = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, segment * size, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+GLuint UniformRing::push(const void *data)
+{
+	if (!mapped || used == blocksPerFrame)
+	{
+		printf("UniformRing: more than %u blocks in one frame\n", blocksPerFrame);
+		return segment * blocksPerFrame * blockSize;
+	}
+	memcpy(mapped + used * blockSize, data, dataSize);
+	return (segment * blocksPerFrame + used++) * blockSize;
+}
+
+void UniformRing::unmap()
+{
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glUnmapBuffer(GL_UNIFORM_BUFFER);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	mapped = NULL;
+}
+
+void UniformRing::fence()
+{
+	fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void UniformRing::bind(GLuint binding, GLuint offset) const
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, dataSize);
+}
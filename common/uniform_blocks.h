@@ -0,0 +1,99 @@
+/* uniform_blocks.h
+ std140 uniform blocks shared by every shader program.
+ FrameData holds the camera, light and frame constants and is written once
+ per frame. ObjectData holds the per-draw values, including the model-view,
+ MVP and normal matrices worked out once per draw on the CPU so the vertex
+ shaders do no matrix products of their own; the blocks for a frame are
+ packed into one segment of a ring buffer and each draw selects its block
+ with glBindBufferRange. MaterialData holds the lighting constants of a
+ surface; the materials never change, so they sit in one static buffer.
+ The layouts here must match the blocks declared in the shaders.
+*/
+
+#pragma once
+
+#include "wrapper_glfw.h"
+#include <glm/glm.hpp>
+
+/* Binding points of the blocks, set for each program in the Shader class */
+const GLuint FRAME_BLOCK_BINDING = 0;
+const GLuint OBJECT_BLOCK_BINDING = 1;
+const GLuint MATERIAL_BLOCK_BINDING = 3;		// 2 is the shadow cube faces (shadow_map.h)
+
+struct FrameUniforms
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 lightpos;			// Eye space
+	GLuint colourmode;
+	GLuint shadows;				// 0 none, 1 receivers sample the 2D shadow map, 2 the cube map
+	GLint pcfRadius;
+	GLfloat shadowBias;
+	glm::mat4 lightspace;		// World space to shadow map coordinates
+	GLfloat shadowMapSize;
+	GLuint pad[3];
+	glm::vec4 shadowLight;		// World space light position and far plane of the cube map
+	glm::vec4 clusterScale;		// Point light clusters (light_clusters.h)
+	GLuint clusterDims[4];		// Clusters in x, y and z, then 1 if the lights are on
+};
+
+struct ObjectUniforms
+{
+	glm::mat4 model;
+	glm::mat4 modelView;
+	glm::mat4 mvp;
+	glm::vec4 normalMatrix[3];	// Eye space mat3, std140 pads each column to a vec4
+	GLfloat alphaValue;
+	GLfloat size;				// Point size of point sprites
+	GLuint receiveShadow;
+};
+
+struct MaterialUniforms
+{
+	glm::vec4 diffuse;
+	glm::vec4 ambient;
+	glm::vec4 specular;
+	glm::vec4 globalAmbient;	// Added whatever the light
+	glm::vec4 emissive;			// Added by the EMISSIVE program variants
+	glm::vec4 attenuation;		// Constant, linear and quadratic falloff, then shininess
+};
+
+/* Uniform buffer split into one segment per frame in flight. A fence per
+   segment makes sure the GPU has finished reading it before it is mapped
+   and overwritten again */
+class UniformRing
+{
+public:
+	UniformRing();
+	~UniformRing();
+
+	/* Room for blocksPerFrame blocks of blockSize bytes in each of numFrames segments */
+	void create(GLuint blockSize, GLuint blocksPerFrame, GLuint numFrames = 3);
+
+	/* Map the next segment for writing; waits if the GPU still uses it */
+	void map();
+
+	/* Copy one block into the mapped segment and return its byte offset in the buffer */
+	GLuint push(const void *data);
+
+	void unmap();
+
+	/* Call after the draws reading this segment have been issued */
+	void fence();
+
+	/* Bind the block at offset to an indexed uniform buffer binding point */
+	void bind(GLuint binding, GLuint offset) const;
+
+	GLuint capacity() const { return blocksPerFrame; }
+
+private:
+	GLuint buffer;
+	GLuint blockSize;		// Padded to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	GLuint dataSize;		// Bytes of each block that are used
+	GLuint blocksPerFrame;
+	GLuint numFrames;
+	GLuint segment;
+	GLuint used;
+	unsigned char *mapped;
+	GLsync fences[4];
+};
@@ -6,6 +6,7 @@
   */
 
 #include "wrapper_glfw.h"
+#include "render_target.h"
 
 /* Inlcude some standard headers */
 
@@ -16,13 +17,18 @@
 using namespace std;
 
 /* Constructor for wrapper object */
-GLWrapper::GLWrapper(int width, int height, const char *title) {
+GLWrapper::GLWrapper(int width, int height, const char *title, bool headless) {
 
 	this->width = width;
 	this->height = height;
 	this->title = title;
 	this->fps = 60;
 	this->running = true;
+	this->offscreen = NULL;
+	this->reshape = NULL;
+	this->frameDone = NULL;
+	this->exitLoop = NULL;
+	this->frameLimit = 0;
 
 	/* Initialise GLFW and exit if it fails */
 	if (!glfwInit()) 
@@ -31,7 +37,10 @@ GLWrapper::GLWrapper(int width, int height, const char *title) {
 		exit(EXIT_FAILURE);
 	}
 
-	glfwWindowHint(GLFW_SAMPLES, 8);
+	// Headless, the window only provides the context and the offscreen
+	// target is multisampled instead
+	glfwWindowHint(GLFW_SAMPLES, headless ? 0 : 8);
+	if (headless) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -61,11 +70,18 @@ GLWrapper::GLWrapper(int width, int height, const char *title) {
 	//glfwSetWindowTitle(window, "Hello Graphics (again)");
 
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, true);
+
+	if (headless)
+	{
+		offscreen = new RenderTarget();
+		offscreen->create(width, height, 8);
+	}
 }
 
 
 /* Terminate GLFW on destruvtion of the wrapepr object */
 GLWrapper::~GLWrapper() {
+	if (offscreen && glfwGetCurrentContext()) delete offscreen;
 	glfwTerminate();
 }
 
@@ -75,6 +91,16 @@ GLFWwindow* GLWrapper::getWindow()
 	return window;
 }
 
+/* Window hints from the constructor still apply, so the context matches */
+GLFWwindow* GLWrapper::createSharedContext()
+{
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow* shared = glfwCreateWindow(1, 1, title, 0, window);
+	if (!offscreen) glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+	if (!shared) cout << "Could not create a shared GLFW context." << endl;
+	return shared;
+}
+
 
 /*
  * Print OpenGL Version details
@@ -100,17 +126,35 @@ and then starts the event loop which runs until the program ends
 */
 int GLWrapper::eventLoop()
 {
+	pacer.setMode(pacer.mode, fps);
+	pacer.start(window);
+
+	// An invisible window is never resized, so report the target's size once
+	if (offscreen && reshape) reshape(window, offscreen->width, offscreen->height);
+
 	// Main loop
-	while (!glfwWindowShouldClose(window))
+	unsigned int frame = 0;
+	while (!glfwWindowShouldClose(window) && (!frameLimit || frame < frameLimit))
 	{
+		if (offscreen) offscreen->bind();
+
 		// Call function to draw your graphics
 		renderer();
 
-		// Swap buffers
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		if (offscreen) offscreen->resolve();
+		if (frameDone) frameDone(frame);
+		frame++;
+
+		// Swap buffers, then wait for the next frame and process events
+		if (!offscreen) glfwSwapBuffers(window);
+		pacer.endFrame();
 	}
 
+	if (exitLoop) exitLoop();
+
+	// The offscreen target needs the context, which glfwTerminate destroys
+	delete offscreen;
+	offscreen = NULL;
 	glfwTerminate();
 	return 0;
 }
@@ -129,6 +173,7 @@ void GLWrapper::setRenderer(void(*func)()) {
 
 /* Register a callback that runs after the window gets resized */
 void GLWrapper::setReshapeCallback(void(*func)(GLFWwindow* window, int w, int h)) {
+	this->reshape = func;
 	glfwSetFramebufferSizeCallback(window, func);
 }
 
@@ -181,28 +226,34 @@ GLuint GLWrapper::BuildShader(GLenum eShaderType, const string &shaderText)
 /* Read a text file into a string*/
 string GLWrapper::readFile(const char *filePath)
 {
-	string content;
-	ifstream fileStream(filePath, ios::in);
+	ifstream fileStream(filePath, ios::in | ios::binary);
 
 	if (!fileStream.is_open()) {
 		cerr << "Could not read file " << filePath << ". File does not exist." << endl;
 		return "";
 	}
 
-	string line = "";
-	while (!fileStream.eof()) {
-		getline(fileStream, line);
-		content.append(line + "\n");
-	}
-
-	fileStream.close();
+	// One read of the whole file rather than a line at a time
+	fileStream.seekg(0, ios::end);
+	streamoff size = fileStream.tellg();
+	if (size <= 0) return "";
+	string content((size_t)size, '\0');
+	fileStream.seekg(0, ios::beg);
+	fileStream.read(&content[0], content.size());
 	return content;
 }
 
 /* Load vertex and fragment shader and return the compiled program */
 GLuint GLWrapper::LoadShader(const char *vertex_path, const char *fragment_path)
 {
-	GLuint vertShader, fragShader;
+	return LoadShader(vertex_path, NULL, fragment_path);
+}
+
+/* Load vertex, geometry (if geometry_path is not NULL) and fragment shader
+   and return the compiled program */
+GLuint GLWrapper::LoadShader(const char *vertex_path, const char *geometry_path, const char *fragment_path)
+{
+	GLuint vertShader, geomShader = 0, fragShader;
 
 	// Read shaders
 	string vertShaderStr = readFile(vertex_path);
@@ -212,11 +263,13 @@ GLuint GLWrapper::LoadShader(const char *vertex_path, const char *fragment_path)
 	int logLength;
 
 	vertShader = BuildShader(GL_VERTEX_SHADER, vertShaderStr);
+	if (geometry_path) geomShader = BuildShader(GL_GEOMETRY_SHADER, readFile(geometry_path));
 	fragShader = BuildShader(GL_FRAGMENT_SHADER, fragShaderStr);
 
 	cout << "Linking program" << endl;
 	GLuint program = glCreateProgram();
 	glAttachShader(program, vertShader);
+	if (geomShader) glAttachShader(program, geomShader);
 	glAttachShader(program, fragShader);
 	glLinkProgram(program);
 
@@ -227,6 +280,7 @@ GLuint GLWrapper::LoadShader(const char *vertex_path, const char *fragment_path)
 	cout << &programError[0] << endl;
 
 	glDeleteShader(vertShader);
+	if (geomShader) glDeleteShader(geomShader);
 	glDeleteShader(fragShader);
 
 	return program;
@@ -8,10 +8,14 @@ Iain Martin August 2014
 #include <string>
 
 /* Inlcude GL_Load and GLFW */
-#include <glload/gl_4_0.h>
+#include <glload/gl_4_4.h>
 #include <glload/gl_load.h>
 #include <GLFW/glfw3.h>
 
+#include "frame_pacer.h"
+
+class RenderTarget;
+
 class GLWrapper {
 private:
 
@@ -22,15 +26,61 @@ private:
 	void(*renderer)();
 	bool running;
 	GLFWwindow* window;
+	FramePacer pacer;
+	RenderTarget *offscreen;			// Drawn into instead of the window when headless
+	void(*reshape)(GLFWwindow* window, int w, int h);
+	void(*frameDone)(unsigned int frame);
+	void(*exitLoop)();
+	unsigned int frameLimit;
 
 public:
-	GLWrapper(int width, int height, const char *title);
+	/* A headless wrapper opens an invisible window and renders into an
+	   offscreen target of width x height with 8x MSAA where supported */
+	GLWrapper(int width, int height, const char *title, bool headless = false);
 	~GLWrapper();
 
 	void setFPS(double fps) {
 		this->fps = fps;
 	}
 
+	/* How eventLoop() paces frames, at the rate given to setFPS() */
+	void setFramePacing(FramePacing mode) {
+		pacer.setMode(mode, fps);
+	}
+	void setIdleCallback(bool(*f)()) {
+		pacer.setIdleCallback(f);
+	}
+	FramePacer &framePacer() {
+		return pacer;
+	}
+
+	/* Stop eventLoop() after this many frames, 0 runs until the window closes */
+	void setFrameLimit(unsigned int frames) {
+		frameLimit = frames;
+	}
+
+	/* Called after each frame is drawn and, when headless, resolved, before
+	   buffers are swapped. The context is still current */
+	void setFrameCallback(void(*f)(unsigned int frame)) {
+		frameDone = f;
+	}
+
+	/* Called when eventLoop() ends, while the context still exists */
+	void setExitCallback(void(*f)()) {
+		exitLoop = f;
+	}
+
+	bool isHeadless() const {
+		return offscreen != NULL;
+	}
+	RenderTarget *offscreenTarget() {
+		return offscreen;
+	}
+
+	/* An invisible window whose context shares objects with the main one,
+	   to make current on another thread. Free it with glfwDestroyWindow */
+	GLFWwindow* createSharedContext();
+
 	void DisplayVersion();
 
 	/* Callback registering functions */
@@ -41,6 +91,7 @@ public:
 
 	/* Shader load and build support functions */
 	GLuint LoadShader(const char *vertex_path, const char *fragment_path);
+	GLuint LoadShader(const char *vertex_path, const char *geometry_path, const char *fragment_path);
 	GLuint BuildShader(GLenum eShaderType, const std::string &shaderText);
 	GLuint BuildShaderProgram(std::string vertShaderStr, std::string fragShaderStr);
 	std::string readFile(const char *filePath);
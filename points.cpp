@@ -5,6 +5,7 @@
  */
 
 #include "points.h"
+#include "gl_counters.h"
 #include "glm/gtc/random.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 
@@ -15,6 +16,8 @@ points::points(GLuint number, GLfloat dist, GLfloat sp)
 	maxdist = dist;
 	speed = sp;
 	angle_x = angle_y = angle_z = 0.f;
+	revision = 0;
+	revision_distance = 0.002f;
 }
 
 
@@ -23,6 +26,7 @@ points::~points()
 	delete[] colours;
 	delete[] vertices;
 	delete[] velocity;
+	delete[] revision_vertices;
 }
 
 void points::updateParams(GLfloat dist, GLfloat sp)
@@ -38,6 +42,7 @@ void  points::create()
 	colours = new glm::vec3[numpoints];
 	velocity = new glm::vec3[numpoints];
 	initial_direction = new glm::vec3[numpoints];
+	revision_vertices = new glm::vec3[numpoints];
 
 	/* Define random position and velocity */
 	for (int i = 0; i < numpoints; i++)
@@ -46,6 +51,7 @@ void  points::create()
 		colours[i] = glm::vec3(170.f/255, 213.f/255, 247.f/255);  // Set to snowflake colour
 		velocity[i] = glm::vec3(glm::linearRand(-0.01, 0.01), -glm::linearRand(0.005, 0.01), glm::linearRand(-0.01, 0.01));
 		initial_direction[i] = velocity[i];
+		revision_vertices[i] = vertices[i];
 	}
 
 	/* Create the vertex buffer object */
@@ -60,7 +66,7 @@ void  points::create()
 }
 
 
-void points::draw()
+void points::draw(GLuint count)
 {
 	/* Bind  vertices. Note that this is in attribute index 0 */
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
@@ -73,7 +79,7 @@ void points::draw()
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
 	/* Draw our points*/
-	glDrawArrays(GL_POINTS, 0, numpoints);
+	glDrawArrays(GL_POINTS, 0, (count && count < numpoints) ? count : numpoints);
 }
 
 
@@ -89,9 +95,22 @@ void points::animate()
 		else vertices[i] = vertices[i] * (maxdist / dist); // Stop snowflakes at maxdistance which should be the radius of the snowglobe
 	}
 
-	// Update the vertex buffer data
+	// Snowflakes resting on the globe only creep, which is not worth a new revision
+	GLfloat limit = revision_distance * revision_distance;
+	for (int i = 0; i < numpoints; i++)
+	{
+		glm::vec3 d = vertices[i] - revision_vertices[i];
+		if (glm::dot(d, d) > limit)
+		{
+			for (int j = 0; j < numpoints; j++) revision_vertices[j] = vertices[j];
+			revision++;
+			break;
+		}
+	}
+
+	// Update the vertex buffer data in place, the storage was sized in create()
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, numpoints * sizeof(glm::vec3), vertices, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, numpoints * sizeof(glm::vec3), vertices);
 }
 
 void points::updateAngle(GLfloat x, GLfloat y, GLfloat z, glm::mat4 rotation_matrix) {
@@ -15,7 +15,7 @@ public:
 	~points();
 
 	void create();
-	void draw();
+	void draw(GLuint count = 0);		// Draws the first count points, or all of them if 0
 	void animate();
 	void updateParams(GLfloat dist, GLfloat sp);
 	void updateAngle(GLfloat x, GLfloat y, GLfloat z, glm::mat4 model);
@@ -26,6 +26,14 @@ public:
 	glm::vec3 *initial_direction;
 
 	GLuint numpoints;		// Number of particles
+
+	// Incremented when any point has moved more than revision_distance
+	// since the last increment, so a cached shadow of the points is
+	// refreshed only once the movement would show
+	GLuint revision;
+	GLfloat revision_distance;
+	glm::vec3 *revision_vertices;
+
 	GLuint vertex_buffer;
 	GLuint colour_buffer;
 
@@ -1,60 +1,30 @@
-// Basic  fragment shader to add a 2D texture
+// Basic  fragment shader to add a texture from a 2D texture array
 
 #version 420
 
 // Ins
 in vec3 fposition, fnormal, flightdir;
-in vec4 fdiffusecolour, fambientcolour;
 in vec2 ftexcoord;
+in vec3 fworldpos;
+flat in int flayer;
 
 // Outs
 out vec4 outputColor;
 
 // Uniforms
-uniform mat4 model, view, projection;
-uniform mat3 normalmatrix;
-uniform uint colourmode, emitmode;
-uniform vec4 lightpos;
+#include "include/lighting.glsl"
+#include "include/shadows.glsl"
+#include "include/object_data.glsl"
 
-uniform sampler2D tex1;
-
-// Global constants
-vec4 specular_albedo = vec4(1.0,1.0,1.0,1.0);
-vec4 global_ambient = vec4(0.05, 0.05, 0.05, 1.0);
-float shininess = 8.0;
+uniform sampler2DArray tex1;		// Floor, wall and window images as layers
 
 void main()
 {
-	vec3 N = fnormal;
-	vec3 L = flightdir;
-	vec3 P = fposition;
-
-	vec4 position_h = vec4(fposition, 1.0);
-
-	// Calculate the diffuse component
-	vec4 diffuse = max(dot(N, L), 0.0) * fdiffusecolour;
-
-	// Calculate the specular component using Phong specular reflection
-	vec3 V = normalize(-P);	
-	vec3 R = reflect(-L, N);
-	vec4 specular = pow(max(dot(R, V), 0.0), shininess) * specular_albedo;
-
-	vec3 light_pos3 = lightpos.xyz;
-	float distanceToLight = length(light_pos3 - P);	// For attenuation
-
-	float attenuation;
-	float attenuation_k1 = 0.05;
-	float attenuation_k2 = 0.05;
-	float attenuation_k3 = 0.05;
-	attenuation = 1.0 / (attenuation_k1 + attenuation_k2*distanceToLight + 
-								attenuation_k3 * pow(distanceToLight, 2));
-
-	vec4 emissive = vec4(0); // Create a vec3(0, 0, 0) for our emmissive light
-	// If emitmode is 1 then we enable emmissive lighting
-	if (emitmode == 1) emissive = vec4(1.0, 1.0, 0.8, 1.0);
+	// Only the light's direct contribution is shadowed
+	float lit = receiveshadow == 1u ? shadowFactor(fworldpos) : 1.0;
 
-	vec4 fcolour = attenuation * (fambientcolour + diffuse + specular) + emissive + global_ambient;
+	vec4 fcolour = phong(fnormal, flightdir, fposition, lit);
 
-	vec4 texcolour = texture(tex1, ftexcoord);
+	vec4 texcolour = texture(tex1, vec3(ftexcoord, flayer));
 	outputColor = fcolour * texcolour;
-}
\ No newline at end of file
+}
@@ -1,4 +1,6 @@
 // Phong shading Blinn-Phong) vertex shader with pas through texture coordinates
+// The room quads are drawn as instances, each with its own transform and
+// texture array layer read from per-instance attributes
 
 #version 400
 
@@ -7,36 +9,31 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec3 texcoord;
 
+// Per-instance attributes
+layout(location = 3) in mat4 instance_model;
+layout(location = 7) in mat3 instance_normalmatrix;	// Model normal matrix, the view rotation is applied below
+layout(location = 10) in int instance_layer;
+
 // Uniform variables are passed in from the application
-uniform mat4 model, view, projection;
-uniform mat3 normalmatrix;
-uniform vec4 lightpos;
+#include "include/frame_data.glsl"
 
 // Output the vertex colour - to be rasterized into pixel fragments
 out vec4 fcolour;
 out vec3 fposition, fnormal, flightdir;
-out vec4 fdiffusecolour, fambientcolour;
 out vec2 ftexcoord;
+out vec3 fworldpos;
+flat out int flayer;
 
 void main()
 {
-	vec4 specular_colour = vec4(1.0,1.0,1.0,1.0);
-	vec4 diffuse_colour = vec4(0.5,0.5,0,1.0);
 	vec4 position_h = vec4(position, 1.0);
 	vec3 light_pos3 = lightpos.xyz;
 
-	float shininess = 8.0;
-
-	fdiffusecolour = diffuse_colour;
-
-	vec3 ambient = diffuse_colour.xyz * 0.5;
-
-	fambientcolour = vec4(ambient, 1.0);
-
-	// Define our vectors to calculate diffuse and specular lighting
-	mat4 mv_matrix = view * model;
-	vec4 P = mv_matrix * position_h;	// Modify the vertex position (x, y, z, w) by the model-view transformation
-	vec3 N = normalize(normalmatrix * normal);		// Modify the normals by the normal-matrix (i.e. to model-view (or eye) coordinates )
+	// Define our vectors to calculate diffuse and specular lighting, one
+	// matrix at a time so no matrix product is formed per vertex
+	vec4 worldpos = instance_model * position_h;
+	vec4 P = view * worldpos;	// Modify the vertex position (x, y, z, w) by the model-view transformation
+	vec3 N = normalize(mat3(view) * (instance_normalmatrix * normal));		// Modify the normals by the normal-matrix (i.e. to model-view (or eye) coordinates, the view is rigid)
 	vec3 L = normalize(light_pos3 - P.xyz);		// Calculate the vector from the light position to the vertex in eye space
 
 	flightdir = L;
@@ -44,8 +41,12 @@ void main()
 	fnormal = N;
 
 	// Define the vertex position
-	gl_Position = projection * view * model * position_h;
+	gl_Position = projection * P;
 
-	// Output the texture coordinates
+	// Output the texture coordinates and the layer of the room texture array
 	ftexcoord = texcoord.xy;
+	flayer = instance_layer;
+
+	// World position, located in the shadow map by the fragment shader
+	fworldpos = worldpos.xyz;
 }
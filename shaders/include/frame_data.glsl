@@ -0,0 +1,15 @@
+// Uniform block shared with the application (uniform_blocks.h)
+layout(std140) uniform FrameData
+{
+	mat4 view, projection;
+	vec4 lightpos;
+	uint colourmode;
+	uint shadows;
+	int pcfradius;
+	float shadowbias;
+	mat4 lightspace;
+	float shadowmapsize;
+	vec4 shadowlight;
+	vec4 clusterscale;		// Light clusters per pixel in x and y, slice = log(depth) * z + w
+	uvec4 clusterdims;		// Clusters in x, y and z, w is 0 when there are no point lights
+};
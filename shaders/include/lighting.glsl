@@ -0,0 +1,64 @@
+// Phong lighting from the point light, shared by the lit fragment shaders,
+// plus the small point lights of the fragment's cluster (light_clusters.h).
+// The surface's constants come from MaterialData. Define EMISSIVE for
+// objects that glow
+
+#include "frame_data.glsl"
+#include "material_data.glsl"
+
+uniform samplerBuffer lightdata;		// Eye space position and radius, then colour, per light
+uniform usamplerBuffer lightgrid;		// Offset and length of each cluster's list
+uniform usamplerBuffer lightindices;
+
+// Diffuse and specular light of the point lights binned into the cluster of
+// the fragment at P. Each fades out smoothly to nothing at its radius
+vec3 clusterLighting(vec3 N, vec3 P)
+{
+	vec3 colour = vec3(0.0);
+	if (clusterdims.w == 0u) return colour;
+
+	uvec2 tile = min(uvec2(gl_FragCoord.xy * clusterscale.xy), clusterdims.xy - 1u);
+	uint slice = uint(clamp(log(-P.z) * clusterscale.z + clusterscale.w, 0.0, float(clusterdims.z - 1u)));
+	uvec2 list = texelFetch(lightgrid, int((slice * clusterdims.y + tile.y) * clusterdims.x + tile.x)).xy;
+
+	vec3 V = normalize(-P);
+	for (uint i = 0u; i < list.y; i++)
+	{
+		int light = int(texelFetch(lightindices, int(list.x + i)).x);
+		vec4 sphere = texelFetch(lightdata, 2 * light);
+		vec3 D = sphere.xyz - P;
+		float d = length(D);
+		if (d >= sphere.w) continue;
+
+		vec3 L = D / d;
+		float falloff = 1.0 - d / sphere.w;
+		float diffuse = max(dot(N, L), 0.0);
+		float specular = pow(max(dot(reflect(-L, N), V), 0.0), attenuation.w);
+		colour += falloff * falloff * texelFetch(lightdata, 2 * light + 1).rgb *
+			(diffuse * diffusealbedo.rgb + specular * specularalbedo.rgb);
+	}
+	return colour;
+}
+
+// Eye space position P with normal N and direction L to the light. Only
+// the light's direct contribution is scaled by lit, the shadow factor
+vec4 phong(vec3 N, vec3 L, vec3 P, float lit)
+{
+	// Calculate the diffuse component
+	vec4 diffuse = max(dot(N, L), 0.0) * diffusealbedo;
+
+	// Calculate the specular component using Phong specular reflection
+	vec3 V = normalize(-P);
+	vec3 R = reflect(-L, N);
+	vec4 specular = pow(max(dot(R, V), 0.0), attenuation.w) * specularalbedo;
+
+	float distanceToLight = length(lightpos.xyz - P);	// For attenuation
+	float falloff = 1.0 / dot(attenuation.xyz, vec3(1.0, distanceToLight, distanceToLight * distanceToLight));
+
+	vec4 colour = falloff * (ambientalbedo + lit * (diffuse + specular)) + globalambient;
+	colour.rgb += clusterLighting(N, P);
+#ifdef EMISSIVE
+	colour += emissivecolour;
+#endif
+	return colour;
+}
@@ -0,0 +1,10 @@
+// Lighting constants of the surface being drawn (uniform_blocks.h)
+layout(std140) uniform MaterialData
+{
+	vec4 diffusealbedo;
+	vec4 ambientalbedo;
+	vec4 specularalbedo;
+	vec4 globalambient;
+	vec4 emissivecolour;	// Added by the EMISSIVE variants
+	vec4 attenuation;		// Constant, linear and quadratic falloff, then shininess
+};
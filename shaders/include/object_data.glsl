@@ -0,0 +1,11 @@
+// Per-draw uniform block shared with the application (uniform_blocks.h)
+layout(std140) uniform ObjectData
+{
+	mat4 model;
+	mat4 modelview;
+	mat4 mvp;				// projection * view * model
+	mat3 normalmatrix;		// Eye space
+	float alphaValue;
+	float size;
+	uint receiveshadow;
+};
@@ -0,0 +1,41 @@
+// Shadow map lookups shared by the shadow receiving fragment shaders
+
+#include "frame_data.glsl"
+
+uniform sampler2DShadow shadowmap;
+uniform samplerCubeShadow shadowcube;
+
+// Fraction of the (2 * pcfradius + 1)^2 shadow map lookups around the
+// fragment that see the light. Each lookup is itself a 2x2 filtered compare.
+// A cube map is compared by distance from the light, with the kernel laid
+// out across the direction to the fragment
+float shadowFactor(vec3 worldpos)
+{
+	if (shadows == 0u) return 1.0;
+
+	float lit = 0.0;
+	float n = float(2 * pcfradius + 1);
+	if (shadows == 2u)
+	{
+		vec3 d = worldpos - shadowlight.xyz;
+		float ref = length(d) / shadowlight.w - shadowbias;
+		vec3 t = normalize(cross(d, abs(d.y) < 0.99 * length(d) ? vec3(0, 1, 0) : vec3(1, 0, 0)));
+		vec3 b = normalize(cross(d, t));
+		float texel = 2.0 * length(d) / shadowmapsize;
+		for (int y = -pcfradius; y <= pcfradius; y++)
+			for (int x = -pcfradius; x <= pcfradius; x++)
+				lit += texture(shadowcube, vec4(d + (float(x) * t + float(y) * b) * texel, ref));
+		return lit / (n * n);
+	}
+
+	vec4 shadowcoord = lightspace * vec4(worldpos, 1.0);
+	if (shadowcoord.w <= 0.0) return 1.0;
+
+	vec3 coord = shadowcoord.xyz / shadowcoord.w;
+	coord.z -= shadowbias;
+	float texel = 1.0 / shadowmapsize;
+	for (int y = -pcfradius; y <= pcfradius; y++)
+		for (int x = -pcfradius; x <= pcfradius; x++)
+			lit += texture(shadowmap, vec3(coord.xy + vec2(x, y) * texel, coord.z));
+	return lit / (n * n);
+}
@@ -0,0 +1,7 @@
+// Occlusion query proxy, colour and depth writes are masked off
+
+#version 400
+
+void main()
+{
+}
@@ -0,0 +1,14 @@
+// Bounding box of a packet drawn inside an occlusion query. ObjectData
+// holds the box's model matrix, nothing but the depth test matters
+
+#version 400
+
+layout(location = 0) in vec3 position;
+
+#include "include/frame_data.glsl"
+#include "include/object_data.glsl"
+
+void main()
+{
+	gl_Position = mvp * vec4(position, 1.0);
+}
@@ -9,12 +9,11 @@ layout(location = 1) in vec3 colour;
 
 
 // Uniform variables are passed in from the application
-uniform mat4 model, view, projection;
-uniform uint colourmode;
+#include "include/frame_data.glsl"
+#include "include/object_data.glsl"
 
 // Output the vertex colour - to be rasterized into pixel fragments
 out vec4 fcolour;
-uniform float size;
 
 void main()
 {
@@ -26,7 +25,7 @@ void main()
 	fcolour = colour_h;
 
 	// Define the vertex position
-	gl_Position = projection * view * model * pos;
+	gl_Position = mvp * pos;
 
 	gl_PointSize = (1.0 + pos2.z / 2 * pos2.w) * size;
 //	gl_PointSize = 2.0 * size;
@@ -0,0 +1,13 @@
+// Writes the distance from the light, divided by the far plane, into the
+// cube shadow map so the receivers can compare distances in any direction
+
+#version 400
+
+in vec3 fworld;
+
+#include "include/frame_data.glsl"
+
+void main()
+{
+	gl_FragDepth = length(fworld - shadowlight.xyz) / shadowlight.w;
+}
@@ -0,0 +1,15 @@
+// Cube shadow map depth of the particles, rounded off to discs
+
+#version 400
+
+in vec3 fworld;
+
+#include "include/frame_data.glsl"
+
+void main()
+{
+	vec2 d = gl_PointCoord - vec2(0.5);
+	if (dot(d, d) > 0.25) discard;
+
+	gl_FragDepth = length(fworld - shadowlight.xyz) / shadowlight.w;
+}
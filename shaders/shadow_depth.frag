@@ -0,0 +1,7 @@
+// Depth-only fragment shader for the shadow pass, only the depth is written
+
+#version 400
+
+void main()
+{
+}
@@ -0,0 +1,10 @@
+// Depth-only fragment shader for the particles in the shadow pass,
+// rounds the square points off to discs
+
+#version 400
+
+void main()
+{
+	vec2 d = gl_PointCoord - vec2(0.5);
+	if (dot(d, d) > 0.25) discard;
+}
@@ -0,0 +1,23 @@
+// Depth-only vertex shader for the particles in the shadow pass.
+// Each point covers the same world space size as a snowflake, whatever the
+// shadow map resolution
+
+#version 400
+
+layout(location = 0) in vec3 position;
+
+#include "include/frame_data.glsl"
+#include "include/object_data.glsl"
+
+// Diameter of a snowflake in world units
+const float flake_size = 0.02;
+
+out vec3 gworld;
+
+void main()
+{
+	vec4 position_h = vec4(position, 1.0);
+	gworld = (model * position_h).xyz;
+	gl_Position = mvp * position_h;
+	gl_PointSize = max(flake_size * projection[1][1] * 0.5 * shadowmapsize / gl_Position.w, 1.0);
+}
@@ -0,0 +1,26 @@
+// Depth-only vertex shader for the static meshes in the shadow pass.
+// Reads the model matrix of each draw from the draw data buffer like
+// static_mesh.vert, FrameData holds the light's view and projection.
+// For a cube map the geometry shader projects the world position instead
+
+#version 400
+
+layout(location = 0) in vec3 position;
+layout(location = 4) in uint drawindex;
+
+#include "include/frame_data.glsl"
+
+uniform samplerBuffer drawdata;
+
+out vec3 gworld;
+
+void main()
+{
+	int base = int(drawindex) * 7;
+	mat4 model = mat4(texelFetch(drawdata, base), texelFetch(drawdata, base + 1),
+		texelFetch(drawdata, base + 2), texelFetch(drawdata, base + 3));
+
+	vec4 world = model * vec4(position, 1.0);
+	gworld = world.xyz;
+	gl_Position = projection * (view * world);
+}
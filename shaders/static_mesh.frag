@@ -0,0 +1,32 @@
+/** Fragment shader with Phong shading for the static meshes drawn by one
+* indirect call, textured from a layer of the object texture array
+*/
+
+#version 400
+
+// Ins
+in vec3 fposition, fnormal, flightdir;
+in vec2 ftexcoord;
+in vec3 fworldpos;
+flat in float flayer;
+flat in float freceiveshadow;
+
+// Outs
+out vec4 outputColor;
+
+// Uniforms
+#include "include/lighting.glsl"
+#include "include/shadows.glsl"
+
+uniform sampler2DArray tex1;
+
+void main()
+{
+	// Only the light's direct contribution is shadowed
+	float lit = freceiveshadow > 0.5 ? shadowFactor(fworldpos) : 1.0;
+
+	vec4 fcolour = phong(fnormal, flightdir, fposition, lit);
+
+	vec4 texcolour = texture(tex1, vec3(ftexcoord, flayer));
+	outputColor = fcolour * texcolour;
+}
@@ -0,0 +1,65 @@
+/** Vertex shader with Phong shading for the static meshes drawn by one
+* indirect call. Each draw reads its model matrix, texture layer and shadow
+* flag from the draw data buffer (mesh_arena.h); the material values are in
+* the MaterialData block shared by the whole call
+*/
+
+#version 400
+
+// These are the vertex attributes, laid out by MeshArena (colour is 1)
+layout(location = 0) in vec3 position;
+layout(location = 2) in vec3 normal;
+layout(location = 3) in vec2 texcoord;
+layout(location = 4) in uint drawindex;
+
+#include "include/frame_data.glsl"
+
+// Seven texels per draw: model matrix columns, then eye space normal matrix
+// columns with the layer, padding and whether the draw receives shadows in w
+uniform samplerBuffer drawdata;
+
+// Output the vertex colour - to be rasterized into pixel fragments
+out vec4 fcolour;
+out vec3 fposition, fnormal, flightdir;
+out vec2 ftexcoord;
+out vec3 fworldpos;
+flat out float flayer;
+flat out float freceiveshadow;
+
+
+void main()
+{
+	int base = int(drawindex) * 7;
+	mat4 model = mat4(texelFetch(drawdata, base), texelFetch(drawdata, base + 1),
+		texelFetch(drawdata, base + 2), texelFetch(drawdata, base + 3));
+	vec4 normal0 = texelFetch(drawdata, base + 4);
+	vec4 normal1 = texelFetch(drawdata, base + 5);
+	vec4 normal2 = texelFetch(drawdata, base + 6);
+	mat3 normalmatrix = mat3(normal0.xyz, normal1.xyz, normal2.xyz);
+
+	vec4 position_h = vec4(position, 1.0);
+	vec3 light_pos3 = lightpos.xyz;
+
+	// Define our vectors to calculate diffuse and specular lighting. The
+	// position is carried through one matrix at a time, so no matrix
+	// product is formed per vertex
+	vec4 worldpos = model * position_h;
+	vec4 P = view * worldpos;	// Modify the vertex position (x, y, z, w) by the model-view transformation
+	vec3 N = normalize(normalmatrix * normal);		// Modify the normals by the normal-matrix (i.e. to model-view (or eye) coordinates )
+	vec3 L = normalize(light_pos3 - P.xyz);		// Calculate the vector from the light position to the vertex in eye space
+
+	flightdir = L;
+	fposition = P.xyz;
+	fnormal = N;
+
+	// Define the vertex position
+	gl_Position = projection * P;
+
+	// Output the texture coordinates, layer and shadow flag of this draw
+	ftexcoord = texcoord.xy;
+	flayer = normal0.w;
+	freceiveshadow = normal2.w;
+
+	// World position, located in the shadow map by the fragment shader
+	fworldpos = worldpos.xyz;
+}
@@ -27,6 +27,25 @@ if you prefer */
 // Include our sphere and object loader classes
 #include "tiny_loader.h"
 #include "sphere_tex.h"
+#include "asset_loader.h"
+#include "texture_cache.h"
+#include "static_geometry.h"
+#include "gl_counters.h"
+#include "shader.h"
+#include "render_queue.h"
+#include "mesh_arena.h"
+#include "mesh_cache.h"
+#include "shadow_map.h"
+#include "frustum.h"
+#include "frame_profiler.h"
+#include "render_target.h"
+#include "frame_capture.h"
+#include "bench_script.h"
+#include "program_builder.h"
+#include "shader_reloader.h"
+#include "light_clusters.h"
+#include <cstring>
+#include <chrono>
 
 /* Include the image loader */
 #define STB_IMAGE_IMPLEMENTATION
@@ -34,51 +53,19 @@ if you prefer */
 
 #include "points.h"
 
-// Custom Shader class that holds unform IDs
-class Shader {
-public:
-	GLuint shaderID;
-	GLuint modelID;
-	GLuint colourmodeID;
-	GLuint viewID;
-	GLuint projectionID;
-	GLuint alphaValueID;
-	GLuint point_sizeID;
-	GLuint lightposID;
-	GLuint normalmatrixID;
-	GLuint emitmodeID;
-	//GLuint tex_matrixID;
-
-	Shader() {
-	
-	}
-
-	Shader(GLuint shaderID) {
-		printf("Creating shader object\n");
-		this->shaderID = shaderID;
-		this->modelID = glGetUniformLocation(shaderID, "model");
-		this->colourmodeID = glGetUniformLocation(shaderID, "colourmode");
-		this->viewID = glGetUniformLocation(shaderID, "view");
-		this->projectionID = glGetUniformLocation(shaderID, "projection");
-		this->alphaValueID = glGetUniformLocation(shaderID, "alphaValue");
-
-		this->point_sizeID = glGetUniformLocation(shaderID, "size");
-
-		this->lightposID = glGetUniformLocation(shaderID, "lightpos");
-		this->normalmatrixID = glGetUniformLocation(shaderID, "normalmatrix");
-
-		this->emitmodeID = glGetUniformLocation(shaderID, "emitmode");
-
-		//this->tex_matrixID = glGetUniformLocation(shaderID, "tex_matrix");
-
-		GLuint loc = glGetUniformLocation(shaderID, "tex1");
-		if (loc >= 0) glUniform1i(loc, 0);
-	}
-};
-
 Shader * program;		/* Identifier for the shader prgoram */
-GLuint const NUM_OF_SHADERS = 5;
+GLuint const NUM_OF_SHADERS = 10;
 Shader shaders[NUM_OF_SHADERS];
+GLuint shader_programs[NUM_OF_SHADERS];	// ProgramBuilder index of each of shaders
+
+/* Linked program binaries are cached here, --no-shader-cache disables it */
+const char *shader_cache_dir = "shader_cache";
+
+/* With --hot-reload, programs are rebuilt in the background when their files
+   are saved and swapped in at the start of the next frame */
+ProgramBuilder *shader_builder;
+ShaderReloader *shader_reloader = NULL;
+bool hot_reload = false;
 
 GLuint vao;			/* Vertex array (Containor) object. This is the index of the VAO that will be the container for
 					   our buffer objects */
@@ -86,7 +73,6 @@ GLuint vao;			/* Vertex array (Containor) object. This is the index of the VAO t
 GLuint colourmode;	/* Index of a uniform to switch the colour mode in the vertex shader
 					  I've included this to show you how to pass in an unsigned integer into
 					  your vertex shader. */
-GLuint emitmode;
 
 /* Position and view globals */
 GLfloat angle_x, angle_inc_x, x, scaler, z, y;
@@ -104,13 +90,33 @@ GLuint alphaValueID;
 GLfloat point_sizeID;
 
 GLfloat aspect_ratio;		/* Aspect ratio of the window defined in the reshape callback*/
+GLfloat viewport_height;	/* Window height in pixels, used to pick mesh levels of detail */
+GLfloat viewport_width;
 
 TinyObjLoader lamppost, table;			// This is an instance of our basic object loaded
 Sphere aSphere(false);		// Create our sphere with no texture coordinates because they aren't handled in the shaders for this example
 
 /* Define textureID*/
-GLuint const NUM_OF_TEXTURES = 6;
-GLuint texID, particle_texID, floor_texID, back_wall_texID, table_texID, window_texID;
+GLuint const NUM_OF_TEXTURES = 2;
+GLuint texID, particle_texID;
+const GLchar* texture_filenames[] = { "images\\glass1.jpg", "images\\snowflake2.png" };
+
+/* Textures of the static meshes, selected per draw by layer */
+GLuint const NUM_OF_OBJECT_LAYERS = 2;
+GLuint const LAMPPOST_LAYER = 0, TABLE_LAYER = 1;
+GLuint object_texID;
+const GLchar* object_texture_filenames[] = { "images\\glass1.jpg", "images\\wood_table_1.jpg" };
+
+/* The static room textures share one texture array, one layer each */
+GLuint const NUM_OF_ROOM_LAYERS = 3;
+GLuint const ROOM_LAYER_SIZE = 1024;
+GLuint const FLOOR_LAYER = 0, WALL_LAYER = 1, WINDOW_LAYER = 2;
+GLuint room_texID;
+const GLchar* room_texture_filenames[] = { "images\\wooden_plank_2.jpg", "images\\wooden_plank_3.jpg", "images\\old_house_window.jpg" };
+
+/* Loads textures and objects in the background, uploads are spread over frames */
+AssetLoader* assets;
+GLdouble const UPLOAD_BUDGET_MS = 2.0;
 
 /* Point sprite object and adjustable parameters */
 points* point_anim;
@@ -118,7 +124,111 @@ GLfloat speed;
 GLfloat maxdist;
 GLfloat point_size;		// Used to adjust point size in the vertex shader
 
-GLuint floor_vbo, back_wall_vbo, side_wall_vbo, window_vbo;
+/* Floor, back wall, side wall and window are instances of the same quad */
+StaticGeometry room;
+
+/* Counters of the last complete frame, printed with G */
+GLCallCounters last_frame_calls;
+
+/* Every object in the scene owns one packet in the render queue */
+RenderQueue render_queue;
+GLuint light_packet, static_packet, particle_packet, room_packet, globe_packet;
+
+/* Cube shadow map around the point light in the globe, or with --spot-shadows
+   a single map looking down from it. The map is only redrawn when the light
+   or a caster moves. Only one particle in SHADOW_PARTICLE_DIVISOR is drawn into it */
+ShadowMap shadow_map;
+bool cube_shadows = true;
+GLuint shadow_map_size = 0;		// 0 picks the default of the shadow map type
+GLint shadow_pcf_radius = 1;
+GLuint const SHADOW_PARTICLE_DIVISOR = 4;
+
+/* --bench-shadows: once the assets are loaded, time bench_shadow_frames frames
+   that redraw the shadow map, then as many that reuse it. The particles are
+   frozen so that the scene really is static */
+GLuint bench_shadow_frames = 0;
+GLuint const BENCH_WARMUP_FRAMES = 10;
+
+/* Fairy lights strung along the back and side walls, lit through light
+   clusters so each pixel only shades the few that reach it. --lights sets
+   how many, up to LightClusters::MAX_LIGHTS, and 0 turns them off */
+LightClusters light_clusters;
+std::vector<PointLight> fairy_lights;
+GLuint num_fairy_lights = 48;
+GLuint twinkle_frame = 0;		// Frames drawn while the scene was not idle
+glm::vec3 const FAIRY_COLOURS[] = { glm::vec3(1.f, 0.2f, 0.1f), glm::vec3(0.2f, 1.f, 0.3f), glm::vec3(0.2f, 0.4f, 1.f),
+	glm::vec3(1.f, 0.8f, 0.2f) };
+
+/* --occlusion-queries: the light marker, particles and globe are drawn only
+   if their bounding boxes pass the depth test against the room and table */
+bool occlusion_queries = false;
+
+/* Frame pacing, chosen with --pacing and --fps. In adaptive mode the loop
+   drops to a few frames a second while the snow is paused (S), the globe
+   is not spinning and no assets are loading. F prints the frame times */
+FramePacing frame_pacing = FRAME_PACING_ADAPTIVE;
+double target_fps = 60;
+bool snow_paused = false;
+FramePacer *frame_pacer;
+
+/* CPU and GPU time of each part of the frame, switched on with --profile
+   and printed with H */
+FrameProfiler profiler;
+GLuint asset_zone, animation_zone, shadow_pass_zone, light_binning_zone;
+
+/* --headless [frames]: render the given number of frames offscreen with no
+   visible window and exit. --output saves the last frame as a PPM image.
+   Headless, benchmark and input playback runs are deterministic: the
+   particles are seeded with DETERMINISTIC_SEED and every asset is loaded
+   before the first frame, so each run draws the same frames */
+GLuint headless_frames = 0;
+const char *headless_output = NULL;
+bool deterministic = false;
+unsigned int const DETERMINISTIC_SEED = 1;
+RenderTarget *offscreen_target;
+GLuint frame_number = 0;
+GLuint frame_limit = 0;			// 0 runs until the window is closed
+
+/* --capture file and --capture-pipe command record every frame, see
+   frame_capture.h. A capture file ending in .yuv is an I420 stream, .rgba a
+   raw RGBA stream and anything else a printf pattern for QOI images.
+   --size WxH sets the window or headless frame size */
+FrameCapture frame_capture;
+const char *capture_target = NULL;
+bool capture_pipe = false;
+int frame_width = 1024, frame_height = 768;
+
+/* --benchmark [timeline]: play a timeline of camera, globe and particle
+   settings (see bench_script.h) for --frames frames, or the timeline's
+   length, and write the frame times and profiler zones as JSON to --json
+   or stdout. The first BENCH_WARMUP_FRAMES frames are not measured.
+   Channels: vx vy vz step_back angle_x angle_y angle_z angle_inc_x
+   angle_inc_y angle_inc_z light_x light_y light_z particles.
+   --record-input and --play-input save and replay key presses by frame */
+bool benchmark = false;
+const char *bench_timeline_file = NULL;
+const char *bench_json = NULL;
+GLuint bench_frames = 0;
+Timeline bench_timeline;
+InputLog input_log;
+const char *record_input = NULL;
+const char *play_input = NULL;
+GLFWwindow *main_window;
+GLuint particle_count = 0;		// Particles drawn, 0 draws them all
+
+/* Orbit the globe, move in and out and thin the snow, 20 s at 60 fps */
+const char *DEFAULT_TIMELINE =
+	"0    vx=0   vy=0   step_back=0    angle_y=0   particles=1000\n"
+	"300  vx=-20 vy=180 step_back=1.5  angle_y=90\n"
+	"600  vx=-35 vy=360 step_back=-0.5 angle_y=180 particles=1000\n"
+	"900  vx=0   vy=540 step_back=2    angle_y=270 particles=250\n"
+	"1199 vx=0   vy=720 step_back=0    angle_y=360 particles=1000\n";
+
+/* Lamppost and table share one mesh arena and are drawn by one indirect call */
+MeshArena static_meshes;
+IndirectBatch static_batch;
+GLuint const NO_DRAW = (GLuint)-1;
+GLuint lamppost_draw = NO_DRAW, table_draw = NO_DRAW;
 
 //GLfloat * quad_data;
 // Create data for our quad with vertices, normals and texturee coordinates 
@@ -153,78 +263,20 @@ GLfloat floor_data[] = {
 using namespace std;
 using namespace glm;
 
-// Calculate shadow projection matrix from Light pos (or direction)
-// and the plane equatino coefficients.
-// This matrix works both for direction and positional lights.
-mat4 shadow_matrix(vec4 L, vec4 P)
-{
-	//dot product of normal and light position/direction
-	GLfloat rdotl = P.x * L.x + P.y * L.y + P.z * L.z + P.w * L.w;
-
-	// Define the shadow projection matix
-	return mat4(-P.x * L.x + rdotl,
-		-P.x * L.y,
-		-P.x * L.z,
-		-P.x * L.w,
-		-P.y * L.x,
-		-P.y * L.y + rdotl,
-		-P.y * L.z,
-		-P.y * L.w,
-		-P.z * L.x,
-		-P.z * L.y,
-		-P.z * L.z + rdotl,
-		-P.z * L.w,
-		-P.w * L.x,
-		-P.w * L.y,
-		-P.w * L.z,
-		-P.w * L.w + rdotl);
-}
-
-/**
-*Uses stb_image.h to loadand imageand create a texture from it
-*/
-bool load_texture(const char* filename, GLuint& texID, bool bGenMipmaps, bool flip = true)
+/* Phong lighting constants of a surface whose ambient response is half its
+   diffuse colour. The constant, linear and quadratic falloff are all k */
+static MaterialUniforms phongMaterial(const vec3 &diffuse, GLfloat k)
 {
-	glGenTextures(1, &texID);
-	// local image parameters
-	int width, height, nrChannels;
-
-	stbi_set_flip_vertically_on_load(flip);
-
-	/* load an image file using stb_image */
-	unsigned char* data = stbi_load(filename, &width, &height, &nrChannels, 0);
-
-	// check for an error during the load process
-	if (data)
-	{
-		// Note: this is not a full check of all pixel format types, just the most common two!
-		int pixel_format = 0;
-		if (nrChannels == 3)
-			pixel_format = GL_RGB;
-		else
-			pixel_format = GL_RGBA;
-
-		// Bind the texture ID before the call to create the texture.
-			// texID[i] will now be the identifier for this specific texture
-		glBindTexture(GL_TEXTURE_2D, texID);
-
-		// Create the texture, passing in the pointer to the loaded image pixel data
-		glTexImage2D(GL_TEXTURE_2D, 0, pixel_format, width, height, 0, pixel_format, GL_UNSIGNED_BYTE, data);
-
-		// Generate Mip Maps
-		if (bGenMipmaps)
-			glGenerateMipmap(GL_TEXTURE_2D);
-	}
-	else
-	{
-		printf("stb_image  loading error: filename=%s", filename);
-		return false;
-	}
-	stbi_image_free(data);
-	return true;
+	MaterialUniforms material;
+	material.diffuse = vec4(diffuse, 1.f);
+	material.ambient = vec4(diffuse * 0.5f, 1.f);
+	material.specular = vec4(1.f);
+	material.globalAmbient = vec4(0.05f, 0.05f, 0.05f, 1.f);
+	material.emissive = vec4(1.f, 1.f, 0.8f, 1.f);
+	material.attenuation = vec4(k, k, k, 8.f);
+	return material;
 }
 
-
 /*
 This function is called before entering the main rendering loop.
 Use it for all your initialisation stuff
@@ -241,15 +293,17 @@ void init(GLWrapper *glw)
 	vx = vy = vz = 0;
 	scaler = 1.f;
 	aspect_ratio = 1.3333f;
+	viewport_height = 768.f;
+	viewport_width = 1024.f;
 	colourmode = 0;
 	alphaValue = 0.4;
 	step_back = 0.f;
-	emitmode = 0;
 
 	// Set point parameters
 	speed = 0.5f;
 	maxdist = 0.162f; ;
 	point_anim = new points(1000, maxdist, speed);
+	if (deterministic) srand(DETERMINISTIC_SEED);
 	point_anim->create();
 	point_size = 15;
 	
@@ -259,29 +313,28 @@ void init(GLWrapper *glw)
 	// Create the vertex array object and make it current
 	glBindVertexArray(vao);
 
-	lamppost.load_obj("obj\\lamp_post_4.obj");
+	// Objects and textures are parsed and decoded on worker threads and
+	// uploaded from display(), so the first frame does not wait for them
+	assets = new AssetLoader();
+
+	assets->submit([]() { lamppost.parse_obj("obj\\lamp_post_4.obj"); },
+		[]() { lamppost_draw = static_batch.add(static_meshes, lamppost.addToArena(static_meshes)); static_meshes.upload(); });
 	lamppost.overrideColour(vec4(0.8f, 0.8f, 0.8f, 1.f));
 
-	table.load_obj("obj\\table_with_tex.obj");
+	assets->submit([]() { table.parse_obj("obj\\table_with_tex.obj"); },
+		[]() { table_draw = static_batch.add(static_meshes, table.addToArena(static_meshes)); static_meshes.upload(); });
 	table.overrideColour(vec4(0.8f, 0.8f, 0.8f, 1.f));
 
-	// Creater the sphere (params are num_lats and num_longs)
-	aSphere.makeSphere(60, 60);
+	// Create the sphere as a level 4 icosphere (5120 triangles) from the compile time table
+	aSphere.makeIcosphere(4);
 
-	GLuint* textures[] = { &texID, &particle_texID, &floor_texID, &back_wall_texID, &table_texID, &window_texID};
-	const GLchar* texture_filenames[] = { "images\\glass1.jpg", "images\\snowflake2.png", "images\\wooden_plank_2.jpg", "images\\wooden_plank_3.jpg", "images\\wood_table_1.jpg", "images\\old_house_window.jpg" };
+	// Each texture shows a grey placeholder until its image has been decoded
+	GLuint* textures[] = { &texID, &particle_texID };
 	for (int i = 0; i < NUM_OF_TEXTURES; i++) {
-		if (!load_texture(texture_filenames[i], *textures[i], true, false))
-		{
-			cout << "Fatal error loading texture: " << endl;
-			exit(0);
-		}
+		assets->loadTexture(texture_filenames[i], *textures[i], true, false);
 	}
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);	
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	assets->loadTextureArray(room_texture_filenames, NUM_OF_ROOM_LAYERS, room_texID, ROOM_LAYER_SIZE);
+	assets->loadTextureArray(object_texture_filenames, NUM_OF_OBJECT_LAYERS, object_texID, ROOM_LAYER_SIZE);
 
 	// Enable gl_PointSize
 	glEnable(GL_PROGRAM_POINT_SIZE);
@@ -289,11 +342,23 @@ void init(GLWrapper *glw)
 	/* Load and build the vertex and fragment shaders */
 	try
 	{
-		shaders[0] = Shader(glw->LoadShader("shaders\\lamppost.vert", "shaders\\lamppost.frag"));
-		shaders[1] = Shader(glw->LoadShader("shaders\\glass.vert", "shaders\\glass.frag"));
-		shaders[2] = Shader(glw->LoadShader("shaders\\point_sprites.vert", "shaders\\point_sprites.frag"));
-		shaders[3] = Shader(glw->LoadShader("shaders\\floor.vert", "shaders\\floor.frag"));
-		shaders[4] = Shader(glw->LoadShader("shaders\\shadow_matrix.vert", "shaders\\shadow_matrix.frag"));
+		// All programs are compiled together, or loaded from the binary cache
+		shader_builder = new ProgramBuilder(glw, shader_cache_dir);
+		ProgramBuilder &builder = *shader_builder;
+		shader_programs[0] = builder.add("shaders\\static_mesh.vert", NULL, "shaders\\static_mesh.frag");
+		shader_programs[1] = builder.add("shaders\\glass.vert", NULL, "shaders\\glass.frag", "TEXTURED ALPHA");
+		shader_programs[2] = builder.add("shaders\\point_sprites.vert", NULL, "shaders\\point_sprites.frag");
+		shader_programs[3] = builder.add("shaders\\floor.vert", NULL, "shaders\\floor.frag");
+		shader_programs[4] = builder.add("shaders\\shadow_static.vert", NULL, "shaders\\shadow_depth.frag");
+		shader_programs[5] = builder.add("shaders\\shadow_points.vert", NULL, "shaders\\shadow_points.frag");
+		shader_programs[6] = builder.add("shaders\\shadow_static.vert", "shaders\\shadow_cube.geom", "shaders\\shadow_cube.frag");
+		shader_programs[7] = builder.add("shaders\\shadow_points.vert", "shaders\\shadow_cube_points.geom", "shaders\\shadow_cube_points.frag");
+		shader_programs[8] = builder.add("shaders\\occlusion_proxy.vert", NULL, "shaders\\occlusion_proxy.frag");
+		shader_programs[9] = builder.add("shaders\\glass.vert", NULL, "shaders\\glass.frag", "TEXTURED EMISSIVE");
+		builder.build();
+		builder.report();
+		for (GLuint i = 0; i < NUM_OF_SHADERS; i++) shaders[i] = Shader(builder.program(shader_programs[i]));
+		if (hot_reload) shader_reloader = new ShaderReloader(glw, shader_builder);
 	}
 	catch (exception& e)
 	{
@@ -305,11 +370,164 @@ void init(GLWrapper *glw)
 	// Set first shader as default
 	program = &shaders[0];
 
-	// Create our quad and texture
-	glGenBuffers(1, &floor_vbo);
-	glGenBuffers(1, &back_wall_vbo);
-	glGenBuffers(1, &side_wall_vbo);
-	glGenBuffers(1, &window_vbo);
+	// Add the scene to the render queue. Packets are retained, display() only
+	// updates their transforms. The particles are added before the globe so
+	// they stay behind it when both are at the same depth
+	GLuint glass_material = render_queue.addMaterial(phongMaterial(vec3(0.5f, 0.5f, 0.5f), 0.1f));
+	GLuint static_material = render_queue.addMaterial(phongMaterial(vec3(0.5f, 0.5f, 0.2f), 0.05f));
+	GLuint room_material = render_queue.addMaterial(phongMaterial(vec3(0.5f, 0.5f, 0.f), 0.05f));
+
+	DrawPacket packet;
+	packet.pipeline = &shaders[9];		// The emissive variant of the glass program
+	packet.material = glass_material;
+	packet.textureTarget = GL_TEXTURE_2D;
+	packet.texture = texID;
+	packet.draw = []() { aSphere.drawSphere(drawmode); };
+	packet.centre = aSphere.boundCentre;
+	packet.radius = aSphere.boundRadius;
+	packet.occlusionTest = true;
+	packet.profileZone = profiler.addZone("light marker");
+	light_packet = render_queue.add(packet);
+
+	packet = DrawPacket();
+	packet.pipeline = &shaders[0];
+	packet.material = static_material;
+	packet.textureTarget = GL_TEXTURE_2D_ARRAY;
+	packet.texture = object_texID;
+	packet.draw = []()
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, drawmode == 1 ? GL_LINE : GL_FILL);
+		static_batch.draw(static_meshes, drawmode == 2 ? GL_POINTS : GL_TRIANGLES);
+		glBindVertexArray(vao);
+	};
+	packet.castsShadow = true;
+	packet.receivesShadow = true;
+	packet.shadowPipeline = cube_shadows ? &shaders[6] : &shaders[4];
+	packet.drawShadow = []()
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		static_batch.draw(static_meshes, GL_TRIANGLES, false);
+		glBindVertexArray(vao);
+	};
+	packet.profileZone = profiler.addZone("lamppost, table");
+	packet.shadowProfileZone = profiler.addZone("static shadows");
+	static_packet = render_queue.add(packet);
+
+	packet = DrawPacket();
+	packet.pipeline = &shaders[3];
+	packet.material = room_material;
+	packet.textureTarget = GL_TEXTURE_2D_ARRAY;
+	packet.texture = room_texID;
+	packet.draw = []() { room.draw(); glBindVertexArray(vao); };
+	packet.receivesShadow = true;
+	packet.profileZone = profiler.addZone("room");
+	room_packet = render_queue.add(packet);
+
+	packet = DrawPacket();
+	packet.pipeline = &shaders[2];
+	packet.textureTarget = GL_TEXTURE_2D;
+	packet.texture = particle_texID;
+	packet.transparent = true;
+	packet.draw = []() { point_anim->draw(particle_count); };
+	packet.castsShadow = true;
+	packet.shadowPipeline = cube_shadows ? &shaders[7] : &shaders[5];
+	packet.drawShadow = []()
+	{
+		GLuint count = (particle_count && particle_count < point_anim->numpoints) ? particle_count : point_anim->numpoints;
+		point_anim->draw(max(count / SHADOW_PARTICLE_DIVISOR, 1u));
+	};
+	packet.radius = point_anim->maxdist;
+	packet.occlusionTest = true;
+	packet.profileZone = profiler.addZone("particles");
+	packet.shadowProfileZone = profiler.addZone("particle shadows");
+	particle_packet = render_queue.add(packet);
+
+	packet = DrawPacket();
+	packet.pipeline = &shaders[1];
+	packet.material = glass_material;
+	packet.textureTarget = GL_TEXTURE_2D;
+	packet.texture = texID;
+	packet.transparent = true;
+	packet.draw = []() { aSphere.drawSphere(drawmode); };
+	packet.centre = aSphere.boundCentre;
+	packet.radius = aSphere.boundRadius;
+	packet.occlusionTest = true;
+	packet.profileZone = profiler.addZone("glass");
+	globe_packet = render_queue.add(packet);
+
+	// Create the room once: the quad and each instance's transform never change
+	vector<StaticInstance> room_instances(4);
+	GLint room_layers[] = { FLOOR_LAYER, WALL_LAYER, WALL_LAYER, WINDOW_LAYER };
+
+	mat4 model = mat4(1.0f);
+	model = translate(model, vec3(-1.3f, -3.f, 0.7f));
+	room_instances[0].model = scale(model, vec3(1.4f, 1.0f, 1.f));
+
+	model = mat4(1.0f);
+	model = translate(model, vec3(-1.3f, -0.3f, -2.f));	
+	model = rotate(model, -radians(-90.f), vec3(1, 0, 0)); 
+	room_instances[1].model = scale(model, vec3(1.4f, 1.0f, 1.f));
+
+	model = mat4(1.0f);
+	model = translate(model, vec3(2.5f, -0.3f, 0.7f));
+	model = rotate(model, -radians(-90.f), vec3(0, 1, 0));
+	model = rotate(model, -radians(-90.f), vec3(1, 0, 0));
+	room_instances[2].model = scale(model, vec3(1.f, 1.f, 1.f));
+
+	model = mat4(1.0f);
+	model = translate(model, vec3(2.499f, 0.5f, 0.7f));
+	model = rotate(model, -radians(-90.f), vec3(0, 1, 0));
+	model = rotate(model, -radians(-90.f), vec3(1, 0, 0));
+	room_instances[3].model = scale(model, vec3(0.6f, 0.6f, 0.6f));
+
+	for (GLuint i = 0; i < room_instances.size(); i++)
+	{
+		room_instances[i].normalmatrix = transpose(inverse(mat3(room_instances[i].model)));
+		room_instances[i].layer = room_layers[i];
+	}
+	room.create("quad:room", floor_data, 4, GL_TRIANGLE_FAN, room_instances);
+	glBindVertexArray(vao);
+
+	// The room's packet keeps an identity model, so its bounds are in world space
+	render_queue.packet(room_packet).centre = room.bounds.centre;
+	render_queue.packet(room_packet).radius = room.bounds.radius;
+	if (occlusion_queries) render_queue.enableOcclusionQueries(&shaders[8]);
+
+	// Lamppost, table and particles cast shadows onto the room and the static meshes
+	if (cube_shadows)
+	{
+		shadow_map.create(shadow_map_size ? shadow_map_size : 1024, SHADOW_MAP_CUBE);
+		shadow_map.bias = 0.002f;
+	}
+	else
+		shadow_map.create(shadow_map_size ? shadow_map_size : 2048, SHADOW_MAP_2D);
+	shadow_map.pcfRadius = shadow_pcf_radius;
+	render_queue.setShadowMap(&shadow_map);
+
+	// The fairy lights hang in swags along the back wall, then the side wall
+	fairy_lights.resize(num_fairy_lights);
+	for (GLuint i = 0; i < num_fairy_lights; i++)
+	{
+		GLfloat t = (i + 0.5f) / num_fairy_lights;
+		GLfloat sag = 0.35f * sinf(3.14159265f * fmodf(t * 8.f, 1.f));
+		if (t < 0.6f) fairy_lights[i].position = vec3(-4.5f + 6.9f * t / 0.6f, 1.5f - sag, -1.95f);
+		else fairy_lights[i].position = vec3(2.45f, 1.5f - sag, -1.95f + 4.f * (t - 0.6f) / 0.4f);
+		fairy_lights[i].radius = 0.6f;
+		fairy_lights[i].colour = FAIRY_COLOURS[i % 4];
+	}
+	if (num_fairy_lights)
+	{
+		light_clusters.create();
+		render_queue.setLightClusters(&light_clusters);
+	}
+
+	asset_zone = profiler.addZone("asset uploads");
+	animation_zone = profiler.addZone("particle animation");
+	shadow_pass_zone = profiler.addZone("shadow pass");
+	light_binning_zone = profiler.addZone("light binning");
+	render_queue.setProfiler(&profiler, shadow_pass_zone);
+
+	if (deterministic) assets->finish();
 
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -319,13 +537,135 @@ void init(GLWrapper *glw)
 	cout << "Turn snowglobe: Q W, E R, T Y" << endl;
 	cout << "Step back: K L" << endl;
 	cout << "Change drawmode: N" << endl;
+	cout << "Print GL call counts: G" << endl;
+	cout << "Print mesh memory: M" << endl;
 	cout << "Exit: ESC" << endl;
 }
 
+/* Called at the start and end of each frame with --bench-shadows. The
+   first half of the timed frames throw the shadow map away so it is drawn
+   every frame, the second half use the cached map. Frame times include
+   the GPU because the end of the frame waits for it to finish */
+void benchmarkShadows(bool frameEnd)
+{
+	static GLuint frame = 0;
+	static chrono::steady_clock::time_point start;
+	static double total_ms[2] = { 0, 0 };
+	static GLuint shadow_passes[2] = { 0, 0 };
+
+	// Time only once everything has been uploaded and drawn a few times
+	if (assets->pending()) return;
+	bool timed = frame >= BENCH_WARMUP_FRAMES;
+	GLuint cached = frame >= BENCH_WARMUP_FRAMES + bench_shadow_frames ? 1 : 0;
+
+	if (!frameEnd)
+	{
+		if (timed && !cached) shadow_map.invalidate();
+		start = chrono::steady_clock::now();
+		return;
+	}
+
+	glFinish();
+	if (timed)
+	{
+		total_ms[cached] += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		shadow_passes[cached] += render_queue.stats.shadowPasses;
+	}
+
+	if (++frame == BENCH_WARMUP_FRAMES + 2 * bench_shadow_frames)
+	{
+		printf("Shadow benchmark: %s map %ux%u, PCF radius %d, %u frames each\n", cube_shadows ? "cube" : "2D",
+			shadow_map.size, shadow_map.size, shadow_map.pcfRadius, bench_shadow_frames);
+		printf("  cold (redrawn every frame): %.3f ms per frame, %u shadow passes\n", total_ms[0] / bench_shadow_frames, shadow_passes[0]);
+		printf("  cached (reused):            %.3f ms per frame, %u shadow passes\n", total_ms[1] / bench_shadow_frames, shadow_passes[1]);
+		glfwSetWindowShouldClose(glfwGetCurrentContext(), GL_TRUE);
+	}
+}
+
 /* Called to update the display. Note that this function is called in the event loop in the wrapper
    class because we registered display as a callback function */
+static void keyCallback(GLFWwindow* window, int key, int s, int action, int mods);
+static bool sceneIdle();
+
+/* Set the scene from the benchmark timeline; channels it does not have
+   keep their values */
+static void applyTimeline(GLuint frame)
+{
+	GLfloat f = (GLfloat)frame;
+	vx = bench_timeline.sample("vx", f, vx);
+	vy = bench_timeline.sample("vy", f, vy);
+	vz = bench_timeline.sample("vz", f, vz);
+	step_back = bench_timeline.sample("step_back", f, step_back);
+	angle_x = bench_timeline.sample("angle_x", f, angle_x);
+	angle_y = bench_timeline.sample("angle_y", f, angle_y);
+	angle_z = bench_timeline.sample("angle_z", f, angle_z);
+	angle_inc_x = bench_timeline.sample("angle_inc_x", f, angle_inc_x);
+	angle_inc_y = bench_timeline.sample("angle_inc_y", f, angle_inc_y);
+	angle_inc_z = bench_timeline.sample("angle_inc_z", f, angle_inc_z);
+	light_x = bench_timeline.sample("light_x", f, light_x);
+	light_y = bench_timeline.sample("light_y", f, light_y);
+	light_z = bench_timeline.sample("light_z", f, light_z);
+
+	// The cached shadow map holds the particles that were drawn
+	GLuint count = (GLuint)bench_timeline.sample("particles", f, (GLfloat)particle_count);
+	if (count != particle_count) shadow_map.invalidate();
+	particle_count = count;
+}
+
+/* Replace edited programs in place, so the packets pointing at them draw
+   with the new program and the Shader constructor binds its blocks again */
+static void reloadShaders()
+{
+	for (const ReloadedProgram &reloaded : shader_reloader->poll())
+	{
+		// An identical variant added twice is one program in more than one slot
+		GLuint old = 0;
+		for (GLuint i = 0; i < NUM_OF_SHADERS; i++)
+		{
+			if (shader_programs[i] != reloaded.index) continue;
+			old = shaders[i].shaderID;
+			shaders[i] = Shader(reloaded.program);
+		}
+		glDeleteProgram(old);
+
+		// The cached shadow map was drawn by the old programs
+		shadow_map.invalidate();
+	}
+}
+
 void display()
 {
+	/* Start counting GL calls for this frame */
+	last_frame_calls = glCalls;
+	glCalls.reset();
+	profiler.beginFrame();
+
+	if (shader_reloader) reloadShaders();
+
+	/* Scripted and recorded input for this frame */
+	if (benchmark)
+	{
+		if (frame_number == BENCH_WARMUP_FRAMES)
+		{
+			frame_pacer->resetStats();
+			profiler.resetStats();
+		}
+		applyTimeline(frame_number);
+	}
+	if (play_input)
+	{
+		for (const InputEvent &event : input_log.eventsFor(frame_number))
+			keyCallback(main_window, event.key, event.scancode, event.action, event.mods);
+	}
+
+	/* Upload any assets the loader threads have finished with */
+	{
+		ProfileScope scope(&profiler, asset_zone);
+		assets->pump(UPLOAD_BUDGET_MS);
+	}
+
+	if (bench_shadow_frames) benchmarkShadows(false);
+
 	/* Define the background colour */
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
@@ -354,291 +694,229 @@ void display()
 	// Define the light position and transform by the view matrix
 	vec4 lightpos = view * vec4(light_x, light_y, light_z, 1.0);
 
-	// Draw light
-	program = &shaders[1];
-	glUseProgram(program->shaderID);
+	render_queue.setFrame(view, projection, lightpos, colourmode, 100.f);
 
-	glBindTexture(GL_TEXTURE_2D, texID);
+	// The fairy lights twinkle, each at its own phase, and are binned for this
+	// view. The twinkle holds still while the scene is idle, when adaptive
+	// pacing drops to a few frames a second
+	if (!sceneIdle()) twinkle_frame++;
+	if (!fairy_lights.empty())
+	{
+		ProfileScope scope(&profiler, light_binning_zone);
+		for (GLuint i = 0; i < fairy_lights.size(); i++)
+			fairy_lights[i].colour = FAIRY_COLOURS[i % 4] * (0.7f + 0.3f * sinf(twinkle_frame * 0.05f + i * 1.7f));
+		light_clusters.update(fairy_lights, view, projection, 0.1f, 20.f, (GLuint)viewport_width, (GLuint)viewport_height);
+	}
 
+	// Both maps are drawn again only if the light has moved. The spot map
+	// relies on the light sitting above everything it lights, so a wide
+	// frustum looking down covers the table and the room's floor
+	if (cube_shadows)
+		shadow_map.placeAt(vec3(light_x, light_y, light_z), 0.02f, 10.f);
+	else
+		shadow_map.lookFrom(vec3(light_x, light_y, light_z), vec3(0, -1, 0), 120.f, 0.05f, 10.f);
+
+	// Light marker
 	mat4 model = mat4(1.0f);
 	model = rotate(model, -radians(angle_x), vec3(1, 0, 0));
 	model = rotate(model, -radians(angle_y), vec3(0, 1, 0));
 	model = rotate(model, -radians(angle_z), vec3(0, 0, 1));
 	model = translate(model, vec3(light_x, light_y, light_z));
 	model = scale(model, vec3(0.05f, 0.05f, 0.05f));
+	render_queue.packet(light_packet).model = model;
 
-	glUniform1ui(program->colourmodeID, colourmode);
-	glUniformMatrix4fv(program->viewID, 1, GL_FALSE, &view[0][0]);
-	glUniformMatrix4fv(program->projectionID, 1, GL_FALSE, &projection[0][0]);
-	glUniform1f(program->alphaValueID, alphaValue);
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
-	glUniform4fv(program->lightposID, 1, value_ptr(lightpos));
-
-	/* Draw our lightposition sphere  with emit mode on*/
-	emitmode = 1;
-	glUniform1ui(program->emitmodeID, emitmode);
-	aSphere.drawSphere(drawmode);
-	emitmode = 0;
-	glUniform1ui(program->emitmodeID, emitmode);
-
-	/* Make the compiled shader program current */
-	// Draw lamppost
-	program = &shaders[0];
-	glUseProgram(program->shaderID);
+	// The lamppost and table share a packet, so each is culled in the batch
+	Frustum frustum(projection * view);
 
-	// Define the model transformations for the object
+	// Lamppost
 	model = mat4(1.0f);
 	model = rotate(model, -radians(angle_x), vec3(1, 0, 0)); 
 	model = rotate(model, -radians(angle_y), vec3(0, 1, 0)); 
 	model = rotate(model, -radians(angle_z), vec3(0, 0, 1));
 	model = translate(model, vec3(x, y - 0.1f, z));
 	model = scale(model, vec3(scaler / 5.f, scaler / 5.f, scaler / 5.f));
+	DrawData draw_data;
+	if (lamppost_draw != NO_DRAW)
+	{
+		const LODLevel &lod = lamppost.lods[lamppost.selectLOD(model, view, projection, viewport_height)];
+		draw_data.model = model;
+		draw_data.setNormalMatrix(view * model);
+		draw_data.layer = LAMPPOST_LAYER;
+		draw_data.receiveShadow = 1.f;
+		static_batch.set(lamppost_draw, lod.indexOffset, lod.indexCount, draw_data);
+		static_batch.setVisible(lamppost_draw, frustum.sphereVisible(transformSphere(model, lamppost.boundCentre, lamppost.boundRadius)));
+	}
+	render_queue.packet(static_packet).model = model;
+	render_queue.packet(static_packet).shadowRevision = static_batch.revision();
 
-	// Send our uniforms variables to the currently bound shader,
-	glUniform1ui(program->colourmodeID, colourmode);
-	glUniformMatrix4fv(program->viewID, 1, GL_FALSE, &view[0][0]);
-	glUniformMatrix4fv(program->projectionID, 1, GL_FALSE, &projection[0][0]);
-	glUniform1f(program->alphaValueID, alphaValue);
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
-	glUniform4fv(program->lightposID, 1, value_ptr(lightpos));
-
-	// Use the lamppost texture
-	glBindTexture(GL_TEXTURE_2D, texID);
-
-	/* Draw our Blender lamppost object */
-	lamppost.drawObject(drawmode);
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// Draw table
-	// Define the model transformations for the object
+	// Table
 	model = mat4(1.0f);
 	model = translate(model, vec3(x, y - 0.1f, z)); // - 0.8f
 	model = translate(model, vec3(0.f, -2.f, 0.f)); // - 0.8f
 	model = scale(model, vec3(scaler / 2.f, scaler / 2.f, scaler / 2.f));
 	model = rotate(model, -radians(90.f), vec3(0, 1, 0));
-
-	// Send our uniforms variables to the currently bound shader,
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
-
-	// Use the table texture
-	glBindTexture(GL_TEXTURE_2D, table_texID);
-	table.drawObject(drawmode);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// Particle shadows
-	program = &shaders[4];
-	glUseProgram(program->shaderID);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// Define the model transformations 
-	model = mat4(1.0f);
-	model = translate(model, vec3(x, y, z));
-	model = scale(model, vec3(scaler * 5, scaler * 5, scaler * 5));//scale equally in all axis
-
-	model = translate(model, vec3(0.f, -0.19f, 0.f));
-	// Calculate the shadow matrix from light position and plane normal
-	mat4 shadow = shadow_matrix(vec4(light_x, light_y, light_z, 1.0), vec4(0, 1.0, 0, 0.0));
-	model = model * shadow;
-
-	// Send uniforms to shadow shader
-	glUniformMatrix4fv(program->viewID, 1, GL_FALSE, &view[0][0]);
-	glUniformMatrix4fv(program->projectionID, 1, GL_FALSE, &projection[0][0]);
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
-
-	//point_anim->updateAngle(angle_x, angle_y, angle_z, rotation_matrix);
-	point_anim->draw();
+	if (table_draw != NO_DRAW)
+	{
+		const LODLevel &lod = table.lods[table.selectLOD(model, view, projection, viewport_height)];
+		draw_data.model = model;
+		draw_data.setNormalMatrix(view * model);
+		draw_data.layer = TABLE_LAYER;
+		draw_data.receiveShadow = 1.f;
+		static_batch.set(table_draw, lod.indexOffset, lod.indexCount, draw_data);
+		static_batch.setVisible(table_draw, frustum.sphereVisible(transformSphere(model, table.boundCentre, table.boundRadius)));
+	}
 
 	// Particle animation
-	glEnable(GL_BLEND);
-
-	// Switch to particle shader
-	program = &shaders[2];
-	glUseProgram(program->shaderID);
-
-	glBindTexture(GL_TEXTURE_2D, particle_texID);
-
-	// Define the model transformations 
 	model = mat4(1.0f);
 	model = translate(model, vec3(x, y, z));
 	model = scale(model, vec3(scaler * 5, scaler * 5, scaler * 5));
 	model = rotate(model, -radians(angle_x), vec3(1, 0, 0));
 	model = rotate(model, -radians(angle_y), vec3(0, 1, 0));
 	model = rotate(model, -radians(angle_z), vec3(0, 0, 1));
+	render_queue.packet(particle_packet).model = model;
+	render_queue.packet(particle_packet).pointSize = point_size;
+	render_queue.packet(particle_packet).shadowRevision = point_anim->revision;
 
 	mat4 rotation_matrix = mat4(1.f); // Passed to updateAngle to calculate inverse
 	rotation_matrix = rotate(rotation_matrix, -radians(angle_x), vec3(1, 0, 0));
 	rotation_matrix = rotate(rotation_matrix, -radians(angle_y), vec3(0, 1, 0));
 	rotation_matrix = rotate(rotation_matrix, -radians(angle_z), vec3(0, 0, 1));
-
-	// Send our uniforms variables to the currently bound shader,
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
-	glUniform1ui(program->colourmodeID, colourmode);
-	glUniform1f(program->point_sizeID, point_size);
-	glUniformMatrix4fv(program->viewID, 1, GL_FALSE, &view[0][0]);
-	glUniformMatrix4fv(program->projectionID, 1, GL_FALSE, &projection[0][0]);
-
 	point_anim->updateAngle(angle_x, angle_y, angle_z, rotation_matrix);
-	point_anim->draw();
-	point_anim->animate();
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// Draw floor
-	program = &shaders[3];
-	glUseProgram(program->shaderID);
-	
-	glBindTexture(GL_TEXTURE_2D, floor_texID);
-
-	// Define the model transformations 
-	model = mat4(1.0f);
-	model = translate(model, vec3(-1.3f, -3.f, 0.7f));
-	model = scale(model, vec3(1.4f, 1.0f, 1.f));
-
-	// Send our uniforms variables to the currently bound shader,
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
-	glUniform1ui(program->colourmodeID, colourmode);
-	glUniformMatrix4fv(program->viewID, 1, GL_FALSE, &view[0][0]);
-	glUniformMatrix4fv(program->projectionID, 1, GL_FALSE, &projection[0][0]);
-	glUniform4fv(program->lightposID, 1, value_ptr(lightpos));
-
-	mat3 normalmatrix = transpose(inverse(mat3(view * model)));
-	glUniformMatrix3fv(program->normalmatrixID, 1, GL_FALSE, &normalmatrix[0][0]);
-
-	glBindBuffer(GL_ARRAY_BUFFER, floor_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(floor_data), floor_data, GL_STATIC_DRAW);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)(0));
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(12 * sizeof(float)));
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)(24 * sizeof(float)));
-
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-
-	// Draw back wall
-	glBindTexture(GL_TEXTURE_2D, back_wall_texID);
-
-	// Define the model transformations 
-	model = mat4(1.0f);
-	model = translate(model, vec3(-1.3f, -0.3f, -2.f));	
-	model = rotate(model, -radians(-90.f), vec3(1, 0, 0)); 
-	model = scale(model, vec3(1.4f, 1.0f, 1.f));
-
-	// Send our uniforms variables to the currently bound shader,
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
-
-	glBindBuffer(GL_ARRAY_BUFFER, back_wall_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(floor_data), floor_data, GL_STATIC_DRAW);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)(0));
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(12 * sizeof(float)));
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)(24 * sizeof(float)));
-
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-
-	// Draw side wall
-	glBindTexture(GL_TEXTURE_2D, back_wall_texID);
 
-	// Define the model transformations 
+	// Snowglobe, blended after everything it contains
 	model = mat4(1.0f);
-	model = translate(model, vec3(2.5f, -0.3f, 0.7f));
-	model = rotate(model, -radians(-90.f), vec3(0, 1, 0));
-	model = rotate(model, -radians(-90.f), vec3(1, 0, 0));
-	model = scale(model, vec3(1.f, 1.f, 1.f));
-
-	// Send our uniforms variables to the currently bound shader,
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
-
-	glBindBuffer(GL_ARRAY_BUFFER, side_wall_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(floor_data), floor_data, GL_STATIC_DRAW);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)(0));
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(12 * sizeof(float)));
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)(24 * sizeof(float)));
-
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	model = translate(model, vec3(x, y, z));
+	model = scale(model, vec3(scaler / 1.2f, scaler / 1.2f, scaler / 1.2f));//scale equally in all axis
+	model = rotate(model, -radians(angle_x), vec3(1, 0, 0)); //rotating in clockwise direction around x-axis
+	model = rotate(model, -radians(angle_y), vec3(0, 1, 0)); //rotating in clockwise direction around y-axis
+	model = rotate(model, -radians(angle_z), vec3(0, 0, 1)); //rotating in clockwise direction around z-axis
+	render_queue.packet(globe_packet).model = model;
+	render_queue.packet(globe_packet).alpha = alphaValue;
 
-	// Draw window
-	glBindTexture(GL_TEXTURE_2D, window_texID);
+	render_queue.execute();
 
-	// Define the model transformations 
-	model = mat4(1.0f);
-	model = translate(model, vec3(2.499f, 0.5f, 0.7f));
-	model = rotate(model, -radians(-90.f), vec3(0, 1, 0));
-	model = rotate(model, -radians(-90.f), vec3(1, 0, 0));
-	model = scale(model, vec3(0.6f, 0.6f, 0.6f));
-
-	// Send our uniforms variables to the currently bound shader,
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
+	if (!bench_shadow_frames)
+	{
+		ProfileScope scope(&profiler, animation_zone);
+		if (!snow_paused) point_anim->animate();
+	}
+	else benchmarkShadows(true);
 
-	glBindBuffer(GL_ARRAY_BUFFER, window_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(floor_data), floor_data, GL_STATIC_DRAW);
+	/* Modify our animation variables */
+	angle_x += angle_inc_x;
+	angle_y += angle_inc_y;
+	angle_z += angle_inc_z;	
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)(0));
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(12 * sizeof(float)));
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)(24 * sizeof(float)));
+	profiler.endFrame();
+	frame_number++;
+}
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
+/* Capture each frame, and save the last headless frame, which is resolved
+   but not yet overwritten */
+static void frameDone(unsigned int frame)
+{
+	if (frame_capture.isCapturing())
+		frame_capture.capture(offscreen_target ? offscreen_target->resolvedFramebuffer() : 0);
+	if (headless_output && offscreen_target && frame + 1 == frame_limit && offscreen_target->save(headless_output))
+		printf("Wrote frame %u to %s\n", frame, headless_output);
+}
 
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+static void writeJSONString(FILE *file, const char *s)
+{
+	fputc('"', file);
+	for (; s && *s; s++)
+	{
+		if (*s == '"' || *s == '\\') fputc('\\', file);
+		if ((unsigned char)*s >= 0x20) fputc(*s, file);
+	}
+	fputc('"', file);
+}
 
-	// Snowglobe
-	// Note: Needs to be last because of Blending
-	program = &shaders[1];
-	glUseProgram(program->shaderID);
+/* Benchmark results as JSON, with what is needed to tell runs apart */
+static void writeBenchmarkResults()
+{
+	FILE *file = bench_json ? fopen(bench_json, "w") : stdout;
+	if (!file)
+	{
+		printf("Could not write %s\n", bench_json);
+		return;
+	}
 
-	glBindTexture(GL_TEXTURE_2D, texID);
+	fprintf(file, "{\n\t\"scene\": \"snowglobe\",\n\t\"timeline\": ");
+	writeJSONString(file, bench_timeline_file ? bench_timeline_file : "default");
+	fprintf(file, ",\n\t\"input_log\": ");
+	if (play_input) writeJSONString(file, play_input);
+	else fprintf(file, "null");
+	fprintf(file, ",\n\t\"frames\": %u,\n\t\"warmup_frames\": %u,\n", frame_number, BENCH_WARMUP_FRAMES);
+	fprintf(file, "\t\"width\": %d,\n\t\"height\": %d,\n\t\"headless\": %s,\n", frame_width, frame_height,
+		offscreen_target ? "true" : "false");
+	fprintf(file, "\t\"shadows\": \"%s\",\n\t\"occlusion_queries\": %s,\n", cube_shadows ? "cube" : "spot",
+		occlusion_queries ? "true" : "false");
+
+	const char *strings[3] = { "vendor", "renderer", "version" };
+	GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	fprintf(file, "\t\"gl\": {");
+	for (GLuint i = 0; i < 3; i++)
+	{
+		fprintf(file, "%s \"%s\": ", i ? "," : "", strings[i]);
+		writeJSONString(file, (const char *)glGetString(names[i]));
+	}
+	fprintf(file, " },\n\t\"frame_times\": ");
+	frame_pacer->writeJSON(file);
+	fprintf(file, ",\n\t\"profile\": ");
+	profiler.writeJSON(file);
+	fprintf(file, "\n}\n");
 
-	/* Define the model transformations for our sphere */
-	model = mat4(1.0f);
-	model = translate(model, vec3(x, y, z));
-	model = scale(model, vec3(scaler / 1.2f, scaler / 1.2f, scaler / 1.2f));//scale equally in all axis
-	model = rotate(model, -radians(angle_x), vec3(1, 0, 0)); //rotating in clockwise direction around x-axis
-	model = rotate(model, -radians(angle_y), vec3(0, 1, 0)); //rotating in clockwise direction around y-axis
-	model = rotate(model, -radians(angle_z), vec3(0, 0, 1)); //rotating in clockwise direction around z-axis
+	if (file != stdout)
+	{
+		fclose(file);
+		printf("Wrote benchmark results to %s\n", bench_json);
+	}
+}
 
-	glUniform1ui(program->colourmodeID, colourmode);
-	glUniformMatrix4fv(program->viewID, 1, GL_FALSE, &view[0][0]);
-	glUniformMatrix4fv(program->projectionID, 1, GL_FALSE, &projection[0][0]);
-	glUniform1f(program->alphaValueID, alphaValue);
-	glUniformMatrix4fv(program->modelID, 1, GL_FALSE, &model[0][0]);
-	
-	glEnable(GL_BLEND);
+/* Read back the frames still in flight before the context goes */
+static void loopExit()
+{
+	if (frame_capture.isCapturing())
+	{
+		frame_capture.finish();
+		frame_capture.report("Frame capture");
+	}
+	if (record_input && input_log.save(record_input))
+		printf("Recorded %zu key events to %s\n", input_log.events.size(), record_input);
+	if (benchmark) writeBenchmarkResults();
 
-	aSphere.drawSphere(drawmode);
+	// The worker's context must go before the window it shares with
+	delete shader_reloader;
+	shader_reloader = NULL;
+}
 
-	//glBindTexture(GL_TEXTURE_2D, 0);
-	glDisable(GL_BLEND);
+static bool hasSuffix(const char *s, const char *suffix)
+{
+	size_t n = strlen(s), m = strlen(suffix);
+	return n >= m && strcmp(s + n - m, suffix) == 0;
+}
 
-	/* Modify our animation variables */
-	angle_x += angle_inc_x;
-	angle_y += angle_inc_y;
-	angle_z += angle_inc_z;	
+/* Nothing on screen changes from one frame to the next */
+static bool sceneIdle()
+{
+	return snow_paused && angle_inc_x == 0 && angle_inc_y == 0 && angle_inc_z == 0 && assets->pending() == 0;
 }
 
 /* Called whenever the window is resized. The new window size is given, in pixels. */
 static void reshape(GLFWwindow* window, int w, int h)
 {
 	glViewport(0, 0, (GLsizei)w, (GLsizei)h);
+	viewport_height = (GLfloat)h;
+	viewport_width = (GLfloat)w;
 	aspect_ratio = ((float)w / 640.f*4.f) / ((float)h / 480.f*3.f);
 }
 
 /* change view angle, exit upon ESC */
 static void keyCallback(GLFWwindow* window, int key, int s, int action, int mods)
 {
+	if (record_input) input_log.record(frame_number, key, s, action, mods);
+
 	/* Enable this call if you want to disable key responses to a held down key*/
 	//if (action != GLFW_PRESS) return;
 
@@ -678,6 +956,39 @@ static void keyCallback(GLFWwindow* window, int key, int s, int action, int mods
 	if (key == 'K') step_back += 1.f;
 	if (key == 'L') step_back -= 1.f;
 
+	/* Print the GL calls made in the last frame */
+	if (key == 'G' && action == GLFW_PRESS)
+	{
+		last_frame_calls.print("Last frame");
+		render_queue.stats.print("Render queue");
+		if (!fairy_lights.empty()) light_clusters.report();
+	}
+
+	/* Print the GPU memory held by meshes */
+	if (key == 'M' && action == GLFW_PRESS)
+	{
+		meshCache().report();
+		printf("Static mesh arena: %u meshes, %.1f KB\n", static_meshes.numMeshes(), static_meshes.byteSize() / 1024.0);
+	}
+
+	/* Pause and resume the snowfall */
+	if (key == 'S' && action == GLFW_PRESS) snow_paused = !snow_paused;
+
+	/* Print the time spent in each part of the frame, turning the profiler
+	   on if it was off */
+	if (key == 'H' && action == GLFW_PRESS)
+	{
+		if (profiler.isEnabled()) profiler.report("Frame profile");
+		else
+		{
+			printf("Profiling enabled, press H again for the report\n");
+			profiler.setEnabled(true);
+		}
+	}
+
+	/* Print the achieved frame times */
+	if (key == 'F' && action == GLFW_PRESS) frame_pacer->report("Frame pacing");
+
 	/* Cycle between drawing vertices, mesh and filled polygons */
 	if (key == 'N' && action != GLFW_PRESS)
 	{
@@ -692,7 +1003,80 @@ static void keyCallback(GLFWwindow* window, int key, int s, int action, int mods
 /* Entry point of program */
 int main(int argc, char* argv[])
 {
-	GLWrapper *glw = new GLWrapper(1024, 768, "Snowglobe");;
+	/* Time cold and warm texture loads without opening a window */
+	if (argc > 1 && strcmp(argv[1], "--bench-textures") == 0)
+	{
+		benchmarkTextureLoads(texture_filenames, NUM_OF_TEXTURES, 0, false);
+		benchmarkTextureLoads(room_texture_filenames, NUM_OF_ROOM_LAYERS, 0, false);
+		return 0;
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--shadow-size") == 0 && i + 1 < argc) shadow_map_size = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--pcf") == 0 && i + 1 < argc) shadow_pcf_radius = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--spot-shadows") == 0) cube_shadows = false;
+		else if (strcmp(argv[i], "--occlusion-queries") == 0) occlusion_queries = true;
+		else if (strcmp(argv[i], "--bench-shadows") == 0)
+			bench_shadow_frames = (i + 1 < argc && atoi(argv[i + 1]) > 0) ? atoi(argv[++i]) : 200;
+		else if (strcmp(argv[i], "--profile") == 0) profiler.setEnabled(true);
+		else if (strcmp(argv[i], "--headless") == 0)
+			headless_frames = (i + 1 < argc && atoi(argv[i + 1]) > 0) ? atoi(argv[++i]) : 300;
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) headless_output = argv[++i];
+		else if (strcmp(argv[i], "--benchmark") == 0)
+		{
+			benchmark = true;
+			if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) bench_timeline_file = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-shader-cache") == 0) shader_cache_dir = "";
+		else if (strcmp(argv[i], "--hot-reload") == 0) hot_reload = true;
+		else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+			num_fairy_lights = min((GLuint)atoi(argv[++i]), (GLuint)LightClusters::MAX_LIGHTS);
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) bench_frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) bench_json = argv[++i];
+		else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc) record_input = argv[++i];
+		else if (strcmp(argv[i], "--play-input") == 0 && i + 1 < argc) play_input = argv[++i];
+		else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) capture_target = argv[++i];
+		else if (strcmp(argv[i], "--capture-pipe") == 0 && i + 1 < argc)
+		{
+			capture_target = argv[++i];
+			capture_pipe = true;
+		}
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+		{
+			if (sscanf(argv[++i], "%dx%d", &frame_width, &frame_height) != 2 || frame_width <= 0 || frame_height <= 0)
+			{
+				printf("Expected --size WIDTHxHEIGHT, not %s\n", argv[i]);
+				frame_width = 1024;
+				frame_height = 768;
+			}
+		}
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) target_fps = atof(argv[++i]);
+		else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc)
+		{
+			if (!parseFramePacing(argv[++i], frame_pacing))
+				printf("Unknown pacing %s, expected none, vsync, limit or adaptive\n", argv[i]);
+		}
+	}
+
+	if (benchmark)
+	{
+		bool loaded = bench_timeline_file ? bench_timeline.load(bench_timeline_file) : bench_timeline.parse(DEFAULT_TIMELINE);
+		if (!loaded) return 1;
+		if (!bench_frames) bench_frames = bench_timeline.length();
+		profiler.setEnabled(true);
+
+		// Percentiles over every measured frame, as the averages are
+		profiler.setHistory(bench_frames);
+	}
+	if (play_input && !input_log.load(play_input)) return 1;
+	deterministic = headless_frames || benchmark || play_input;
+	frame_limit = benchmark ? bench_frames : headless_frames;
+
+	// Benchmarks and headless runs draw frames back to back
+	if (bench_shadow_frames || headless_frames || benchmark) frame_pacing = FRAME_PACING_NONE;
+
+	GLWrapper *glw = new GLWrapper(frame_width, frame_height, "Snowglobe", headless_frames > 0);
 
 	if (!ogl_LoadFunctions())
 	{
@@ -703,11 +1087,35 @@ int main(int argc, char* argv[])
 	glw->setRenderer(display);
 	glw->setKeyCallback(keyCallback);
 	glw->setReshapeCallback(reshape);
+	glw->setFPS(target_fps);
+	glw->setFramePacing(frame_pacing);
+	glw->setIdleCallback(sceneIdle);
+	frame_pacer = &glw->framePacer();
+	if (benchmark) frame_pacer->setHistory(bench_frames);
+	glw->setFrameCallback(frameDone);
+	glw->setExitCallback(loopExit);
+	glw->setFrameLimit(frame_limit);
+	offscreen_target = glw->offscreenTarget();
+	main_window = glw->getWindow();
+
+	// The window's framebuffer can differ from its size on high DPI displays
+	if (capture_target)
+	{
+		int capture_width = frame_width, capture_height = frame_height;
+		if (!headless_frames) glfwGetFramebufferSize(glw->getWindow(), &capture_width, &capture_height);
+		CaptureFormat format = CAPTURE_QOI;
+		if (capture_pipe || hasSuffix(capture_target, ".rgba")) format = CAPTURE_RGBA;
+		else if (hasSuffix(capture_target, ".yuv")) format = CAPTURE_YUV;
+		frame_capture.start(capture_width, capture_height, format, capture_target, capture_pipe);
+	}
 
 	init(glw);
 
 	glw->eventLoop();
+	frame_pacer->report("Frame pacing");
+	if (profiler.isEnabled()) profiler.report("Frame profile");
 
+	delete(assets);
 	delete(glw);
 	return 0;
 }
@@ -7,8 +7,10 @@ Iain Martin November 2018
 */
 
 #include "tiny_loader.h"
+#include "gl_counters.h"
 #include <iostream>
 #include <stdio.h>
+#include <algorithm>
 
 //Tinyobjloader library used to import models
 #ifndef TINYOBJLOADER_IMPLEMENTATION
@@ -19,6 +21,11 @@ Iain Martin November 2018
 using namespace std;
 using namespace glm;
 
+// Number of levels in each LOD chain, and the share of the previous level's
+// triangles each one keeps
+static const GLuint NUM_LODS = 5;
+static const GLfloat LOD_RATIO = 0.5f;
+
 // Debig print method to print out the attributres loaded from the obj file
 static  void PrintInfo(const tinyobj::attrib_t& attrib,
 	const vector<tinyobj::shape_t>& shapes,
@@ -34,6 +41,14 @@ TinyObjLoader::TinyObjLoader()
 	numVertices = 0;
 	numNormals = 0;
 	numTexCoords = 0;
+
+	boundRadius = 0;
+	currentLOD = 0;
+	fullDetailRadius = 300.f;
+
+	uploaded = false;
+	inArena = false;
+	colourOverridden = false;
 }
 
 TinyObjLoader::~TinyObjLoader()
@@ -41,8 +56,19 @@ TinyObjLoader::~TinyObjLoader()
 }
 
 
+/* Load and upload in one go on the calling thread */
 void TinyObjLoader::load_obj(string inputfile, bool debugPrint)
 {
+	parse_obj(inputfile, debugPrint);
+	upload();
+}
+
+
+/* Parse the obj file and build the LOD chain into CPU side arrays.
+   Makes no GL calls so it can run on an asset loader worker thread */
+void TinyObjLoader::parse_obj(string inputfile, bool debugPrint)
+{
+	sourceFile = inputfile;
 	tinyobj::attrib_t attrib;
 	vector<tinyobj::shape_t> shapes;
 	vector<tinyobj::material_t> materials;
@@ -79,16 +105,16 @@ void TinyObjLoader::load_obj(string inputfile, bool debugPrint)
 		cout << "\tEither create an Obj file with normals or add code to calculate the normals. " << endl;
 	}
 
-	vector<tinyobj::real_t> pVertices = attrib.vertices;
-	vector<tinyobj::real_t> pNormals = attrib.normals;
-	vector<tinyobj::real_t> pColors = attrib.colors;
-	vector<tinyobj::real_t> pTexCoords = attrib.texcoords;
+	pVertices = attrib.vertices;
+	pNormals = attrib.normals;
+	pColors = attrib.colors;
+	pTexCoords = attrib.texcoords;
 
 	numPIndexes = 0;
 	for (size_t s = 0; s < shapes.size(); s++) {
 		numPIndexes += shapes[s].mesh.num_face_vertices.size() * 3;//3 vertexes for each face
 	}
-	GLuint* pIndices = new GLuint[numPIndexes];
+	vector<GLuint> pIndices(numPIndexes);
 	
 	// Debug print if requested to
 	if (debugPrint)	PrintInfo(attrib, shapes, materials);
@@ -123,40 +149,110 @@ void TinyObjLoader::load_obj(string inputfile, bool debugPrint)
 	}
 
 
-	glGenBuffers(1, &positionBufferObject);
-	glBindBuffer(GL_ARRAY_BUFFER, positionBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, pVertices.size() * sizeof(tinyobj::real_t), &pVertices.front(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// Bounding sphere from the axis aligned bounds of the positions
+	vec3 bmin(0.f), bmax(0.f);
+	for (GLuint i = 0; i < numVertices; i++)
+	{
+		vec3 p(pVertices[i * 3], pVertices[i * 3 + 1], pVertices[i * 3 + 2]);
+		if (i == 0) bmin = bmax = p;
+		bmin = glm::min(bmin, p);
+		bmax = glm::max(bmax, p);
+	}
+	boundCentre = (bmin + bmax) * 0.5f;
+	boundRadius = 0;
+	for (GLuint i = 0; i < numVertices; i++)
+	{
+		vec3 p(pVertices[i * 3], pVertices[i * 3 + 1], pVertices[i * 3 + 2]);
+		boundRadius = glm::max(boundRadius, length(p - boundCentre));
+	}
 
-	glGenBuffers(1, &normalBufferObject);
-	glBindBuffer(GL_ARRAY_BUFFER, normalBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, pNormals.size() * sizeof(tinyobj::real_t), &pNormals.front(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// Build the LOD chain, or reuse the one cached next to the obj file
+	string cachefile = inputfile + ".lod";
+	unsigned long long key = hashMesh(&pVertices.front(), numVertices, pIndices, NUM_LODS, LOD_RATIO);
+	if (!loadLODCache(cachefile, key, lodIndices, lods))
+	{
+		buildLODChain(&pVertices.front(), numVertices, pIndices, NUM_LODS, LOD_RATIO, lodIndices, lods);
+		if (!saveLODCache(cachefile, key, lodIndices, lods))
+			cerr << "Could not write LOD cache " << cachefile << endl;
+	}
+	currentLOD = 0;
+}
 
-	glGenBuffers(1, &colourBufferObject);
-	glBindBuffer(GL_ARRAY_BUFFER, colourBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, pColors.size() * sizeof(tinyobj::real_t), &pColors.front(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	glGenBuffers(1, &elementBufferObject);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBufferObject);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, numPIndexes * sizeof(GLuint), pIndices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+/* Objects loaded from the same file share buffers unless their colours differ */
+string TinyObjLoader::meshKey() const
+{
+	if (!colourOverridden) return sourceFile;
 
-	if (numTexCoords > 0)
+	char colour[64];
+	snprintf(colour, sizeof(colour), "#colour(%g,%g,%g,%g)", colourOverride[0], colourOverride[1], colourOverride[2], colourOverride[3]);
+	return sourceFile + colour;
+}
+
+
+/* Create the buffer objects from the parsed data, must be called on the GL thread */
+void TinyObjLoader::upload()
+{
+	mesh = meshCache().acquire(meshKey(), [this](GPUMesh &m)
 	{
-		glGenBuffers(1, &texCoordsObject);
-		glBindBuffer(GL_ARRAY_BUFFER, texCoordsObject);
-		glBufferData(GL_ARRAY_BUFFER, pTexCoords.size() * sizeof(tinyobj::real_t), &pTexCoords.front(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-	}
+		m.createBuffer(GL_ARRAY_BUFFER, pVertices.size() * sizeof(tinyobj::real_t), &pVertices.front());
+		m.createBuffer(GL_ARRAY_BUFFER, pNormals.size() * sizeof(tinyobj::real_t), &pNormals.front());
 
-	delete pIndices;
+		if (colourOverridden)
+		{
+			vector<vec4> colours(numVertices, colourOverride);
+			m.createBuffer(GL_ARRAY_BUFFER, sizeof(vec4) * numVertices, &colours.front());
+		}
+		else
+			m.createBuffer(GL_ARRAY_BUFFER, pColors.size() * sizeof(tinyobj::real_t), &pColors.front());
+
+		m.createBuffer(GL_ELEMENT_ARRAY_BUFFER, lodIndices.size() * sizeof(GLuint), &lodIndices.front());
+
+		if (numTexCoords > 0)
+			m.createBuffer(GL_ARRAY_BUFFER, pTexCoords.size() * sizeof(tinyobj::real_t), &pTexCoords.front());
+
+		m.numVertices = numVertices;
+		m.numIndices = (GLuint)lodIndices.size();
+	});
+
+	positionBufferObject = mesh->buffers[0];
+	normalBufferObject = mesh->buffers[1];
+	colourBufferObject = mesh->buffers[2];
+	elementBufferObject = mesh->buffers[3];
+	if (numTexCoords > 0) texCoordsObject = mesh->buffers[4];
+
+	uploaded = true;
+}
+
+
+GLuint TinyObjLoader::addToArena(MeshArena &arena)
+{
+	// Use the same per-vertex values the separate buffers would give the shaders
+	vector<GLfloat> colours(numVertices * 4, 0.f);
+	for (GLuint i = 0; i < numVertices; i++)
+	{
+		for (GLuint c = 0; c < 4; c++)
+		{
+			if (colourOverridden) colours[i * 4 + c] = colourOverride[c];
+			else if (i * 4 + c < pColors.size()) colours[i * 4 + c] = pColors[i * 4 + c];
+		}
+	}
+	vector<GLfloat> normals(numVertices * 3, 0.f);
+	copy(pNormals.begin(), pNormals.begin() + glm::min(pNormals.size(), normals.size()), normals.begin());
+	vector<GLfloat> texcoords(numVertices * 2, 0.f);
+	copy(pTexCoords.begin(), pTexCoords.begin() + glm::min(pTexCoords.size(), texcoords.size()), texcoords.begin());
+
+	GLuint id = arena.addMesh(meshKey(), &pVertices.front(), &normals.front(), &colours.front(), &texcoords.front(),
+		numVertices, &lodIndices.front(), (GLuint)lodIndices.size());
+	inArena = true;
+	return id;
 }
 
 
 void TinyObjLoader::drawObject(int drawmode)
 {
+	// Nothing to draw until the asset loader has uploaded the buffers
+	if (!uploaded) return;
 
 	/* Draw the object as GL_POINTS */
 	glBindBuffer(GL_ARRAY_BUFFER, positionBufferObject);
@@ -198,27 +294,46 @@ void TinyObjLoader::drawObject(int drawmode)
 	}
 	else
 	{
-		glDrawElements(GL_TRIANGLES, numPIndexes, GL_UNSIGNED_INT, (GLvoid*)(0));
+		const LODLevel &lod = lods[currentLOD];
+		glDrawElements(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, (GLvoid*)(lod.indexOffset * sizeof(GLuint)));
 	}
 }
 
 
+/* Select the level of detail from the screen size of the bounding sphere.
+   With each level holding half the triangles of the previous one, halving
+   the projected radius drops one level so triangle count follows screen size */
+GLuint TinyObjLoader::selectLOD(const mat4 &model, const mat4 &view, const mat4 &projection, GLfloat viewport_height)
+{
+	vec4 centre = view * model * vec4(boundCentre, 1.f);
+	GLfloat scale = glm::max(length(vec3(model[0])), glm::max(length(vec3(model[1])), length(vec3(model[2]))));
+	GLfloat distance = -centre.z;
+
+	currentLOD = 0;
+	if (isUploaded() && distance > 0)
+	{
+		GLfloat radius = boundRadius * scale * projection[1][1] * viewport_height * 0.5f / distance;
+		while (currentLOD + 1 < lods.size() && radius < fullDetailRadius / (GLfloat)(1 << (currentLOD + 1)))
+			currentLOD++;
+	}
+	return currentLOD;
+}
+
+
 /**
  * If an object does not have colour values (e.g. through a material),
  * override the colours by setting the colours manually
  */
 void TinyObjLoader::overrideColour(glm::vec4 c)
 {
-	vec4 *pColours = new vec4[numVertices];
-	for (int i = 0; i < numVertices; i++)
-	{
-		pColours[i] = c;
-	}
-
-	glBindBuffer(GL_ARRAY_BUFFER, colourBufferObject);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * numVertices, pColours, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
+	colourOverride = c;
+	colourOverridden = true;
+	if (!uploaded) return;
+
+	// The coloured mesh is a different cache entry, other users of the
+	// previous buffers keep them
+	mesh.reset();
+	upload();
 }
 
 
@@ -9,6 +9,11 @@ Iain Martin November 2018
 #pragma once
 
 #include "wrapper_glfw.h"
+#include "mesh_lod.h"
+#include "mesh_arena.h"
+#include "mesh_cache.h"
+#include <memory>
+#include <string>
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -19,9 +24,39 @@ public:
 	~TinyObjLoader();
 
 	void load_obj(std::string inputfile, bool debugPrint = false);
+
+	// load_obj split in two so parsing can run on a worker thread
+	void parse_obj(std::string inputfile, bool debugPrint = false);
+
+	/* Take the buffers from the mesh cache, creating them only if no other
+	   object has loaded the same file with the same colours */
+	void upload();
+	bool isUploaded() const { return uploaded || inArena; }
+
+	/* Alternative to upload(): append the mesh to a shared arena for
+	   indirect drawing and return its mesh id there. Levels of detail are
+	   ranges of lods relative to the mesh's first index */
+	GLuint addToArena(MeshArena &arena);
+
 	void drawObject(int drawmode);
 	void overrideColour(glm::vec4 c);
 
+	/* Pick the level of detail for the next drawObject() call from the
+	   projected radius of the bounding sphere in pixels */
+	GLuint selectLOD(const glm::mat4 &model, const glm::mat4 &view, const glm::mat4 &projection, GLfloat viewport_height);
+
+	// Bounding sphere in object space, computed at load time
+	glm::vec3 boundCentre;
+	GLfloat boundRadius;
+
+	// LOD chain, all levels are ranges in elementBufferObject
+	std::vector<LODLevel> lods;
+	GLuint currentLOD;
+
+	// Projected radius (in pixels) at which level 0 is drawn, each halving
+	// of the radius drops one level
+	GLfloat fullDetailRadius;
+
 private:
 	// Define vertex buffer object names (e.g as globals)
 	GLuint positionBufferObject;
@@ -40,6 +75,22 @@ private:
 	GLuint numNormals;
 	GLint  numTexCoords;
 	GLuint numPIndexes;
-	
 
+	// Parsed data waiting for (and kept after) upload
+	std::vector<GLfloat> pVertices;
+	std::vector<GLfloat> pNormals;
+	std::vector<GLfloat> pColors;
+	std::vector<GLfloat> pTexCoords;
+	std::vector<GLuint> lodIndices;
+
+	// Key of the mesh in the mesh cache and the arena
+	std::string meshKey() const;
+
+	std::string sourceFile;
+	std::shared_ptr<GPUMesh> mesh;
+
+	bool uploaded;
+	bool inArena;
+	bool colourOverridden;
+	glm::vec4 colourOverride;
 };
@@ -0,0 +1,148 @@
+/**
+ * State change test for the render queue
+ * Queues a known set of packets on a hidden context and checks the order
+ * they are drawn in and the exact number of program, texture, blend and
+ * uniform block changes left after sorting and redundant state elimination.
+ * The GL calls themselves are counted too (gl_counters.h), so a state change
+ * issued without being recorded in the queue's stats is caught as well.
+ *
+ * Build from tools/render_queue_test.cpp together with common/render_queue.cpp,
+ * common/uniform_blocks.cpp, common/shader.cpp, common/shadow_map.cpp,
+ * common/light_clusters.cpp, common/frustum.cpp, common/frame_profiler.cpp,
+ * common/gl_counters.cpp, common/wrapper_glfw.cpp, common/frame_pacer.cpp and
+ * common/render_target.cpp (include path: common), linked with glload and GLFW.
+ *
+ * Usage: render_queue_test
+ *   Exits with 0 when every check passes.
+ */
+
+#include "wrapper_glfw.h"
+#include "render_queue.h"
+#include "gl_counters.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+using namespace glm;
+
+static int failures = 0;
+
+static void check(const char *what, GLuint value, GLuint expected)
+{
+	if (value == expected) return;
+	printf("FAIL %s: %u, expected %u\n", what, value, expected);
+	failures++;
+}
+
+static const char *VERTEX_SOURCE =
+	"#version 400\n"
+	"void main() { gl_Position = vec4(0.0, 0.0, 0.0, 1.0); }\n";
+static const char *FRAGMENT_SOURCE =
+	"#version 400\n"
+	"out vec4 outputColor;\n"
+	"void main() { outputColor = vec4(1.0); }\n";
+
+/* What each packet draws, recorded by its draw callback */
+static string drawn;
+
+static DrawPacket makePacket(Shader *pipeline, GLuint texture, GLuint material, GLfloat depth, char name)
+{
+	DrawPacket packet;
+	packet.pipeline = pipeline;
+	packet.textureTarget = GL_TEXTURE_2D;
+	packet.texture = texture;
+	packet.material = material;
+	packet.model = translate(mat4(1.f), vec3(0.f, 0.f, -depth));
+	packet.draw = [name]() { drawn += name; };
+	return packet;
+}
+
+int main(int argc, char *argv[])
+{
+	GLWrapper glw(64, 64, "Render queue test", true);
+
+	// The keys sort pipelines in the order the queue first meets them and
+	// textures by name. The program names are swapped so sorting by name
+	// would put the pipelines the other way round
+	GLuint programs[2] = { glw.BuildShaderProgram(VERTEX_SOURCE, FRAGMENT_SOURCE),
+		glw.BuildShaderProgram(VERTEX_SOURCE, FRAGMENT_SOURCE) };
+	sort(programs, programs + 2);
+	Shader first(programs[1]), second(programs[0]);
+
+	GLuint textures[2];
+	glGenTextures(2, textures);
+	sort(textures, textures + 2);
+	for (GLuint texture : textures) glBindTexture(GL_TEXTURE_2D, texture);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	RenderQueue queue;
+	MaterialUniforms material = {};
+	GLuint dull = queue.addMaterial(material);
+	material.diffuse = vec4(1.f);
+	GLuint bright = queue.addMaterial(material);
+
+	// Opaque packets, added out of order
+	queue.add(makePacket(&first, textures[0], dull, 2.f, 'A'));
+	queue.add(makePacket(&second, textures[0], bright, 4.f, 'B'));
+	queue.add(makePacket(&first, textures[1], dull, 1.f, 'C'));
+	queue.add(makePacket(&first, textures[0], dull, 3.f, 'D'));
+	queue.add(makePacket(&second, textures[0], bright, 5.f, 'E'));
+
+	// Transparent packets, drawn far to near whatever their state
+	DrawPacket packet = makePacket(&first, textures[1], dull, 6.f, 'G');
+	packet.transparent = true;
+	queue.add(packet);
+	packet = makePacket(&second, textures[1], dull, 8.f, 'F');
+	packet.transparent = true;
+	queue.add(packet);
+
+	// Hidden packets are neither drawn nor given a uniform block
+	packet = makePacket(&second, textures[1], bright, 7.f, 'H');
+	packet.visible = false;
+	queue.add(packet);
+
+	mat4 projection = perspective(radians(30.f), 1.f, 0.1f, 100.f);
+	queue.setFrame(mat4(1.f), projection, vec4(0.f, 0.f, 0.f, 1.f), 0, 100.f);
+
+	// Every frame starts from unknown state, so the second one must match the first
+	for (GLuint frame = 0; frame < 2; frame++)
+	{
+		printf("Frame %u\n", frame);
+		drawn.clear();
+		glCalls.reset();
+		queue.execute();
+		const RenderQueueStats &stats = queue.stats;
+
+		if (drawn != "ADCBEFG")
+		{
+			printf("FAIL draw order: %s, expected ADCBEFG\n", drawn.c_str());
+			failures++;
+		}
+
+		// first: A D (texture 0), C (texture 1); second: B E (texture 0);
+		// then F (second, texture 1) and G (first, texture 1) blended
+		check("program changes", stats.programChanges, 3);
+		check("texture changes", stats.textureChanges, 4);
+		check("blend changes", stats.blendChanges, 1);
+		check("draws", stats.draws, 7);
+
+		// One FrameData block and one ObjectData block per draw. Each draw
+		// selects its object block, and the material changes three times
+		check("uniform blocks", stats.uniformBlocks, 1 + 7);
+		check("uniform range binds", stats.uniformRangeBinds, 1 + 7 + 3);
+
+		check("glUseProgram calls", glCalls.programBinds, stats.programChanges);
+		check("glBindTexture calls", glCalls.textureBinds, stats.textureChanges);
+		check("GL draw calls", glCalls.drawCalls, 0);
+	}
+
+	glDeleteTextures(2, textures);
+	glDeleteProgram(programs[0]);
+	glDeleteProgram(programs[1]);
+
+	printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+	return failures ? 1 : 0;
+}
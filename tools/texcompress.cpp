@@ -0,0 +1,111 @@
+/**
+ * Offline texture compressor for the snowglobe project
+ * Transcodes images into block compressed KTX files with a full mip chain.
+ * The application picks up <image>.ktx next to an image automatically.
+ *
+ * Build from tools/texcompress.cpp together with common/bc_encoder.cpp,
+ * common/ktx.cpp and common/texture_cache.cpp (include path: common).
+ *
+ * Usage: texcompress [--bc1 | --bc3 | --bc7] [--threads N] [image ...]
+ *   With no images the textures used by the scene are converted.
+ *   By default RGB images become BC1 and RGBA images BC3.
+ */
+
+#include "bc_encoder.h"
+#include "ktx.h"
+#include "texture_cache.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace std;
+
+static const char *DEFAULT_IMAGES[] = { "images\\glass1.jpg", "images\\snowflake2.png", "images\\wooden_plank_2.jpg",
+	"images\\wooden_plank_3.jpg", "images\\wood_table_1.jpg", "images\\old_house_window.jpg" };
+
+static bool compressImage(const char *filename, int forcedFormat, unsigned int numThreads)
+{
+	int width, height, nrChannels;
+	unsigned char *data = stbi_load(filename, &width, &height, &nrChannels, 0);
+	if (!data)
+	{
+		cerr << "Could not load " << filename << ": " << stbi_failure_reason() << endl;
+		return false;
+	}
+
+	BCFormat format = (nrChannels == 4) ? BC_FORMAT_BC3 : BC_FORMAT_BC1;
+	if (forcedFormat >= 0) format = (BCFormat)forcedFormat;
+
+	GLenum internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	if (format == BC_FORMAT_BC3) internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	if (format == BC_FORMAT_BC7) internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+	GLenum baseFormat = (format == BC_FORMAT_BC1) ? GL_RGB : GL_RGBA;
+
+	// Mips are filtered from the uncompressed image, then each level is encoded
+	MipChain chain;
+	chain.build(data, width, height, nrChannels);
+	stbi_image_free(data);
+
+	auto start = chrono::steady_clock::now();
+	vector<vector<unsigned char> > levels(chain.levels.size());
+	double psnr = 0;
+	for (size_t i = 0; i < chain.levels.size(); i++)
+	{
+		const MipLevel &level = chain.levels[i];
+		levels[i].resize(bcImageSize(format, level.width, level.height));
+		encodeImage(format, chain.level((GLuint)i), level.width, level.height, nrChannels, levels[i].data(), numThreads);
+		if (i == 0)
+			psnr = imagePSNR(format, chain.level(0), level.width, level.height, nrChannels, levels[0].data());
+	}
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	size_t compressedSize = 0;
+	for (const auto &level : levels) compressedSize += level.size();
+
+	// GL stores RGB8 textures padded to four bytes per texel
+	size_t uncompressedSize = 0;
+	for (const auto &level : chain.levels) uncompressedSize += (size_t)level.width * level.height * 4;
+
+	const char *names[] = { "BC1", "BC3", "BC7" };
+	string outfile = string(filename) + ".ktx";
+	if (!writeKTX(outfile, internalFormat, baseFormat, width, height, levels))
+	{
+		cerr << "Could not write " << outfile << endl;
+		return false;
+	}
+
+	printf("%s: %dx%d %s, %zu levels, %.1f ms, PSNR %.2f dB, %zu KB -> %zu KB (%.1fx)\n",
+		filename, width, height, names[format], levels.size(), ms, psnr,
+		uncompressedSize / 1024, compressedSize / 1024, (double)uncompressedSize / compressedSize);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	int forcedFormat = -1;
+	unsigned int numThreads = 0;
+	vector<const char *> images;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--bc1") == 0) forcedFormat = BC_FORMAT_BC1;
+		else if (strcmp(argv[i], "--bc3") == 0) forcedFormat = BC_FORMAT_BC3;
+		else if (strcmp(argv[i], "--bc7") == 0) forcedFormat = BC_FORMAT_BC7;
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) numThreads = atoi(argv[++i]);
+		else images.push_back(argv[i]);
+	}
+	if (images.empty())
+		images.assign(DEFAULT_IMAGES, DEFAULT_IMAGES + sizeof(DEFAULT_IMAGES) / sizeof(DEFAULT_IMAGES[0]));
+
+	int failures = 0;
+	for (const char *image : images)
+		if (!compressImage(image, forcedFormat, numThreads)) failures++;
+
+	return failures ? 1 : 0;
+}